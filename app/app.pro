@@ -50,6 +50,7 @@ SOURCES += \
     src/plugins/mprisremote/mprisremoteplugin.cpp \
     src/models/mprisplayersmodel.cpp \
     src/plugins/sendnotifications/notificationslistener.cpp \
+    src/plugins/sendnotifications/notificationiconcache.cpp \
     src/plugins/sendnotifications/notifyingapplication.cpp \
     src/plugins/sendnotifications/sendnotificationsplugin.cpp \
     src/plugins/touchpad/touchpadplugin.cpp \
@@ -112,6 +113,7 @@ HEADERS += \
     src/plugins/mprisremote/mprisremoteplugin.h \
     src/models/mprisplayersmodel.h \
     src/plugins/sendnotifications/notificationslistener.h \
+    src/plugins/sendnotifications/notificationiconcache.h \
     src/plugins/sendnotifications/notifyingapplication.h \
     src/plugins/sendnotifications/sendnotificationsplugin.h \
     src/plugins/touchpad/touchpadplugin.h \
@@ -157,7 +157,7 @@ Column {
 
                         Connections {
                             target: player
-                            onPropertiesChanged: positionSlider.value = player.position
+                            onPositionChanged: positionSlider.value = player.position
                         }
 
                         Component.onCompleted: {
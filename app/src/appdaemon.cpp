@@ -30,6 +30,7 @@
 #include <sailfishconnect/backend/pairinghandler.h>
 #include <sailfishconnect/device.h>
 #include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/helper/tracing.h>
 #include <sailfishconnect/systeminfo.h>
 
 namespace SailfishConnect {
@@ -73,6 +74,7 @@ AppDaemon::AppDaemon(QObject* parent)
     : Daemon(makeUniquePtr<SailfishOsConfig>(), parent)
     , m_contacts(new ContactsManager(this))
 {
+    SC_TRACE_SCOPE("AppDaemon::AppDaemon");
     notification_.setAppName(PRETTY_PACKAGE_NAME);
     notification_.setCategory("device");
 
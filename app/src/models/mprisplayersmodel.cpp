@@ -24,15 +24,20 @@
 #include <sailfishconnect/daemon.h>
 #include <sailfishconnect/device.h>
 #include <sailfishconnect/helper/cpphelper.h>
-#include "../plugins/mprisremote/mprisremoteplugin.h"
 
 namespace SailfishConnect {
 
 static Q_LOGGING_CATEGORY(logger, "sailfishconnect.mpris-players-model")
 
+constexpr int MprisPlayersModel::UPDATE_INTERVAL;
+
 MprisPlayersModel::MprisPlayersModel(QObject *parent)
     : QAbstractListModel(parent)
 {
+    m_updateTimer.setSingleShot(true);
+    m_updateTimer.setInterval(UPDATE_INTERVAL);
+    connect(&m_updateTimer, &QTimer::timeout,
+            this, &MprisPlayersModel::emitPendingChanges);
 }
 
 int MprisPlayersModel::rowCount(const QModelIndex &parent) const
@@ -112,6 +117,40 @@ QHash<int, QByteArray> MprisPlayersModel::roleNames() const
     return roles;
 }
 
+QVector<int> MprisPlayersModel::rolesFor(MprisPlayer::Properties properties)
+{
+    QVector<int> roles;
+    if (properties & MprisPlayer::IsPlaying)
+        roles.append(IsPlayingRole);
+    if (properties & MprisPlayer::CurrentSong)
+        roles.append(CurrentSongRole);
+    if (properties & MprisPlayer::Title)
+        roles.append(TitleRole);
+    if (properties & MprisPlayer::Artist)
+        roles.append(ArtistRole);
+    if (properties & MprisPlayer::Album)
+        roles.append(AlbumRole);
+    if (properties & MprisPlayer::AlbumArtUrl)
+        roles.append(AlbumArtUrlRole);
+    if (properties & MprisPlayer::Volume)
+        roles.append(VolumeRole);
+    if (properties & MprisPlayer::Length)
+        roles.append(LengthRole);
+    if (properties & MprisPlayer::Position)
+        roles.append(PositionRole);
+    if (properties & MprisPlayer::PlayAllowed)
+        roles.append(PlayAllowedRole);
+    if (properties & MprisPlayer::PauseAllowed)
+        roles.append(PauseAllowedRole);
+    if (properties & MprisPlayer::GoNextAllowed)
+        roles.append(GoNextAllowedRole);
+    if (properties & MprisPlayer::GoPreviousAllowed)
+        roles.append(GoPreviousAllowedRole);
+    if (properties & MprisPlayer::SeekAllowed)
+        roles.append(SeekAllowedRole);
+    return roles;
+}
+
 void MprisPlayersModel::setDeviceId(const QString& value)
 {
     if (value == m_deviceId)
@@ -149,6 +188,7 @@ void MprisPlayersModel::setPlugin(MprisRemotePlugin* plugin)
             m_plugin->player(player)->disconnect(this);
         }
         m_players.clear();
+        m_pendingChanges.clear();
     }
 
     m_plugin = plugin;
@@ -165,6 +205,7 @@ void MprisPlayersModel::setPlugin(MprisRemotePlugin* plugin)
             connectPlayer(player);
         }
     }
+    updateRows();
 
     endResetModel();
 }
@@ -173,7 +214,9 @@ void MprisPlayersModel::connectPlayer(const QString &name)
 {
     auto player = m_plugin->player(name);
     connect(player, &MprisPlayer::propertiesChanged,
-            this, &MprisPlayersModel::playerUpdated);
+            this, [this, name](MprisPlayer::Properties changed) {
+        playerUpdated(name, changed);
+    });
 }
 
 void MprisPlayersModel::playerAdded(const QString& name)
@@ -188,6 +231,7 @@ void MprisPlayersModel::playerAdded(const QString& name)
     beginInsertRows(QModelIndex(), insert_pos, insert_pos);
 
     m_players.insert(insert_pos, name);
+    updateRows();
     connectPlayer(name);
 
     endInsertRows();
@@ -195,29 +239,61 @@ void MprisPlayersModel::playerAdded(const QString& name)
 
 void MprisPlayersModel::playerRemoved(const QString& name)
 {
-    auto remove_pos = m_players.indexOf(name);
+    auto remove_pos = m_rows.value(name, -1);
     if (remove_pos < 0) {
         return;
     }
 
+    MprisPlayer* player = m_plugin->player(name);
+    if (player) {
+        player->disconnect(this);
+    }
+    m_pendingChanges.remove(name);
+
     beginRemoveRows(QModelIndex(), remove_pos, remove_pos);
     m_players.removeAt(remove_pos);
+    updateRows();
     endRemoveRows();
 }
 
-void MprisPlayersModel::playerUpdated()
+void MprisPlayersModel::playerUpdated(
+        const QString& name, MprisPlayer::Properties changed)
 {
-    MprisPlayer* player = qobject_cast<MprisPlayer*>(QObject::sender());
-    Q_ASSERT(player);
+    m_pendingChanges[name] |= changed;
+    if (!m_updateTimer.isActive()) {
+        m_updateTimer.start();
+    }
+}
 
-    auto i = m_players.indexOf(player->name());
-    dataChanged(index(i), index(i));
+void MprisPlayersModel::emitPendingChanges()
+{
+    const auto pendingChanges = m_pendingChanges;
+    m_pendingChanges.clear();
+
+    for (auto iter = pendingChanges.constBegin();
+         iter != pendingChanges.constEnd(); ++iter) {
+        int row = m_rows.value(iter.key(), -1);
+        if (row < 0)
+            continue;
+
+        emit dataChanged(index(row), index(row), rolesFor(iter.value()));
+    }
+}
+
+void MprisPlayersModel::updateRows()
+{
+    m_rows.clear();
+    for (int i = 0; i < m_players.size(); ++i) {
+        m_rows.insert(m_players[i], i);
+    }
 }
 
 void MprisPlayersModel::pluginDestroyed()
 {
     beginResetModel();
     m_players.clear();
+    m_rows.clear();
+    m_pendingChanges.clear();
     m_plugin = nullptr;
     endResetModel();
 }
@@ -19,13 +19,15 @@
 #define SAILFISHCONNECT_MPRISPLAYERSMODEL_H
 
 #include <QAbstractListModel>
+#include <QHash>
+#include <QTimer>
+
+#include "../plugins/mprisremote/mprisremoteplugin.h"
 
 class Device;
 
 namespace SailfishConnect {
 
-class MprisRemotePlugin;
-
 class MprisPlayersModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -33,6 +35,11 @@ class MprisPlayersModel : public QAbstractListModel
     Q_PROPERTY(QString deviceId READ deviceId WRITE setDeviceId)
 
 public:
+    /**
+     * Player changes are collected and announced at most once per frame.
+     */
+    static constexpr int UPDATE_INTERVAL = 16;
+
     explicit MprisPlayersModel(QObject *parent = nullptr);
 
     enum ExtraRoles {
@@ -65,15 +72,23 @@ public:
     QString deviceId() const { return m_deviceId; }
     void setDeviceId(const QString& value);
 
+    static QVector<int> rolesFor(MprisPlayer::Properties properties);
+
 private:
     QStringList m_players;
+    QHash<QString, int> m_rows;
+    QHash<QString, MprisPlayer::Properties> m_pendingChanges;
+    QTimer m_updateTimer;
     MprisRemotePlugin* m_plugin = nullptr;
     QString m_deviceId;
     Device* m_device = nullptr;
 
     void playerAdded(const QString& name);
     void playerRemoved(const QString& name);
-    void playerUpdated();
+    void playerUpdated(
+            const QString& name, MprisPlayer::Properties changed);
+    void emitPendingChanges();
+    void updateRows();
     void pluginDestroyed();
     void devicePluginsChanged();
 
@@ -17,6 +17,8 @@
 
 #include "albumartcache.h"
 
+#include <limits>
+
 #include <QQuickTextureFactory>
 #include <QCryptographicHash>
 #include <QFile>
@@ -26,14 +28,21 @@
 #include <QFileInfo>
 #include <QQmlEngine>
 #include <QNetworkAccessManager>
-#include <QNetworkRequest>
-#include <QNetworkReply>
+#include <QDataStream>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QTimer>
+#include <QSettings>
+#include <QImageReader>
+#include <QThreadPool>
+#include <QCoreApplication>
 
 #include <sailfishconnect/io/copyjob.h>
+#include <sailfishconnect/io/diskcache.h>
 #include <sailfishconnect/kdeconnectconfig.h>
+#include <sailfishconnect/helper/cpphelper.h>
 #include <sailfishconnect/helper/humanize.h>
 #include <sailfishconnect/daemon.h>
-#include <sailfishconnect/device.h>
 #include <appdaemon.h>
 
 #include "mprisremoteplugin.h"
@@ -42,8 +51,63 @@ namespace SailfishConnect {
 
 static Q_LOGGING_CATEGORY(logger, "kdeconnect.plugin.mprisremote.albumartcache")
 
+constexpr qint64 AlbumArtCache::DEFAULT_DEVICE_CACHE_SIZE;
+constexpr qint64 AlbumArtCache::DEFAULT_CACHE_SIZE;
+constexpr int AlbumArtCache::FETCH_TIMEOUT;
+constexpr qint64 AlbumArtCache::REVALIDATE_INTERVAL;
+
+/**
+ * Shared by the caches of all devices to coalesce their requests.
+ */
+static HttpFetcher* httpFetcher()
+{
+    static HttpFetcher* fetcher = []() {
+        auto* network = Daemon::instance()->networkAccessManager();
+        return new HttpFetcher(network, network);
+    }();
+    return fetcher;
+}
+
+/**
+ * Validators of an album art response and when they were last checked,
+ * stored in the cache index.
+ */
+static QByteArray encodeValidation(
+        const HttpFetcher::Validators& validators, qint64 checkedAt)
+{
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream << validators.etag << validators.lastModified << checkedAt;
+    return result;
+}
+
+static bool decodeValidation(
+        const QByteArray& data,
+        HttpFetcher::Validators* validators, qint64* checkedAt)
+{
+    if (data.isEmpty())
+        return false;
+
+    QDataStream stream(data);
+    stream >> validators->etag >> validators->lastModified >> *checkedAt;
+    return stream.status() == QDataStream::Ok;
+}
+
+static DiskCacheGroup& cacheGroup()
+{
+    static DiskCacheGroup group([]() {
+        QSettings settings;
+        settings.beginGroup(QStringLiteral("MprisRemote"));
+        return settings.value(
+                    QStringLiteral("albumArtCacheSize"),
+                    AlbumArtCache::DEFAULT_CACHE_SIZE).toLongLong();
+    }());
+    return group;
+}
+
 AlbumArtCache::AlbumArtCache(
-        KdeConnectConfig *config, const QString& deviceId, QObject *parent)
+        KdeConnectConfig *config, const QString& deviceId, qint64 maxSize,
+        QObject *parent)
     : QObject(parent)
     , m_config(config)
     , m_deviceId(deviceId)
@@ -53,23 +117,37 @@ AlbumArtCache::AlbumArtCache(
         m_deviceId, QStringLiteral("SailfishConnect::MprisRemotePlugin"));
     m_cacheDir = QDir(pluginConfigDir.filePath(QStringLiteral("albumart")));
 
-    if (!m_cacheDir.mkpath(QStringLiteral("."))) {
-        qCCritical(logger).noquote()
-                << "Failed to create cache dir" << m_cacheDir;
-        return;
-    }
+    m_diskCache = new DiskCache(m_cacheDir.path(), maxSize, this);
+    connect(m_diskCache, &DiskCache::inserted,
+            this, [this](const QString& hash) {
+        AlbumArtIndex::instance()->setCached(
+                    m_deviceId, hash, m_diskCache->filePath(hash));
+    });
+    connect(m_diskCache, &DiskCache::removed,
+            this, [this](const QString& hash) {
+        AlbumArtIndex::instance()->setMissing(m_deviceId, hash);
+    });
+    AlbumArtIndex::instance()->addCache(m_deviceId, this);
+    m_diskCache->setGroup(&cacheGroup());
+
+    connect(httpFetcher(), &HttpFetcher::finished,
+            this, &AlbumArtCache::httpFetchFinished);
 
-    const QFileInfoList files = m_cacheDir.entryInfoList(
-                QDir::Files | QDir::NoDotAndDotDot);
-    for (const auto& file : files) {
-        m_diskCache.insert(file.baseName(), file.fileName());
-        m_diskCacheSize += file.size();
-    }
     qCInfo(logger).noquote()
-            << "Using" << humanizeBytes(m_diskCacheSize)
+            << "Using" << humanizeBytes(m_diskCache->size())
             << "of album art cache";
 }
 
+AlbumArtCache::~AlbumArtCache()
+{
+    AlbumArtIndex::instance()->removeCache(m_deviceId);
+
+    // unfinished downloads would stay in the cache dir forever
+    for (auto* job : asConst(m_fetching)) {
+        QFile::remove(job->filePath());
+    }
+}
+
 DownloadAlbumArtJob *AlbumArtCache::getFetchingJob(const QString &hash)
 {
     return m_fetching.value(hash, nullptr);
@@ -77,22 +155,47 @@ DownloadAlbumArtJob *AlbumArtCache::getFetchingJob(const QString &hash)
 
 bool AlbumArtCache::isAvailable(const QUrl& url) const
 {
-    return m_diskCache.contains(hashFor(url));
+    return m_diskCache->contains(hashFor(url));
 }
 
 bool AlbumArtCache::isHashAvailable(const QString &hash) const
 {
-    return m_diskCache.contains(hash);
+    return m_diskCache->contains(hash);
 }
 
 QImage AlbumArtCache::getAvailable(const QUrl &url)
 {
-    return QImage(cacheFileFor(url));
+    QString path = m_diskCache->lookup(hashFor(url));
+    return path.isNull() ? QImage() : QImage(path);
 }
 
-QImage AlbumArtCache::getCacheFile(const QString &hashFile)
+bool AlbumArtCache::refetch(const QString &hash)
 {
-    return QImage(m_cacheDir.filePath(hashFile));
+    if (isFetching(hash))
+        return true;
+
+    QUrl url;
+    for (const QUrl& playerUrl : asConst(m_playerUrls)) {
+        if (hashFor(playerUrl) == hash) {
+            url = playerUrl;
+            break;
+        }
+    }
+    if (url.isEmpty() || m_diskCache->hasFailed(hash))
+        return false;
+
+    emit fetchRequested(url);
+    return isFetching(hash);
+}
+
+bool AlbumArtCache::isFetching(const QString &hash) const
+{
+    return m_fetching.contains(hash) || m_httpFetching.contains(hash);
+}
+
+QString AlbumArtCache::getCacheFile(const QString &hashFile)
+{
+    return m_diskCache->lookup(QFileInfo(hashFile).baseName());
 }
 
 QString AlbumArtCache::hashFor(const QUrl &url)
@@ -114,37 +217,75 @@ QString AlbumArtCache::cacheFileNameFor(const QUrl &url) const
     return hashFor(url) % QChar('.') % fileExt;
 }
 
-QUrl AlbumArtCache::imageUrl(const QUrl &url) const
+QUrl AlbumArtCache::imageUrl(const QString& player, const QUrl &url)
 {
+    // remember url to fetch it again, when it was evicted
+    m_playerUrls.insert(player, url);
     return QUrl(QStringLiteral("image://albumart/%1/%2").arg(
                     m_deviceId, cacheFileNameFor(url)));
 }
 
+void AlbumArtCache::releasePlayer(const QString& player)
+{
+    m_playerUrls.remove(player);
+}
+
 DownloadAlbumArtJob *AlbumArtCache::startFetching(const QUrl &url)
 {
     if (url.isEmpty())
         return nullptr;
 
     QString hash = hashFor(url);
-    if (m_diskCache.contains(hash) || m_fetching.contains(hash)) {
+    if (isFetching(hash)) {
+        qCDebug(logger) << url << "already fetching";
+        return nullptr;
+    }
+    if (m_diskCache->contains(hash)) {
         qCDebug(logger) << url << "already cached";
+        if (!url.isLocalFile()) {
+            revalidate(url, hash);
+        }
+        return nullptr;
+    }
+    if (m_diskCache->hasFailed(hash)) {
+        qCDebug(logger) << url << "failed recently, not retrying yet";
         return nullptr;
     }
 
+    AlbumArtIndex::instance()->setFetching(m_deviceId, hash);
+
+    if (!url.isLocalFile()) {
+        m_httpFetching.insert(hash);
+        httpFetcher()->fetch(url);
+        return nullptr;  // to not start request to other side
+    }
+
     auto* job = new DownloadAlbumArtJob(url, cacheFileFor(url), this);
-    // TODO: add timeout to remove it after a time when no response
     m_fetching.insert(hash, job);
     connect(job, &DownloadAlbumArtJob::finished,
             this, &AlbumArtCache::fetchFinished);
+    QTimer::singleShot(FETCH_TIMEOUT, job, [job]() {
+        job->abort(QStringLiteral("Timed out"));
+    });
+    return job;
+}
 
-    if (!url.isLocalFile()) {
-        auto network = Daemon::instance()->networkAccessManager();
-        job->gotData(QSharedPointer<QIODevice>(
-            network->get(QNetworkRequest(url))));
-        return nullptr;  // to not start request to other side
-    } else {
-        return job;
+void AlbumArtCache::revalidate(const QUrl &url, const QString &hash)
+{
+    HttpFetcher::Validators validators;
+    qint64 checkedAt = 0;
+    if (!decodeValidation(m_diskCache->metadata(hash), &validators, &checkedAt)
+            || validators.isEmpty()) {
+        // nothing to revalidate with
+        return;
     }
+
+    if (QDateTime::currentMSecsSinceEpoch() - checkedAt < REVALIDATE_INTERVAL)
+        return;
+
+    qCDebug(logger) << "Revalidate" << url;
+    m_httpFetching.insert(hash);
+    httpFetcher()->fetch(url, validators);
 }
 
 void AlbumArtCache::endFetching(
@@ -166,99 +307,149 @@ void AlbumArtCache::fetchFinished(
     Q_ASSERT(job != nullptr);
 
     m_fetching.remove(job->hash());
+    job->deleteLater();
 
     if (errorString.isEmpty()) {
-        m_diskCache.insert(job->hash(), job->fileName());
-        m_diskCacheSize += job->fileSize();
+        m_diskCache->insert(job->hash(), job->fileName(), job->fileSize());
 
         qCDebug(logger).nospace()
                 << "Added " << job->url()
-                << " (Disk cache: " << humanizeBytes(m_diskCacheSize) << ")";
+                << " (Disk cache: " << humanizeBytes(m_diskCache->size())
+                << ", " << m_diskCache->hitCount() << " hits, "
+                << m_diskCache->missCount() << " misses, "
+                << m_diskCache->evictionCount() << " evictions)";
+    } else {
+        m_diskCache->markFailed(job->hash());
+        AlbumArtIndex::instance()->setMissing(m_deviceId, job->hash());
     }
 }
 
+void AlbumArtCache::httpFetchFinished(
+        const QUrl &url, const HttpFetcher::Result &result)
+{
+    const QString hash = hashFor(url);
+    if (!m_httpFetching.remove(hash)) {
+        // requested by another device
+        return;
+    }
+
+    const bool cached = m_diskCache->contains(hash);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if (result.status == HttpFetcher::NotModified && cached) {
+        m_diskCache->setMetadata(
+                    hash, encodeValidation(result.validators, now));
+        return;
+    }
+
+    if (result.status == HttpFetcher::Ok) {
+        QSaveFile file(cacheFileFor(url));
+        if (file.open(QIODevice::WriteOnly)
+                && file.write(result.data) == result.data.size()
+                && file.commit()) {
+            m_diskCache->insert(
+                        hash, cacheFileNameFor(url), result.data.size(),
+                        encodeValidation(result.validators, now));
+            if (cached) {
+                DecodedAlbumArtCache::instance()->remove(hash);
+            }
+
+            qCDebug(logger).nospace()
+                    << "Added " << url
+                    << " (Disk cache: " << humanizeBytes(m_diskCache->size())
+                    << ", " << m_diskCache->hitCount() << " hits, "
+                    << m_diskCache->missCount() << " misses, "
+                    << m_diskCache->evictionCount() << " evictions)";
+            return;
+        }
+
+        qCCritical(logger).noquote()
+                << "Failed to write cache file" << file.fileName()
+                << file.errorString();
+    }
+
+    if (cached) {
+        // keep the old copy and check again later
+        HttpFetcher::Validators validators;
+        qint64 checkedAt;
+        decodeValidation(m_diskCache->metadata(hash), &validators, &checkedAt);
+        m_diskCache->setMetadata(hash, encodeValidation(validators, now));
+        return;
+    }
+
+    qCWarning(logger) << "Failed download of" << url.toString()
+                      << result.errorString;
+    m_diskCache->markFailed(hash);
+    AlbumArtIndex::instance()->setMissing(m_deviceId, hash);
+}
+
 // -----------------------------------------------------------------------------
 
 void AlbumArtProvider::registerImageProvider(QQmlEngine* qmlEngine) {
+    // create it in the main thread before image threads ask for it
+    AlbumArtIndex::instance();
     qmlEngine->addImageProvider(
                 QStringLiteral("albumart"), new AlbumArtProvider());
 }
 
-QQuickImageResponse *AlbumArtProvider::unsafeRequestImageResponse(
-        QString id, QSize requestedSize, QThread *targetThread)
-{
-    QQuickImageResponse* result = unsafeRequestImageResponse_(
-                id, requestedSize);
-    result->moveToThread(targetThread);
-    return result;
-}
-
-QQuickImageResponse *AlbumArtProvider::unsafeRequestImageResponse_(
-        const QString& id, const QSize& requestedSize)
+QQuickImageResponse *AlbumArtProvider::requestImageResponse(
+        const QString &id, const QSize &requestedSize)
 {
+    // called in an image thread, so only the index may be used here
     auto parts = id.split(QChar('/'));
     if (parts.length() != 2) {
         return new CachedAlbumArtImageResponse(QImage());
     }
 
-    Device* device = Daemon::instance()->getDevice(parts[0]);
-    if (device == nullptr) {
-        qCDebug(logger) << "non-existing device" << parts[0];
-        return new CachedAlbumArtImageResponse(QImage());
+    const QString deviceId = parts[0];
+    const QString hash = QFileInfo(parts[1]).baseName();
+    auto* index = AlbumArtIndex::instance();
+    AlbumArtIndex::Entry entry = index->entry(deviceId, hash);
+    if (entry.state != AlbumArtIndex::Cached) {
+        return new AlbumArtImageResponse(deviceId, hash, requestedSize);
     }
 
-    MprisRemotePlugin* plugin = qobject_cast<MprisRemotePlugin*>(
-                device->plugin("SailfishConnect::MprisRemotePlugin"));
-    if (plugin == nullptr) {
-        qCDebug(logger) << "mpris plugin not loaded";
-        return new CachedAlbumArtImageResponse(QImage());
-    }
+    QMetaObject::invokeMethod(
+                index, "recordAccess", Qt::QueuedConnection,
+                Q_ARG(QString, deviceId), Q_ARG(QString, hash));
 
-    QFileInfo fileName { parts[1] };
-    AlbumArtCache* cache = plugin->albumArtCache();
-    QString hash = fileName.baseName();
-    DownloadAlbumArtJob* job = cache->getFetchingJob(hash);
-    if (job) {
-        return new AlbumArtImageResponse(job);
+    QImage image = DecodedAlbumArtCache::instance()->get(hash, requestedSize);
+    if (!image.isNull()) {
+        return new CachedAlbumArtImageResponse(image);
     }
 
-    if (!cache->isHashAvailable(hash)) {
-        qCWarning(logger) << "image not cached yet:" << parts[1];
-        return new CachedAlbumArtImageResponse(QImage());
-    }
-
-    // TODO: load image in other thread
-    return new CachedAlbumArtImageResponse(cache->getCacheFile(parts[1]));
+    return new AlbumArtImageResponse(entry.filePath, hash, requestedSize);
 }
 
-QQuickImageResponse *AlbumArtProvider::requestImageResponse(
-        const QString &id, const QSize &requestedSize)
+// -----------------------------------------------------------------------------
+
+AlbumArtImageResponse::AlbumArtImageResponse(
+        const QString &filePath, const QString &hash,
+        const QSize &requestedSize)
+    : m_filePath(filePath)
+    , m_hash(hash)
+    , m_requestedSize(requestedSize)
 {
-    QQuickImageResponse* result = nullptr;
-    bool success = QMetaObject::invokeMethod(
-                this, "unsafeRequestImageResponse",
-                Qt::BlockingQueuedConnection,
-                Q_RETURN_ARG(QQuickImageResponse*, result),
-                Q_ARG(QString, id),
-                Q_ARG(QSize, requestedSize),
-                Q_ARG(QThread*, QThread::currentThread()));
-    return success && result
-            ? result : new CachedAlbumArtImageResponse(QImage());
+    setAutoDelete(false);
+    startDecoding();
 }
 
-// -----------------------------------------------------------------------------
-
-AlbumArtImageResponse::AlbumArtImageResponse(DownloadAlbumArtJob *job)
-    : m_url(job->url())
+AlbumArtImageResponse::AlbumArtImageResponse(
+        const QString &deviceId, const QString &hash,
+        const QSize &requestedSize)
+    : m_deviceId(deviceId)
+    , m_hash(hash)
+    , m_requestedSize(requestedSize)
 {
-    connect(
-        job, &DownloadAlbumArtJob::finished,
-        this, &AlbumArtImageResponse::onFinished,
-        Qt::QueuedConnection);
-    connect(
-        job, &DownloadAlbumArtJob::destroyed,
-        this, &AlbumArtImageResponse::onJobDestroyed,
-        Qt::QueuedConnection);
+    setAutoDelete(false);
+
+    auto* index = AlbumArtIndex::instance();
+    connect(index, &AlbumArtIndex::stateChanged,
+            this, &AlbumArtImageResponse::onStateChanged,
+            Qt::QueuedConnection);
+
+    // look again, the state could have changed before we were connected
+    handleState(index->entry(m_deviceId, m_hash));
 }
 
 QQuickTextureFactory *AlbumArtImageResponse::textureFactory() const
@@ -272,21 +463,262 @@ QString AlbumArtImageResponse::errorString() const
     return m_errorString;
 }
 
-void AlbumArtImageResponse::onFinished(
-        const QString& cacheFile, const QString& errorString)
+void AlbumArtImageResponse::run()
 {
-    m_errorString = errorString;
-    if (errorString.isEmpty()) {
-        m_image = QImage(cacheFile);
+    m_image = decode(m_filePath, m_requestedSize);
+    if (m_image.isNull()) {
+        m_errorString = QStringLiteral("Failed to decode album art");
+    } else {
+        DecodedAlbumArtCache::instance()->insert(
+                    m_hash, m_requestedSize, m_image);
     }
 
-    emit finished();
+    // QML connects to finished only after the response was returned and
+    // moved to its thread, so do not emit it from the worker directly
+    QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+}
+
+QImage AlbumArtImageResponse::decode(
+        const QString &filePath, const QSize &requestedSize)
+{
+    QImageReader reader(filePath);
+
+    QSize size = reader.size();
+    if (size.isValid()
+            && (requestedSize.width() > 0 || requestedSize.height() > 0)) {
+        QSize bounds(
+            requestedSize.width() > 0
+                ? requestedSize.width() : std::numeric_limits<int>::max(),
+            requestedSize.height() > 0
+                ? requestedSize.height() : std::numeric_limits<int>::max());
+        if (size.width() > bounds.width()
+                || size.height() > bounds.height()) {
+            size.scale(bounds, Qt::KeepAspectRatio);
+            reader.setScaledSize(size);
+        }
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qCWarning(logger).noquote()
+                << "Failed to decode" << filePath << reader.errorString();
+    }
+    return image;
+}
+
+void AlbumArtImageResponse::startDecoding()
+{
+    QThreadPool::globalInstance()->start(this);
+}
+
+void AlbumArtImageResponse::handleState(const AlbumArtIndex::Entry &entry)
+{
+    auto* index = AlbumArtIndex::instance();
+
+    switch (entry.state) {
+    case AlbumArtIndex::Cached:
+        disconnect(index, nullptr, this, nullptr);
+        m_filePath = entry.filePath;
+        startDecoding();
+        break;
+
+    case AlbumArtIndex::Fetching:
+        break;
+
+    case AlbumArtIndex::Missing:
+        if (!m_fetchRequested) {
+            m_fetchRequested = true;
+            QMetaObject::invokeMethod(
+                        index, "requestFetch", Qt::QueuedConnection,
+                        Q_ARG(QString, m_deviceId), Q_ARG(QString, m_hash));
+            break;
+        }
+
+        disconnect(index, nullptr, this, nullptr);
+        m_errorString = QStringLiteral("album art not available");
+        emit finished();
+        break;
+    }
 }
 
-void AlbumArtImageResponse::onJobDestroyed()
+void AlbumArtImageResponse::onStateChanged(
+        const QString &deviceId, const QString &hash)
 {
-    m_errorString = QStringLiteral("job destroyed");
-    emit finished();
+    if (hash != m_hash || deviceId != m_deviceId)
+        return;
+
+    if (!m_filePath.isEmpty() || !m_errorString.isEmpty()) {
+        // already decoding or finished
+        return;
+    }
+
+    handleState(AlbumArtIndex::instance()->entry(m_deviceId, m_hash));
+}
+
+// -----------------------------------------------------------------------------
+
+AlbumArtIndex::AlbumArtIndex() = default;
+
+AlbumArtIndex* AlbumArtIndex::instance()
+{
+    static AlbumArtIndex* instance = []() {
+        auto* result = new AlbumArtIndex();
+        // slots must run in the main thread, whoever asks first
+        if (QCoreApplication::instance()) {
+            result->moveToThread(QCoreApplication::instance()->thread());
+        }
+        return result;
+    }();
+    return instance;
+}
+
+AlbumArtIndex::Entry AlbumArtIndex::entry(
+        const QString &deviceId, const QString &hash) const
+{
+    QReadLocker lock(&m_lock);
+    auto device = m_entries.constFind(deviceId);
+    if (device == m_entries.constEnd())
+        return Entry();
+
+    return device->value(hash);
+}
+
+void AlbumArtIndex::addCache(const QString &deviceId, AlbumArtCache *cache)
+{
+    m_caches.insert(deviceId, cache);
+
+    QHash<QString, Entry> entries;
+    const QStringList hashes = cache->diskCache()->keys();
+    for (const QString& hash : hashes) {
+        Entry entry;
+        entry.state = Cached;
+        entry.filePath = cache->diskCache()->filePath(hash);
+        entries.insert(hash, entry);
+    }
+
+    QWriteLocker lock(&m_lock);
+    m_entries.insert(deviceId, entries);
+}
+
+void AlbumArtIndex::removeCache(const QString &deviceId)
+{
+    m_caches.remove(deviceId);
+
+    QHash<QString, Entry> entries;
+    {
+        QWriteLocker lock(&m_lock);
+        entries = m_entries.take(deviceId);
+    }
+
+    // let waiting responses fail
+    for (auto iter = entries.constBegin(); iter != entries.constEnd(); ++iter) {
+        if (iter->state == Fetching) {
+            emit stateChanged(deviceId, iter.key());
+        }
+    }
+}
+
+void AlbumArtIndex::setFetching(const QString &deviceId, const QString &hash)
+{
+    Entry entry;
+    entry.state = Fetching;
+    setEntry(deviceId, hash, entry);
+}
+
+void AlbumArtIndex::setCached(
+        const QString &deviceId, const QString &hash, const QString &filePath)
+{
+    Entry entry;
+    entry.state = Cached;
+    entry.filePath = filePath;
+    setEntry(deviceId, hash, entry);
+}
+
+void AlbumArtIndex::setMissing(const QString &deviceId, const QString &hash)
+{
+    {
+        QWriteLocker lock(&m_lock);
+        auto device = m_entries.find(deviceId);
+        if (device != m_entries.end()) {
+            device->remove(hash);
+        }
+    }
+    emit stateChanged(deviceId, hash);
+}
+
+void AlbumArtIndex::requestFetch(const QString &deviceId, const QString &hash)
+{
+    AlbumArtCache* cache = m_caches.value(deviceId, nullptr);
+    if (cache == nullptr || !cache->refetch(hash)) {
+        qCDebug(logger) << "Can not fetch album art" << hash
+                        << "of" << deviceId;
+        emit stateChanged(deviceId, hash);
+    }
+}
+
+void AlbumArtIndex::recordAccess(const QString &deviceId, const QString &hash)
+{
+    AlbumArtCache* cache = m_caches.value(deviceId, nullptr);
+    if (cache) {
+        cache->getCacheFile(hash);
+    }
+}
+
+void AlbumArtIndex::setEntry(
+        const QString &deviceId, const QString &hash, const Entry &entry)
+{
+    {
+        QWriteLocker lock(&m_lock);
+        m_entries[deviceId].insert(hash, entry);
+    }
+    emit stateChanged(deviceId, hash);
+}
+
+// -----------------------------------------------------------------------------
+
+DecodedAlbumArtCache::DecodedAlbumArtCache()
+{
+    m_images.setMaxCost(MAX_COST_KB);
+}
+
+DecodedAlbumArtCache* DecodedAlbumArtCache::instance()
+{
+    static DecodedAlbumArtCache instance;
+    return &instance;
+}
+
+QImage DecodedAlbumArtCache::get(const QString &hash, const QSize &size)
+{
+    QMutexLocker lock(&m_mutex);
+    QImage* image = m_images.object(key(hash, size));
+    return image ? *image : QImage();
+}
+
+void DecodedAlbumArtCache::insert(
+        const QString &hash, const QSize &size, const QImage &image)
+{
+    QMutexLocker lock(&m_mutex);
+    m_images.insert(
+        key(hash, size), new QImage(image), qMax(1, image.byteCount() / 1024));
+}
+
+void DecodedAlbumArtCache::remove(const QString &hash)
+{
+    const QString prefix = hash % QChar('@');
+
+    QMutexLocker lock(&m_mutex);
+    const auto keys = m_images.keys();
+    for (const QString& key : keys) {
+        if (key.startsWith(prefix)) {
+            m_images.remove(key);
+        }
+    }
+}
+
+QString DecodedAlbumArtCache::key(const QString &hash, const QSize &size)
+{
+    return hash % QChar('@') % QString::number(size.width())
+            % QChar('x') % QString::number(size.height());
 }
 
 // -----------------------------------------------------------------------------
@@ -314,13 +746,14 @@ DownloadAlbumArtJob::DownloadAlbumArtJob(
 
 bool DownloadAlbumArtJob::gotData(const QSharedPointer<QIODevice>& payload)
 {
-    if (isFetching()) {
+    if (isFetching() || m_done) {
         qCDebug(logger) << "Already downloading" << m_url;
         return false;
     }
 
     if (payload.isNull()) {
         qCDebug(logger) << "Empty payload";
+        m_done = true;
         emit finished(m_filePath, QStringLiteral("Empty payload"));
         return false;
     }
@@ -330,6 +763,7 @@ bool DownloadAlbumArtJob::gotData(const QSharedPointer<QIODevice>& payload)
         qCCritical(logger).noquote()
                 << "Failed to create cache file" << file->fileName()
                 << file->errorString();
+        m_done = true;
         emit finished(
             m_filePath, QStringLiteral("Failed to create cache file"));
         return false;
@@ -352,55 +786,35 @@ void DownloadAlbumArtJob::fetchFinished(KJob* fileTransfer)
     if (fileTransfer->error()) {
         failed(fileTransfer->errorString());
     } else {
-        // TODO: make it prettier :D
-        auto* fileTransferJob = qobject_cast<CopyJob*>(m_fileTransfer);
-        if (fileTransferJob) {
-            auto* reply = qobject_cast<QNetworkReply*>(
-                        fileTransferJob->source().data());
-            if (reply) {
-                // TODO: in Qt 5.9 use QNetworkRequest::UserVerifiedRedirectPolicy
-                QString location = reply->attribute(
-                    QNetworkRequest::RedirectionTargetAttribute).toString();
-                if (!location.isEmpty()) {
-                    m_redirectCount += 1;
-
-                    if (m_redirectCount > 10) {
-                        failed(QStringLiteral("too many redirects"));
-                        return;
-                    }
-
-                    auto network = Daemon::instance()->networkAccessManager();
-                    // TODO: set QNetworkRequest::BackgroundRequestAttribute
-                    m_fileTransfer = nullptr;
-                    gotData(QSharedPointer<QIODevice>(
-                        network->get(QNetworkRequest(location))));
-                    return;
-                }
-
-                int status = reply->attribute(
-                    QNetworkRequest::HttpStatusCodeAttribute).toInt();
-                if (status != 200) {
-                    failed(QStringLiteral("status code was not 200"));
-                    return;
-                }
-            }
-        }
-
         m_fileSize = fileTransfer->processedAmount(KJob::Bytes);
+        m_done = true;
         emit finished(m_filePath, QString());
     }
 }
 
+void DownloadAlbumArtJob::abort(const QString &error)
+{
+    if (m_done)
+        return;
+
+    if (m_fileTransfer) {
+        KJob* fileTransfer = m_fileTransfer;
+        m_fileTransfer = nullptr;
+        fileTransfer->kill();
+    }
+
+    failed(error);
+}
+
 void DownloadAlbumArtJob::failed(const QString &error)
 {
     qCWarning(logger) << "Failed download of" << m_url.toString()
                       << error;
 
-    // mark as failed
-    QFile file { m_filePath };
-    file.open(QIODevice::WriteOnly);
-    file.close();
+    // the cache remembers the failure, drop what we got so far
+    QFile::remove(m_filePath);
 
+    m_done = true;
     emit finished(m_filePath, error);
 }
 
@@ -22,16 +22,23 @@
 #include <QQuickAsyncImageProvider>
 #include <QCache>
 #include <QImage>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QRunnable>
 #include <QSet>
 #include <QDir>
 #include <KJob>
 
+#include <sailfishconnect/io/httpfetcher.h>
+
 class KdeConnectConfig;
 class QQmlEngine;
 class KJob;
 
 namespace SailfishConnect {
 
+class DiskCache;
+
 class DownloadAlbumArtJob : public QObject
 {
     Q_OBJECT
@@ -48,6 +55,11 @@ public:
     bool isFetching() const { return m_fileTransfer != nullptr; }
     KJob *fileTransfer() const;
 
+    /**
+     * Give up waiting for or copying album art.
+     */
+    void abort(const QString& error);
+
 signals:
     void finished(const QString& cacheFile, const QString& errorString);
 
@@ -57,19 +69,38 @@ private:
     QString m_filePath;
     qlonglong m_fileSize;
     KJob* m_fileTransfer = nullptr;
-    int m_redirectCount = 0;
+    bool m_done = false;
 
     void failed(const QString& error);
     void fetchFinished(KJob* fileTransfer);
 };
 
+/**
+ * Album art of one device on disk.
+ *
+ * The cache is bounded by a byte budget per device and by a budget shared
+ * by all devices, least recently used album art is removed first. Failed
+ * downloads are retried after DiskCache::failureTtl().
+ *
+ * Album art from the internet is fetched through a HttpFetcher shared by
+ * all devices and revalidated after REVALIDATE_INTERVAL. Album art from
+ * the device must arrive within FETCH_TIMEOUT.
+ */
 class AlbumArtCache : public QObject
 {
     Q_OBJECT
 public:
+    static constexpr qint64 DEFAULT_DEVICE_CACHE_SIZE = 20 * 1024 * 1024;
+    static constexpr qint64 DEFAULT_CACHE_SIZE = 50 * 1024 * 1024;
+    static constexpr int FETCH_TIMEOUT = 30000;
+    static constexpr qint64 REVALIDATE_INTERVAL = 24 * 60 * 60 * 1000;
+
     explicit AlbumArtCache(
             KdeConnectConfig* config,
-            const QString &deviceId, QObject *parent = nullptr);
+            const QString &deviceId,
+            qint64 maxSize = DEFAULT_DEVICE_CACHE_SIZE,
+            QObject *parent = nullptr);
+    ~AlbumArtCache() override;
 
     void init();
 
@@ -92,15 +123,44 @@ public:
      */
     QImage getAvailable(const QUrl& url);
 
-    QImage getCacheFile(const QString& hashFile);
+    /**
+     * @brief Fetch album art again, e.g. after it was evicted.
+     *
+     * Only album art currently shown by a player, see imageUrl(), can be
+     * fetched again.
+     *
+     * @param hash hash of album art url
+     * @return whether album art is fetched now
+     */
+    bool refetch(const QString& hash);
+
+    /**
+     * @brief Path of cached album art file.
+     * @param hashFile file name in the form of hash.ext
+     * @return path or null string, when not in cache.
+     */
+    QString getCacheFile(const QString& hashFile);
 
     static QString hashFor(const QUrl& url);
     QString cacheFileFor(const QUrl& url) const;
     QString cacheFileNameFor(const QUrl& url) const;
 
-    QUrl imageUrl(const QUrl& url) const;
+    /**
+     * @brief Image provider url for the album art @p player shows now.
+     *
+     * The url is remembered to fetch it again when it was evicted, until
+     * the player shows other album art or is released.
+     */
+    QUrl imageUrl(const QString& player, const QUrl& url);
+    void releasePlayer(const QString& player);
+
+    const DiskCache* diskCache() const { return m_diskCache; }
 
 signals:
+    /**
+     * Album art for @p url is needed again, see refetch().
+     */
+    void fetchRequested(const QUrl& url);
 
 public slots:
 
@@ -109,11 +169,113 @@ private:
     QString m_deviceId;
 
     QHash<QString, DownloadAlbumArtJob*> m_fetching;
-    QHash<QString, QString> m_diskCache;
-    qint64 m_diskCacheSize = 0; // TODO: use QCache for cache handling
+    QSet<QString> m_httpFetching;
+    QHash<QString, QUrl> m_playerUrls;
+    DiskCache* m_diskCache = nullptr;
     QDir m_cacheDir;
 
+    bool isFetching(const QString& hash) const;
+    void revalidate(const QUrl& url, const QString& hash);
     void fetchFinished(const QString &cacheFile, const QString &errorString);
+    void httpFetchFinished(
+            const QUrl& url, const HttpFetcher::Result& result);
+};
+
+
+/**
+ * Thread-safe view on the album art caches of all devices.
+ *
+ * The image provider looks up album art here from QML's image threads
+ * without waiting for the main thread. The caches keep it up to date from
+ * the main thread. Only requests that need the caches themselves, like
+ * fetching missing album art, are queued to the main thread.
+ */
+class AlbumArtIndex : public QObject
+{
+    Q_OBJECT
+public:
+    enum State { Missing, Fetching, Cached };
+
+    struct Entry {
+        State state = Missing;
+        QString filePath;
+    };
+
+    static AlbumArtIndex* instance();
+
+    /**
+     * Current state of album art @p hash of device @p deviceId. Can be
+     * called from any thread.
+     */
+    Entry entry(const QString& deviceId, const QString& hash) const;
+
+    // only to be called from the main thread
+    void addCache(const QString& deviceId, AlbumArtCache* cache);
+    void removeCache(const QString& deviceId);
+    void setFetching(const QString& deviceId, const QString& hash);
+    void setCached(
+            const QString& deviceId, const QString& hash,
+            const QString& filePath);
+    void setMissing(const QString& deviceId, const QString& hash);
+
+public slots:
+    /**
+     * Fetch missing album art. Meant to be queued from other threads,
+     * stateChanged() is emitted in any case.
+     */
+    void requestFetch(const QString& deviceId, const QString& hash);
+
+    /**
+     * Count access to cached album art for LRU eviction. Meant to be
+     * queued from other threads.
+     */
+    void recordAccess(const QString& deviceId, const QString& hash);
+
+signals:
+    void stateChanged(const QString& deviceId, const QString& hash);
+
+private:
+    AlbumArtIndex();
+
+    void setEntry(
+            const QString& deviceId, const QString& hash, const Entry& entry);
+
+    mutable QReadWriteLock m_lock;
+    QHash<QString, QHash<QString, Entry>> m_entries;
+
+    // only used in the main thread
+    QHash<QString, AlbumArtCache*> m_caches;
+};
+
+
+/**
+ * Recently decoded album art in the sizes it was requested in.
+ *
+ * Flipping through players shows the same covers again and again, this
+ * spares reading and decoding them every time. Thread-safe.
+ */
+class DecodedAlbumArtCache
+{
+public:
+    static constexpr int MAX_COST_KB = 8 * 1024;
+
+    static DecodedAlbumArtCache* instance();
+
+    QImage get(const QString& hash, const QSize& size);
+    void insert(const QString& hash, const QSize& size, const QImage& image);
+
+    /**
+     * Forget all sizes of @p hash, e.g. after the album art changed.
+     */
+    void remove(const QString& hash);
+
+private:
+    DecodedAlbumArtCache();
+
+    static QString key(const QString& hash, const QSize& size);
+
+    QMutex m_mutex;
+    QCache<QString, QImage> m_images;
 };
 
 
@@ -125,32 +287,50 @@ public:
             const QString &id, const QSize &requestedSize) override;
 
     static void registerImageProvider(QQmlEngine* qmlEngine);
-
-private slots:
-    QQuickImageResponse* unsafeRequestImageResponse(
-            QString id, QSize requestedSize, QThread *targetThread);
-
-private:
-    QQuickImageResponse* unsafeRequestImageResponse_(
-            const QString &id, const QSize &requestedSize);
 };
 
 
-class AlbumArtImageResponse : public QQuickImageResponse {
+/**
+ * Album art decoded in the global thread pool, scaled down to the
+ * requested size while decoding.
+ */
+class AlbumArtImageResponse : public QQuickImageResponse, public QRunnable {
     Q_OBJECT
 public:
-    AlbumArtImageResponse(DownloadAlbumArtJob* job);
+    /**
+     * Decode cached file @p filePath.
+     */
+    AlbumArtImageResponse(
+            const QString& filePath, const QString& hash,
+            const QSize& requestedSize);
+
+    /**
+     * Decode album art @p hash of @p deviceId as soon as it is cached.
+     * Missing album art is fetched again.
+     */
+    AlbumArtImageResponse(
+            const QString& deviceId, const QString& hash,
+            const QSize& requestedSize);
 
     QQuickTextureFactory *textureFactory() const override;
     QString errorString() const override;
 
+    void run() override;
+
+    static QImage decode(const QString& filePath, const QSize& requestedSize);
+
 private:
-    QUrl m_url;
+    QString m_deviceId;
+    QString m_filePath;
+    QString m_hash;
+    QSize m_requestedSize;
     QString m_errorString;
     QImage m_image;
+    bool m_fetchRequested = false;
 
-    void onFinished(const QString &cacheFile, const QString &errorString);
-    void onJobDestroyed();
+    void startDecoding();
+    void handleState(const AlbumArtIndex::Entry& entry);
+    void onStateChanged(const QString& deviceId, const QString& hash);
 };
 
 
@@ -24,6 +24,7 @@
 #include <sailfishconnect/device.h>
 #include <sailfishconnect/helper/cpphelper.h>
 #include <sailfishconnect/daemon.h>
+#include <sailfishconnect/kdeconnectpluginconfig.h>
 
 #include "albumartcache.h"
 
@@ -39,6 +40,19 @@ static const QString PACKET_TYPE_MPRIS =
 
 // MprisPlayer
 
+constexpr qint64 MprisPlayer::POSITION_TOLERANCE;
+
+template<typename T>
+static void updateProperty(
+        T& field, const T& value,
+        MprisPlayer::Properties& changed, MprisPlayer::Property property)
+{
+    if (field != value) {
+        field = value;
+        changed |= property;
+    }
+}
+
 MprisPlayer::MprisPlayer(MprisRemotePlugin *parent, const QString& name)
     : QObject(parent), m_parent(parent), m_player(name),
       m_isSpotify(m_player.toLower() == QLatin1String("spotify"))
@@ -65,9 +79,9 @@ void MprisPlayer::setVolume(int value)
     if (setVolumeAllowed()) {
         m_parent->sendCommand(m_player, "setVolume", value);
 
-        m_volume = value;
-
-        emit propertiesChanged();
+        Properties changed;
+        updateProperty(m_volume, value, changed, Volume);
+        emitChanges(changed);
     }
 }
 
@@ -79,47 +93,121 @@ void MprisPlayer::setPosition(int value)
         m_lastPosition = value;
         m_lastPositionTime = QDateTime::currentMSecsSinceEpoch();
 
-        emit propertiesChanged();
+        emitChanges(Position);
     }
 }
 
 void MprisPlayer::receivePacket(const NetworkPacket &np, AlbumArtCache *cache)
 {
-    m_currentSong =
-            np.get<QString>(QStringLiteral("nowPlaying"), m_currentSong);
-    m_title =
-            np.get<QString>(QStringLiteral("title"), m_title);
-    m_artist =
-            np.get<QString>(QStringLiteral("artist"), m_artist);
-    m_album =
-            np.get<QString>(QStringLiteral("album"), m_album);
-    m_length =
-            np.get<qint64>(QStringLiteral("length"), m_length);
-    m_isPlaying =
-            np.get<bool>(QStringLiteral("isPlaying"), m_isPlaying);
-    m_playAllowed =
-            np.get<bool>(QStringLiteral("canPlay"), m_playAllowed);
-    m_pauseAllowed =
-            np.get<bool>(QStringLiteral("canPause"), m_pauseAllowed);
-    m_goNextAllowed =
-            np.get<bool>(QStringLiteral("canGoNext"), m_goNextAllowed);
-    m_goPreviousAllowed =
-            np.get<bool>(QStringLiteral("canGoPrevious"), m_goPreviousAllowed);
-    m_seekAllowed =
-            np.get<bool>(QStringLiteral("canSeek"), m_seekAllowed);
+    const bool hadPosition = hasPosition();
+    const bool couldSeek = seekAllowed();
+    Properties changed;
+
+    updateProperty(m_currentSong,
+        np.get<QString>(QStringLiteral("nowPlaying"), m_currentSong),
+        changed, CurrentSong);
+    updateProperty(m_title,
+        np.get<QString>(QStringLiteral("title"), m_title),
+        changed, Title);
+    updateProperty(m_artist,
+        np.get<QString>(QStringLiteral("artist"), m_artist),
+        changed, Artist);
+    updateProperty(m_album,
+        np.get<QString>(QStringLiteral("album"), m_album),
+        changed, Album);
+    updateProperty(m_length,
+        np.get<qint64>(QStringLiteral("length"), m_length),
+        changed, Length);
+    updateProperty(m_playAllowed,
+        np.get<bool>(QStringLiteral("canPlay"), m_playAllowed),
+        changed, PlayAllowed);
+    updateProperty(m_pauseAllowed,
+        np.get<bool>(QStringLiteral("canPause"), m_pauseAllowed),
+        changed, PauseAllowed);
+    updateProperty(m_goNextAllowed,
+        np.get<bool>(QStringLiteral("canGoNext"), m_goNextAllowed),
+        changed, GoNextAllowed);
+    updateProperty(m_goPreviousAllowed,
+        np.get<bool>(QStringLiteral("canGoPrevious"), m_goPreviousAllowed),
+        changed, GoPreviousAllowed);
+    updateProperty(m_seekAllowed,
+        np.get<bool>(QStringLiteral("canSeek"), m_seekAllowed),
+        changed, SeekAllowed);
 
     QString albumArtUrl = np.get<QString>(QStringLiteral("albumArtUrl"));
     if (!albumArtUrl.isEmpty()) {
         m_remoteAlbumArtUrl = albumArtUrl;
-        m_albumArtUrl = cache->imageUrl(m_remoteAlbumArtUrl);
+        updateProperty(m_albumArtUrl,
+                       cache->imageUrl(m_player, m_remoteAlbumArtUrl),
+                       changed, AlbumArtUrl);
     }
 
     if (np.has(QStringLiteral("pos")) && !isSpotify()) {
+        qint64 expected = position();
         m_lastPosition = np.get<qint64>(QStringLiteral("pos"), m_lastPosition);
         m_lastPositionTime = QDateTime::currentMSecsSinceEpoch();
+
+        // most updates only confirm that the song goes on
+        if (expected < 0 || m_lastPosition < 0
+                || qAbs(m_lastPosition - expected) >= POSITION_TOLERANCE) {
+            changed |= Position;
+        }
+    }
+
+    // position is extrapolated from the play state, so restart it
+    bool isPlaying = np.get<bool>(QStringLiteral("isPlaying"), m_isPlaying);
+    if (isPlaying != m_isPlaying && !changed.testFlag(Position)
+            && m_lastPosition >= 0) {
+        m_lastPosition = position();
+        m_lastPositionTime = QDateTime::currentMSecsSinceEpoch();
     }
+    updateProperty(m_isPlaying, isPlaying, changed, IsPlaying);
 
-    emit propertiesChanged();
+    if (hadPosition != hasPosition()) {
+        changed |= Position;
+    }
+    if (couldSeek != seekAllowed()) {
+        changed |= SeekAllowed;
+    }
+
+    emitChanges(changed);
+}
+
+void MprisPlayer::emitChanges(Properties changed)
+{
+    if (!changed)
+        return;
+
+    if (changed & IsPlaying)
+        emit isPlayingChanged();
+    if (changed & CurrentSong)
+        emit currentSongChanged();
+    if (changed & Title)
+        emit titleChanged();
+    if (changed & Artist)
+        emit artistChanged();
+    if (changed & Album)
+        emit albumChanged();
+    if (changed & AlbumArtUrl)
+        emit albumArtUrlChanged();
+    if (changed & Volume)
+        emit volumeChanged();
+    if (changed & Length)
+        emit lengthChanged();
+    if (changed & Position)
+        emit positionChanged();
+    if (changed & PlayAllowed)
+        emit playAllowedChanged();
+    if (changed & PauseAllowed)
+        emit pauseAllowedChanged();
+    if (changed & GoNextAllowed)
+        emit goNextAllowedChanged();
+    if (changed & GoPreviousAllowed)
+        emit goPreviousAllowedChanged();
+    if (changed & SeekAllowed)
+        emit seekAllowedChanged();
+
+    emit propertiesChanged(changed);
 }
 
 void MprisPlayer::playPause()
@@ -176,8 +264,15 @@ MprisRemotePlugin::MprisRemotePlugin(Device* device,
                                      const QSet<QString> &outgoingCapabilities)
     : KdeConnectPlugin(device, name, outgoingCapabilities)
     , m_cache(new AlbumArtCache(
-                  Daemon::instance()->config(), device->id(), this))
+                  Daemon::instance()->config(), device->id(),
+                  config()->get<qint64>(
+                      QStringLiteral("albumArtCacheSize"),
+                      AlbumArtCache::DEFAULT_DEVICE_CACHE_SIZE),
+                  this))
 {
+    connect(m_cache, &AlbumArtCache::fetchRequested,
+            this, &MprisRemotePlugin::fetchAlbumArt);
+
     requestPlayerList();
 }
 
@@ -226,6 +321,7 @@ bool MprisRemotePlugin::receivePacket(const NetworkPacket& np)
         for (auto removedPlayer : asConst(oldPlayerList)) {
             m_players[removedPlayer]->deleteLater();
             m_players.remove(removedPlayer);
+            m_cache->releasePlayer(removedPlayer);
         }
 
         for (auto addedPlayer : asConst(addedPlayers)) {
@@ -262,6 +358,23 @@ bool MprisRemotePlugin::askForAlbumArt(
     return true;
 }
 
+void MprisRemotePlugin::fetchAlbumArt(const QUrl &url)
+{
+    if (!m_supportAlbumArtPayload)
+        return;
+
+    const QString albumArtUrl = url.toString();
+    for (MprisPlayer* player : asConst(m_players)) {
+        if (player->remoteAlbumArtUrl() != albumArtUrl)
+            continue;
+
+        if (m_cache->startFetching(url)) {
+            askForAlbumArt(albumArtUrl, player->name());
+        }
+        return;
+    }
+}
+
 void MprisRemotePlugin::sendCommand(
         const QString& player, const QString& method, const QString& value)
 {
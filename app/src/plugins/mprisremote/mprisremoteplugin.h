@@ -36,24 +36,49 @@ class MprisPlayer : public QObject
     Q_OBJECT
 
     Q_PROPERTY(QString name READ name CONSTANT)
-    Q_PROPERTY(bool isPlaying READ isPlaying NOTIFY propertiesChanged)
-    Q_PROPERTY(QString currentSong READ currentSong NOTIFY propertiesChanged)
-    Q_PROPERTY(QString title READ title NOTIFY propertiesChanged)
-    Q_PROPERTY(QString artist READ artist NOTIFY propertiesChanged)
-    Q_PROPERTY(QString album READ album NOTIFY propertiesChanged)
-    Q_PROPERTY(QUrl albumArtUrl READ albumArtUrl NOTIFY propertiesChanged)
-    Q_PROPERTY(int volume READ volume WRITE setVolume NOTIFY propertiesChanged)
-    Q_PROPERTY(qint64 length READ length NOTIFY propertiesChanged)
-    Q_PROPERTY(qint64 position READ position WRITE setPosition)
-    Q_PROPERTY(bool hasPosition READ hasPosition NOTIFY propertiesChanged)
-    Q_PROPERTY(bool playAllowed READ playAllowed NOTIFY propertiesChanged)
-    Q_PROPERTY(bool pauseAllowed READ pauseAllowed NOTIFY propertiesChanged)
-    Q_PROPERTY(bool goNextAllowed READ goNextAllowed NOTIFY propertiesChanged)
-    Q_PROPERTY(bool goPreviousAllowed READ goPreviousAllowed NOTIFY propertiesChanged)
-    Q_PROPERTY(bool seekAllowed READ seekAllowed NOTIFY propertiesChanged)
-    Q_PROPERTY(bool setVolumeAllowed READ setVolumeAllowed NOTIFY propertiesChanged)
+    Q_PROPERTY(bool isPlaying READ isPlaying NOTIFY isPlayingChanged)
+    Q_PROPERTY(QString currentSong READ currentSong NOTIFY currentSongChanged)
+    Q_PROPERTY(QString title READ title NOTIFY titleChanged)
+    Q_PROPERTY(QString artist READ artist NOTIFY artistChanged)
+    Q_PROPERTY(QString album READ album NOTIFY albumChanged)
+    Q_PROPERTY(QUrl albumArtUrl READ albumArtUrl NOTIFY albumArtUrlChanged)
+    Q_PROPERTY(int volume READ volume WRITE setVolume NOTIFY volumeChanged)
+    Q_PROPERTY(qint64 length READ length NOTIFY lengthChanged)
+    Q_PROPERTY(qint64 position READ position WRITE setPosition NOTIFY positionChanged)
+    Q_PROPERTY(bool hasPosition READ hasPosition NOTIFY positionChanged)
+    Q_PROPERTY(bool playAllowed READ playAllowed NOTIFY playAllowedChanged)
+    Q_PROPERTY(bool pauseAllowed READ pauseAllowed NOTIFY pauseAllowedChanged)
+    Q_PROPERTY(bool goNextAllowed READ goNextAllowed NOTIFY goNextAllowedChanged)
+    Q_PROPERTY(bool goPreviousAllowed READ goPreviousAllowed NOTIFY goPreviousAllowedChanged)
+    Q_PROPERTY(bool seekAllowed READ seekAllowed NOTIFY seekAllowedChanged)
+    Q_PROPERTY(bool setVolumeAllowed READ setVolumeAllowed CONSTANT)
 
 public:
+    enum Property {
+        IsPlaying = 1 << 0,
+        CurrentSong = 1 << 1,
+        Title = 1 << 2,
+        Artist = 1 << 3,
+        Album = 1 << 4,
+        AlbumArtUrl = 1 << 5,
+        Volume = 1 << 6,
+        Length = 1 << 7,
+        Position = 1 << 8,
+        PlayAllowed = 1 << 9,
+        PauseAllowed = 1 << 10,
+        GoNextAllowed = 1 << 11,
+        GoPreviousAllowed = 1 << 12,
+        SeekAllowed = 1 << 13,
+    };
+    Q_DECLARE_FLAGS(Properties, Property)
+    Q_FLAG(Properties)
+
+    /**
+     * Reported positions that differ less from the extrapolated position
+     * are not announced as change.
+     */
+    static constexpr qint64 POSITION_TOLERANCE = 1000;
+
     MprisPlayer(MprisRemotePlugin* parent, const QString& name);
 
     QString name() const { return m_player; }
@@ -90,7 +115,26 @@ public slots:
     Q_SCRIPTABLE void seek(int value);
 
 signals:
-    void propertiesChanged();
+    /**
+     * Emitted once after the single property signals for all @p changed
+     * properties.
+     */
+    void propertiesChanged(MprisPlayer::Properties changed);
+
+    void isPlayingChanged();
+    void currentSongChanged();
+    void titleChanged();
+    void artistChanged();
+    void albumChanged();
+    void albumArtUrlChanged();
+    void volumeChanged();
+    void lengthChanged();
+    void positionChanged();
+    void playAllowedChanged();
+    void pauseAllowedChanged();
+    void goNextAllowedChanged();
+    void goPreviousAllowedChanged();
+    void seekAllowedChanged();
 
 private:
     MprisRemotePlugin* m_parent;
@@ -121,8 +165,12 @@ private:
     {
         return m_isSpotify;
     }
+
+    void emitChanges(Properties changed);
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(MprisPlayer::Properties)
+
 
 class MprisRemotePlugin : public KdeConnectPlugin
 {
@@ -160,6 +208,7 @@ private:
     void requestPlayerList();
     void requestPlayerStatus(const QString& player);
     bool askForAlbumArt(const QString &url, const QString& playerName);
+    void fetchAlbumArt(const QUrl& url);
 };
 
 class MprisRemotePluginFactory :
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "notificationiconcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFileInfo>
+
+namespace SailfishConnect {
+
+constexpr int NotificationIconCache::MAX_COST_KB;
+
+NotificationIconCache::NotificationIconCache()
+{
+    m_icons.setMaxCost(MAX_COST_KB);
+}
+
+NotificationIconCache* NotificationIconCache::instance()
+{
+    static NotificationIconCache instance;
+    return &instance;
+}
+
+NotificationIconCache::Icon NotificationIconCache::icon(
+        const QString& key, const std::function<QByteArray()>& encode)
+{
+    if (Icon* icon = m_icons.object(key)) {
+        ++m_hits;
+        return *icon;
+    }
+
+    ++m_misses;
+    auto* icon = new Icon();
+    icon->png = encode();
+    if (!icon->png.isEmpty()) {
+        icon->md5 = QCryptographicHash::hash(
+                    icon->png, QCryptographicHash::Md5);
+    }
+
+    Icon result = *icon;
+    m_icons.insert(key, icon, qMax(1, icon->png.size() / 1024));
+    return result;
+}
+
+QString NotificationIconCache::themeKey(const QString& iconName)
+{
+    return QStringLiteral("theme:") + iconName;
+}
+
+QString NotificationIconCache::fileKey(const QString& path)
+{
+    QFileInfo info(path);
+    return QStringLiteral("file:") % path
+            % QChar(':') % QString::number(
+                info.lastModified().toMSecsSinceEpoch())
+            % QChar(':') % QString::number(info.size());
+}
+
+QString NotificationIconCache::imageDataKey(
+        const QByteArray& imageData, int width, int height, int rowStride,
+        bool hasAlpha)
+{
+    return QStringLiteral("data:") % QString::fromLatin1(
+                QCryptographicHash::hash(
+                    imageData, QCryptographicHash::Md5).toHex())
+            % QChar(':') % QString::number(width)
+            % QChar('x') % QString::number(height)
+            % QChar(':') % QString::number(rowStride)
+            % QChar(':') % QString::number(hasAlpha ? 1 : 0);
+}
+
+} // namespace SailfishConnect
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOTIFICATIONICONCACHE_H
+#define NOTIFICATIONICONCACHE_H
+
+#include <functional>
+
+#include <QByteArray>
+#include <QCache>
+#include <QString>
+
+namespace SailfishConnect {
+
+/**
+ * Notification icons encoded as PNG, shared by all devices.
+ *
+ * Icons are keyed by their source, e.g. the theme icon name, the file path
+ * with its modification time or the digest of raw image data. So an app
+ * posting many notifications with the same icon encodes it only once.
+ * The MD5 of the PNG is sent as payloadHash, so peers that have the icon
+ * already can skip the transfer.
+ *
+ * Must only be used from the main thread.
+ */
+class NotificationIconCache
+{
+public:
+    static constexpr int MAX_COST_KB = 2 * 1024;
+
+    struct Icon {
+        QByteArray png;
+        QByteArray md5;
+
+        bool isNull() const { return png.isEmpty(); }
+        QString payloadHash() const { return QString::fromLatin1(md5.toHex()); }
+    };
+
+    static NotificationIconCache* instance();
+
+    /**
+     * Icon for source @p key, @p encode is called to create the PNG when it
+     * is not cached. Failures are cached too.
+     */
+    Icon icon(const QString& key, const std::function<QByteArray()>& encode);
+
+    static QString themeKey(const QString& iconName);
+    static QString fileKey(const QString& path);
+    static QString imageDataKey(
+            const QByteArray& imageData, int width, int height, int rowStride,
+            bool hasAlpha);
+
+    quint64 hitCount() const { return m_hits; }
+    quint64 missCount() const { return m_misses; }
+
+private:
+    NotificationIconCache();
+
+    QCache<QString, Icon> m_icons;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // NOTIFICATIONICONCACHE_H
@@ -42,32 +42,49 @@ namespace SailfishConnect {
 static Q_LOGGING_CATEGORY(logger, "SailfishConnect.SendNotifications")
 
 const char* NOTIFY_SIGNATURE = "susssasa{sv}i";
+const char* NOTIFY_REPLY_SIGNATURE = "u";
+const char* NOTIFICATION_CLOSED_SIGNATURE = "uu";
 
+// time in ms after which a Notify call is not expected to be answered anymore
+const qint64 NOTIFY_REPLY_TIMEOUT = 30 * 1000;
 
-void becomeMonitor(DBusConnection* conn, const char* match) {
+constexpr int NotificationsListener::COALESCE_WINDOW;
+constexpr int NotificationsListener::DEFAULT_MIN_UPDATE_INTERVAL;
+
+
+bool becomeMonitor(DBusConnection* conn, const char** matches, int count) {
     // message
     DBusMessage* msg = dbus_message_new_method_call(
         DBUS_SERVICE_DBUS,
         DBUS_PATH_DBUS,
         DBUS_INTERFACE_MONITORING,
         "BecomeMonitor");
-    Q_ASSERT(msg != nullptr);
+    if (msg == nullptr) {
+        qCCritical(logger) << "Out of memory creating BecomeMonitor call";
+        return false;
+    }
 
     // arguments
-    const char* matches[] = {match};
-    const char** matches_ = matches;
     dbus_uint32_t flags = 0;
-    Q_ASSERT(dbus_message_append_args(
+    bool ok = dbus_message_append_args(
                 msg,
-                DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &matches_, 1,
+                DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &matches, count,
                 DBUS_TYPE_UINT32, &flags,
-                DBUS_TYPE_INVALID));
+                DBUS_TYPE_INVALID);
 
     // send
     // TODO: wait and check for error: dbus_connection_send_with_reply_and_block
-    Q_ASSERT(dbus_connection_send(conn, msg, nullptr));
+    if (!ok) {
+        qCCritical(logger) << "Could not append BecomeMonitor arguments";
+    } else {
+        ok = dbus_connection_send(conn, msg, nullptr);
+        if (!ok) {
+            qCCritical(logger) << "Could not send BecomeMonitor call";
+        }
+    }
 
     dbus_message_unref(msg);
+    return ok;
 }
 
 extern "C" DBusHandlerResult handleMessageFromC(
@@ -87,12 +104,17 @@ extern "C" DBusHandlerResult handleMessageFromC(
     return DBUS_HANDLER_RESULT_HANDLED;
 }
 
-NotificationsListenerThread::NotificationsListenerThread() = default;
+NotificationsListenerThread::NotificationsListenerThread()
+{
+    m_clock.start();
+}
 
 NotificationsListenerThread::~NotificationsListenerThread()
 {
     quit();
-    dbus_connection_unref(m_connection);
+    if (m_connection) {
+        dbus_connection_unref(m_connection);
+    }
 }
 
 void NotificationsListenerThread::quit()
@@ -116,10 +138,21 @@ void NotificationsListenerThread::run()
     dbus_connection_set_exit_on_disconnect(connection, false);
     dbus_connection_add_filter(connection, handleMessageFromC, this, nullptr);
 
-    becomeMonitor(
-                connection,
-                "interface='org.freedesktop.Notifications',"
-                "member='Notify'");
+    // replies carry the ids of new notifications
+    const char* matches[] = {
+        "interface='org.freedesktop.Notifications',"
+        "member='Notify'",
+        "type='method_return',"
+        "sender='org.freedesktop.Notifications'",
+        "type='error',"
+        "sender='org.freedesktop.Notifications'",
+        "type='signal',"
+        "interface='org.freedesktop.Notifications',"
+        "member='NotificationClosed'"
+    };
+    if (!becomeMonitor(connection, matches, 4)) {
+        return;
+    }
 
     // wake up every minute to see if we are still connected
     while (dbus_connection_read_write_dispatch(connection, 60 * 1000))
@@ -148,6 +181,12 @@ void NotificationsListenerThread::handleMessage(
     if (dbus_message_is_method_call(
                 message, "org.freedesktop.Notifications", "Notify")) {
         handleNotifyCall(message);
+    } else if (dbus_message_is_signal(
+                   message, "org.freedesktop.Notifications",
+                   "NotificationClosed")) {
+        handleNotificationClosed(message);
+    } else if (dbus_message_get_reply_serial(message) != 0) {
+        handleNotifyReply(message);
     }
 }
 
@@ -262,24 +301,129 @@ void NotificationsListenerThread::handleNotifyCall(DBusMessage *message)
         return;
     }
 
-    QString appName = nextString(&iter);
-    uint replacesId = nextUnsigned(&iter);
-    QString appIcon = nextString(&iter);
-    QString summary = nextString(&iter);
-    QString body = nextString(&iter);
-    QStringList actions = nextStringList(&iter);
-    QVariantMap hints = nextVariantMap(&iter);
-    int timeout = nextInt(&iter);
+    QSharedPointer<NotificationEvent> event(new NotificationEvent());
+    event->appName = nextString(&iter);
+    event->replacesId = nextUnsigned(&iter);
+    event->appIcon = nextString(&iter);
+    event->summary = nextString(&iter);
+    event->body = nextString(&iter);
+    event->actions = nextStringList(&iter);
+    event->hints = nextVariantMap(&iter);
+    event->timeout = nextInt(&iter);
+
+    if (event->replacesId != 0) {
+        event->id = event->replacesId;
+        Q_EMIT Notify(event);
+        return;
+    }
+
+    // calls the server never answered
+    const qint64 now = m_clock.elapsed();
+    for (auto pending = m_pendingNotifies.begin();
+         pending != m_pendingNotifies.end();) {
+        if (now - pending->since > NOTIFY_REPLY_TIMEOUT) {
+            pending = m_pendingNotifies.erase(pending);
+        } else {
+            ++pending;
+        }
+    }
+
+    const CallKey key(QString::fromUtf8(dbus_message_get_sender(message)),
+                      dbus_message_get_serial(message));
+    m_pendingNotifies.insert(key, PendingNotify{event, now});
+}
+
+void NotificationsListenerThread::handleNotifyReply(DBusMessage *message)
+{
+    const CallKey key(QString::fromUtf8(dbus_message_get_destination(message)),
+                      dbus_message_get_reply_serial(message));
+    const PendingNotify pending = m_pendingNotifies.take(key);
+    if (!pending.event)
+        return;  // reply to another call
+
+    if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_ERROR) {
+        qCDebug(logger)
+                << "Notify of" << pending.event->appName << "failed:"
+                << dbus_message_get_error_name(message);
+        return;
+    }
+
+    if (!dbus_message_has_signature(message, NOTIFY_REPLY_SIGNATURE)) {
+        qCWarning(logger).nospace()
+                << "Reply to Notify has wrong signature. Expected "
+                << NOTIFY_REPLY_SIGNATURE << ", got "
+                << dbus_message_get_signature(message);
+        return;
+    }
 
-    Q_EMIT Notify(
-                appName, replacesId, appIcon, summary, body, actions, hints,
-                timeout);
+    DBusMessageIter iter;
+    dbus_message_iter_init(message, &iter);
+    pending.event->id = nextUnsigned(&iter);
+
+    Q_EMIT Notify(pending.event);
+}
+
+void NotificationsListenerThread::handleNotificationClosed(
+        DBusMessage *message)
+{
+    DBusMessageIter iter;
+    dbus_message_iter_init(message, &iter);
+
+    if (!dbus_message_has_signature(message, NOTIFICATION_CLOSED_SIGNATURE)) {
+        qCWarning(logger).nospace()
+                << "NotificationClosed has wrong signature. Expected "
+                << NOTIFICATION_CLOSED_SIGNATURE << ", got "
+                << dbus_message_get_signature(message);
+        return;
+    }
+
+    uint id = nextUnsigned(&iter);
+    uint reason = nextUnsigned(&iter);
+
+    Q_EMIT NotificationClosed(id, reason);
+}
+
+NotificationsMonitor::NotificationsMonitor()
+    : m_thread(new NotificationsListenerThread())
+{
+    qRegisterMetaType<NotificationEventPtr>();
+
+    connect(m_thread, &NotificationsListenerThread::Notify,
+            this, &NotificationsMonitor::Notify);
+    connect(m_thread, &NotificationsListenerThread::NotificationClosed,
+            this, &NotificationsMonitor::NotificationClosed);
+
+    m_thread->start();
+}
+
+NotificationsMonitor::~NotificationsMonitor()
+{
+    m_thread->quit();
+    if (m_thread->wait(1000)) {
+        delete m_thread;
+    } else {
+        // still blocked in libdbus, leave it to process exit
+        qCWarning(logger) << "Notification monitor thread did not stop";
+    }
+}
+
+QSharedPointer<NotificationsMonitor> NotificationsMonitor::instance()
+{
+    static QWeakPointer<NotificationsMonitor> instance;
+
+    QSharedPointer<NotificationsMonitor> result = instance.toStrongRef();
+    if (!result) {
+        result = QSharedPointer<NotificationsMonitor>(
+                    new NotificationsMonitor());
+        instance = result;
+    }
+    return result;
 }
 
 NotificationsListener::NotificationsListener(KdeConnectPlugin* aPlugin)
     : QObject(aPlugin)
     , m_plugin(aPlugin)
-    , m_thread(new NotificationsListenerThread())
+    , m_monitor(NotificationsMonitor::instance())
 {
     qRegisterMetaTypeStreamOperators<NotifyingApplication>(
         "NotifyingApplication");
@@ -289,15 +433,21 @@ NotificationsListener::NotificationsListener(KdeConnectPlugin* aPlugin)
     connect(
         m_plugin->config(), &SailfishConnectPluginConfig::configChanged,
         this, &NotificationsListener::loadApplications);
-    connect(m_thread, &NotificationsListenerThread::Notify,
+    connect(m_monitor.data(), &NotificationsMonitor::Notify,
             this, &NotificationsListener::onNotify);
+    connect(m_monitor.data(), &NotificationsMonitor::NotificationClosed,
+            this, &NotificationsListener::onNotificationClosed);
 
-    m_thread->start();
+    m_throttle.setCoalesceWindow(COALESCE_WINDOW);
+    loadUpdateInterval();
+    connect(
+        m_plugin->config(), &SailfishConnectPluginConfig::configChanged,
+        this, &NotificationsListener::loadUpdateInterval);
+    connect(&m_throttle, &PacketThrottle::send,
+            this, &NotificationsListener::sendPacket);
 }
 
-NotificationsListener::~NotificationsListener() {
-    m_thread->quit();
-}
+NotificationsListener::~NotificationsListener() = default;
 
 void NotificationsListener::loadApplications()
 {
@@ -312,6 +462,13 @@ void NotificationsListener::loadApplications()
     qCDebug(logger) << "Loaded" << m_applications.size() << " applications";
 }
 
+void NotificationsListener::loadUpdateInterval()
+{
+    m_throttle.setMinInterval(m_plugin->config()->get<int>(
+        QStringLiteral("generalMinUpdateInterval"),
+        DEFAULT_MIN_UPDATE_INTERVAL));
+}
+
 bool NotificationsListener::parseImageDataArgument(const QVariant& argument,
                                                    int& width, int& height,
                                                    int& rowStride, int& bitsPerSample,
@@ -335,8 +492,7 @@ static QByteArray imageToPng(const QImage& image) {
     QBuffer buffer;
     buffer.open(QIODevice::ReadWrite);
 
-    // TODO: cache icons
-    bool success = image.save(buffer.data(), "PNG");
+    bool success = image.save(&buffer, "PNG");
     if (success) {
         return buffer.data();
     } else {
@@ -344,23 +500,7 @@ static QByteArray imageToPng(const QImage& image) {
     }
 }
 
-static QSharedPointer<QIODevice> imageToPngBuffer(const QImage& image) {
-    if (image.isNull())
-        return QSharedPointer<QIODevice>();
-
-    QSharedPointer<QBuffer> buffer;
-    buffer->open(QIODevice::ReadWrite);
-
-    bool success = image.save(buffer->data(), "PNG");
-    if (success) {
-        buffer->seek(0);
-        return buffer;
-    } else {
-        return QSharedPointer<QIODevice>();
-    }
-}
-
-QSharedPointer<QIODevice> NotificationsListener::iconForImageData(
+NotificationIconCache::Icon NotificationsListener::iconForImageData(
         const QVariant& argument) const
 {
     int width, height, rowStride, bitsPerSample, channels;
@@ -369,7 +509,7 @@ QSharedPointer<QIODevice> NotificationsListener::iconForImageData(
 
     if (!parseImageDataArgument(argument, width, height, rowStride, bitsPerSample,
                                 channels, hasAlpha, imageData))
-        return QSharedPointer<QIODevice>();
+        return NotificationIconCache::Icon();
 
     if (bitsPerSample != 8) {
         qCWarning(logger)
@@ -380,15 +520,21 @@ QSharedPointer<QIODevice> NotificationsListener::iconForImageData(
             << "bitsPerSample=" << bitsPerSample
             << "channels=" << channels
             << "hasAlpha=" << hasAlpha;
-        return QSharedPointer<QIODevice>();
+        return NotificationIconCache::Icon();
     }
 
-    QImage image(reinterpret_cast<uchar*>(imageData.data()), width, height, rowStride,
-                 hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
-    if (hasAlpha)
-        image = image.rgbSwapped();  // RGBA --> ARGB
-
-    return imageToPngBuffer(image);
+    return NotificationIconCache::instance()->icon(
+        NotificationIconCache::imageDataKey(
+            imageData, width, height, rowStride, hasAlpha),
+        [&]() {
+            QImage image(reinterpret_cast<uchar*>(imageData.data()),
+                         width, height, rowStride,
+                         hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+            if (hasAlpha)
+                image = image.rgbSwapped();  // RGBA --> ARGB
+
+            return imageToPng(image);
+        });
 }
 
 static QByteArray pathToPng(const QString& path) {
@@ -424,91 +570,105 @@ static QByteArray themeIconToPng(const QString& iconName) {
     return buffer;
 }
 
-QSharedPointer<QIODevice> NotificationsListener::iconForIconName(
+#ifdef SAILFISHOS
+static QByteArray imageProviderToPng(const QUrl& url) {
+    auto* imageProvider = static_cast<QQuickImageProvider*>(
+            AppDaemon::instance()->imageProvider(url.host()));
+    if (!imageProvider) {
+        qCWarning(logger)
+                << "No image provider" << url.host() << "found.";
+        return QByteArray();
+    }
+
+    QString id = url.path();
+    id.remove(0, 1);
+
+    QSize size;
+    QSize requestedSize(128, 128);
+    QImage image;
+    switch (imageProvider->imageType()) {
+    case QQmlImageProviderBase::Image:
+        qCDebug(logger)
+                << "Get image from QQmlImageProvider" << id;
+        image = imageProvider->requestImage(
+            id, &size, requestedSize);
+        break;
+    case QQmlImageProviderBase::Pixmap:
+        qCDebug(logger)
+                << "Get pixmap from QQmlImageProvider" << id;
+        image = imageProvider->requestPixmap(
+            id, &size, requestedSize).toImage();
+        break;
+    case QQmlImageProviderBase::Texture:
+        qCDebug(logger)
+                << "Get texture from QQmlImageProvider" << id;
+        image = imageProvider->requestTexture(
+            id, &size, requestedSize)->image();
+        break;
+    default:
+        Q_UNREACHABLE();
+    }
+
+    if (image.isNull()) {
+        qCWarning(logger)
+                << "Could not get theme icon:"
+                << url;
+    }
+
+    QByteArray result = imageToPng(image);
+    if (result.isNull()) {
+        qCWarning(logger)
+                << "Could not convert theme icon to png:"
+                << url;
+    }
+    return result;
+}
+#endif
+
+NotificationIconCache::Icon NotificationsListener::iconForIconName(
         const QString& iconName) const
 {
-    qCDebug(logger) << "convert icon name" << iconName << "to png";
+    auto* cache = NotificationIconCache::instance();
 
-    QByteArray result;
     if (!iconName.contains(QChar('/'))) {
-        result = themeIconToPng(iconName);
-    } else {
-        auto url = QUrl::fromUserInput(
-            iconName, QString(), QUrl::AssumeLocalFile);
+        return cache->icon(
+            NotificationIconCache::themeKey(iconName),
+            [&]() { return themeIconToPng(iconName); });
+    }
 
-        QString scheme = url.scheme();
-        if (scheme == QLatin1String("file")) {
-            result = pathToPng(url.path());
+    auto url = QUrl::fromUserInput(
+        iconName, QString(), QUrl::AssumeLocalFile);
+
+    QString scheme = url.scheme();
+    if (scheme == QLatin1String("file")) {
+        QString path = url.path();
+        return cache->icon(
+            NotificationIconCache::fileKey(path),
+            [&]() { return pathToPng(path); });
 #ifdef SAILFISHOS
-        } else if (scheme == QLatin1String("image")) {
-            auto* imageProvider = static_cast<QQuickImageProvider*>(
-                    AppDaemon::instance()->imageProvider(url.host()));
-            if (!imageProvider) {
-                qCWarning(logger)
-                        << "No image provider" << url.host() << "found.";
-                result = QByteArray();
-            } else {
-                QString id = url.path();
-                id.remove(0, 1);
-
-                QSize size;
-                QSize requestedSize(128, 128);
-                QImage image;
-                switch (imageProvider->imageType()) {
-                case QQmlImageProviderBase::Image:
-                    qCDebug(logger)
-                            << "Get image from QQmlImageProvider" << id;
-                    image = imageProvider->requestImage(
-                        id, &size, requestedSize);
-                    break;
-                case QQmlImageProviderBase::Pixmap:
-                    qCDebug(logger)
-                            << "Get pixmap from QQmlImageProvider" << id;
-                    image = imageProvider->requestPixmap(
-                        id, &size, requestedSize).toImage();
-                    break;
-                case QQmlImageProviderBase::Texture:
-                    qCDebug(logger)
-                            << "Get texture from QQmlImageProvider" << id;
-                    image = imageProvider->requestTexture(
-                        id, &size, requestedSize)->image();
-                    break;
-                default:
-                    Q_UNREACHABLE();
-                }
-
-                if (image.isNull()) {
-                    qCWarning(logger)
-                            << "Could not get theme icon:"
-                            << iconName;
-                }
-
-                result = imageToPng(image);
-                if (result.isNull()) {
-                    qCWarning(logger)
-                            << "Could not convert theme icon to png:"
-                            << iconName;
-                }
-            }
+    } else if (scheme == QLatin1String("image")) {
+        return cache->icon(
+            url.toString(),
+            [&]() { return imageProviderToPng(url); });
 #endif
-        } else {
-            qCWarning(logger)
-                    << "Not supported file scheme for icon file" << scheme;
-            result = QByteArray();
-        }
     }
 
-    auto* buffer = new QBuffer();
-    buffer->setData(result);
-    return QSharedPointer<QIODevice>(buffer);
+    qCWarning(logger)
+            << "Not supported file scheme for icon file" << scheme;
+    return NotificationIconCache::Icon();
 }
 
-void NotificationsListener::onNotify(const QString& appName, uint replacesId,
-                                     const QString& appIcon,
-                                     const QString& summary, const QString& body,
-                                     const QStringList& actions,
-                                     const QVariantMap& hints, int timeout)
+void NotificationsListener::onNotify(const NotificationEventPtr& event)
 {
+    const QString& appName = event->appName;
+    const uint replacesId = event->replacesId;
+    const QString& appIcon = event->appIcon;
+    const QString& summary = event->summary;
+    const QString& body = event->body;
+    const QStringList& actions = event->actions;
+    const QVariantMap& hints = event->hints;
+    const int timeout = event->timeout;
+
     Q_UNUSED(actions);
 
 //    qCDebug(logger)
@@ -587,10 +747,9 @@ void NotificationsListener::onNotify(const QString& appName, uint replacesId,
 #endif
 
     // TODO: use nemo hints
-    // TODO: if id == 0 use return value of call
     //qCDebug(logger) << "Sending notification from" << appName << ":" <<ticker << "; appIcon=" << appIcon;
     NetworkPacket np("kdeconnect.notification", {
-        {QStringLiteral("id"), QString::number(replacesId)},
+        {QStringLiteral("id"), QString::number(event->id)},
         {QStringLiteral("appName"), appName},
         {QStringLiteral("ticker"), ticker},
         {QStringLiteral("isClearable"), timeout == -1},
@@ -604,36 +763,59 @@ void NotificationsListener::onNotify(const QString& appName, uint replacesId,
     // Only send icon on first notify (replacesId == 0)
     if (config->get(QStringLiteral("generalSynchronizeIcons"), true)
             && replacesId == 0) {
-        QSharedPointer<QIODevice> iconSource;
+        NotificationIconCache::Icon icon;
         // try different image sources according to priorities in notifications-
         // spec version 1.2:
         if (hints.contains(QStringLiteral("image-data")))
-            iconSource = iconForImageData(hints[QStringLiteral("image-data")]);
+            icon = iconForImageData(hints[QStringLiteral("image-data")]);
         // 1.1 backward compatibility
         else if (hints.contains(QStringLiteral("image_data")))
-            iconSource = iconForImageData(hints[QStringLiteral("image_data")]);
+            icon = iconForImageData(hints[QStringLiteral("image_data")]);
         else if (hints.contains(QStringLiteral("image-path")))
-            iconSource = iconForIconName(hints[QStringLiteral("image-path")].toString());
+            icon = iconForIconName(hints[QStringLiteral("image-path")].toString());
         // 1.1 backward compatibility
         else if (hints.contains(QStringLiteral("image_path")))
-            iconSource = iconForIconName(hints[QStringLiteral("image_path")].toString());
+            icon = iconForIconName(hints[QStringLiteral("image_path")].toString());
         else if (!appIcon.isEmpty())
-            iconSource = iconForIconName(appIcon);
+            icon = iconForIconName(appIcon);
         // < 1.1 backward compatibility
         else if (hints.contains(QStringLiteral("icon_data")))
-            iconSource = iconForImageData(hints[QStringLiteral("icon_data")]);
+            icon = iconForImageData(hints[QStringLiteral("icon_data")]);
 #ifdef SAILFISHOS
         // Lipstick compatibility (deprecated)
         else if (hints.contains(QStringLiteral("x-nemo-icon")))
-            iconSource = iconForIconName(hints[QStringLiteral("x-nemo-icon")].toString());
+            icon = iconForIconName(hints[QStringLiteral("x-nemo-icon")].toString());
 #endif
 
-        if (iconSource) {
-            np.setPayload(iconSource, iconSource->size());
-            // TODO: np.set(QStringLiteral("payloadHash"), );
+        if (!icon.isNull()) {
+            auto* buffer = new QBuffer();
+            buffer->setData(icon.png);
+            np.setPayload(QSharedPointer<QIODevice>(buffer), icon.png.size());
+            np.set(QStringLiteral("payloadHash"), icon.payloadHash());
         }
     }
 
+    // updates of the notification only send its latest state
+    m_throttle.submit(QString::number(event->id), np);
+}
+
+void NotificationsListener::onNotificationClosed(uint id, uint reason)
+{
+    Q_UNUSED(reason);
+
+    if (!m_throttle.remove(QString::number(id)))
+        return;  // not sent by us
+
+    // dismissals are never delayed
+    ++m_dismissals;
+    m_plugin->sendPacket(NetworkPacket("kdeconnect.notification", {
+        {QStringLiteral("id"), QString::number(id)},
+        {QStringLiteral("isCancel"), true},
+    }));
+}
+
+void NotificationsListener::sendPacket(NetworkPacket np)
+{
     m_plugin->sendPacket(np);
 }
 
@@ -22,12 +22,18 @@
 #pragma once
 
 #include <sailfishconnect/device.h>
+#include <sailfishconnect/networkpacket.h>
 #include <QIODevice>
 #include <QSharedPointer>
 #include <QThread>
 #include <QHash>
 #include <QSet>
+#include <QPair>
+#include <QElapsedTimer>
 #include <dbus/dbus.h>
+#include <sailfishconnect/helper/packetthrottle.h>
+
+#include "notificationiconcache.h"
 
 class KdeConnectPlugin;
 
@@ -78,6 +84,25 @@ private:
     DBusError err;
 };
 
+/**
+ * A Notify call seen on the session bus, parsed once and shared by all
+ * listeners.
+ */
+struct NotificationEvent {
+    /// id the notification server returned, equal to replacesId for updates
+    uint id = 0;
+    QString appName;
+    uint replacesId;
+    QString appIcon;
+    QString summary;
+    QString body;
+    QStringList actions;
+    QVariantMap hints;
+    int timeout;
+};
+
+using NotificationEventPtr = QSharedPointer<const NotificationEvent>;
+
 class NotificationsListenerThread : public QThread {
     Q_OBJECT
 public:
@@ -101,9 +126,8 @@ public:
     void handleMessage(DBusMessage *message);
 
 signals:
-    void Notify(const QString&, uint, const QString&,
-                const QString&, const QString&,
-                const QStringList&, const QVariantMap&, int);
+    void Notify(const SailfishConnect::NotificationEventPtr&);
+    void NotificationClosed(uint, uint);
 protected:
     void run() override;
 
@@ -111,26 +135,71 @@ private:
     QAtomicPointer<DBusConnection> m_connection = nullptr;
     RawDbusError lastError;
 
+    using CallKey = QPair<QString, dbus_uint32_t>;
+
+    struct PendingNotify {
+        QSharedPointer<NotificationEvent> event;
+        qint64 since;
+    };
+
+    // new notifications waiting for the id in the reply of the server
+    QHash<CallKey, PendingNotify> m_pendingNotifies;
+    QElapsedTimer m_clock;
+
     void handleNotifyCall(DBusMessage *message);
+    void handleNotifyReply(DBusMessage *message);
+    void handleNotificationClosed(DBusMessage *message);
 };
 
-class IconCacheEntry : public QObject {
+/**
+ * Monitors notifications of the session bus for all devices.
+ *
+ * There is only one monitor thread and D-Bus connection per process. It
+ * lives as long as a NotificationsListener holds a reference to it.
+ */
+class NotificationsMonitor : public QObject
+{
+    Q_OBJECT
 public:
+    ~NotificationsMonitor() override;
+
+    static QSharedPointer<NotificationsMonitor> instance();
+
+signals:
+    void Notify(const SailfishConnect::NotificationEventPtr&);
+    void NotificationClosed(uint, uint);
+
 private:
-    QByteArray pngData;
-    QByteArray md5Hash;
+    NotificationsMonitor();
+
+    NotificationsListenerThread* m_thread;
 };
 
-// TODO: make singleton with shapedpointer/weakpointer
 class NotificationsListener : public QObject
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.freedesktop.Notifications")
 
 public:
+    /**
+     * Updates of the same notification are collected for this time in ms,
+     * so only the latest state of a burst is sent.
+     */
+    static constexpr int COALESCE_WINDOW = 250;
+
+    /**
+     * Default minimum time in ms between two packets for the same
+     * notification. Configurable with generalMinUpdateInterval.
+     */
+    static constexpr int DEFAULT_MIN_UPDATE_INTERVAL = 1000;
+
     explicit NotificationsListener(KdeConnectPlugin* aPlugin);
     ~NotificationsListener() override;
 
+    quint64 sentPacketCount() const { return m_throttle.sentPackets(); }
+    quint64 droppedPacketCount() const { return m_throttle.droppedPackets(); }
+    quint64 dismissalCount() const { return m_dismissals; }
+
 protected:
     // virtual helper function to make testing possible (QDBusArgument can not
     // be injected without making a DBUS-call):
@@ -138,22 +207,26 @@ protected:
                                         int& height, int& rowStride, int& bitsPerSample,
                                         int& channels, bool& hasAlpha,
                                         QByteArray& imageData) const;
-    QSharedPointer<QIODevice> iconForImageData(const QVariant& argument) const;
-    QSharedPointer<QIODevice> iconForIconName(const QString& iconName) const;
+    NotificationIconCache::Icon iconForImageData(const QVariant& argument) const;
+    NotificationIconCache::Icon iconForIconName(const QString& iconName) const;
 
 private Q_SLOTS:
     void loadApplications();
-    void onNotify(const QString&, uint, const QString&,
-                  const QString&, const QString&,
-                  const QStringList&, const QVariantMap&, int);
+    void loadUpdateInterval();
+    void onNotify(const SailfishConnect::NotificationEventPtr& event);
+    void onNotificationClosed(uint id, uint reason);
+    void sendPacket(NetworkPacket np);
 
 private:
-    QSharedPointer<QIODevice> pngFromImage();
-
     KdeConnectPlugin* m_plugin;
     QHash<QString, NotifyingApplication> m_applications;
-    NotificationsListenerThread* m_thread;
-    //QCache<IconCacheEntry> m_iconCache;
+    QSharedPointer<NotificationsMonitor> m_monitor;
+
+    // updates of a notification by its id
+    PacketThrottle m_throttle;
+    quint64 m_dismissals = 0;
 };
 
 } // namespace SailfishConnect
+
+Q_DECLARE_METATYPE(SailfishConnect::NotificationEventPtr)
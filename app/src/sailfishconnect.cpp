@@ -37,6 +37,7 @@
 #include "appdaemon.h"
 #include <sailfishconnect/device.h>
 #include <sailfishconnect/kdeconnectplugin.h>
+#include <sailfishconnect/helper/tracing.h>
 #include "plugins/mprisremote/mprisremoteplugin.h"
 #include "plugins/touchpad/touchpadplugin.h"
 #include "models/devicelistmodel.h"
@@ -98,6 +99,7 @@ void myMessageOutput(QtMsgType type, const QMessageLogContext &context, const QS
 }
 
 void registerQmlTypes() {
+    SC_TRACE_SCOPE("registerQmlTypes");
     // TODO: register in plugin factories when possible
     qmlRegisterType<DeviceListModel>(
                 "SailfishConnect.UI", 0, 3, "DeviceListModel");
@@ -128,6 +130,7 @@ void registerQmlTypes() {
 
 std::unique_ptr<QGuiApplication> createApplication(int &argc, char **argv)
 {
+    SC_TRACE_SCOPE("createApplication");
     std::unique_ptr<QGuiApplication> app(SailfishApp::application(argc, argv));
     app->setApplicationDisplayName(PRETTY_PACKAGE_NAME);
     app->setApplicationName(PACKAGE_NAME);
@@ -172,6 +175,9 @@ int main(int argc, char *argv[])
     qInstallMessageHandler(myMessageOutput);
 
     auto app = createApplication(argc, argv);
+#ifdef SAILFISHCONNECT_TRACING
+    Tracing::writeTraceOnQuit(app.get());
+#endif
 
     auto options = parseCommandLine(*app);
 
@@ -33,6 +33,7 @@
 #include "appdaemon.h"
 #include "plugins/mprisremote/albumartcache.h"
 #include "sailfishconnect.h"
+#include <sailfishconnect/helper/tracing.h>
 
 namespace SailfishConnect {
 
@@ -74,6 +75,7 @@ UI::~UI() = default;
 
 void UI::showMainWindow()
 {
+    SC_TRACE_SCOPE("UI::showMainWindow");
     if (m_view) {
         m_view->showFullScreen();
         return;
@@ -92,7 +94,10 @@ void UI::showMainWindow()
     m_view->rootContext()->setContextProperty("daemon", m_daemon.get());
     m_view->rootContext()->setContextProperty("ui", this);
     m_view->rootContext()->setContextProperty("keyboardLayout", m_keyboardLayoutProvider);
-    m_view->setSource(SailfishApp::pathToMainQml());
+    {
+        SC_TRACE_SCOPE("QQuickView::setSource");
+        m_view->setSource(SailfishApp::pathToMainQml());
+    }
     m_view->showFullScreen();
 }
 
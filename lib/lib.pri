@@ -1,6 +1,7 @@
 QT += network dbus
 CONFIG += link_pkgconfig
 PKGCONFIG += openssl
+CONFIG(tracing):DEFINES += SAILFISHCONNECT_TRACING
 
 INCLUDEPATH += $$PWD
 LIBS += -L$$OUT_PWD/../lib -lsailfishconnect
@@ -13,6 +13,7 @@ DEFINES += \
     QT_DISABLE_DEPRECATED_BEFORE=0x050600 \
     QT_USE_QSTRINGBUILDER
 CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT QT_NO_DEBUG
+CONFIG(tracing):DEFINES += SAILFISHCONNECT_TRACING
 INCLUDEPATH += $PWD
 
 SOURCES += \
@@ -39,9 +40,18 @@ SOURCES += \
     sailfishconnect/downloadjob.cpp \
     sailfishconnect/backend/lan/lanuploadjob.cpp \
     sailfishconnect/backend/lan/lannetworklistener.cpp \
+    sailfishconnect/backend/lan/announcescheduler.cpp \
+    sailfishconnect/backend/loopback/loopbacklinkprovider.cpp \
+    sailfishconnect/backend/loopback/loopbackdevicelink.cpp \
     sailfishconnect/io/jobmanager.cpp \
+    sailfishconnect/io/configstore.cpp \
+    sailfishconnect/io/diskcache.cpp \
+    sailfishconnect/io/httpfetcher.cpp \
     sailfishconnect/networkpacket.cpp \
-    sailfishconnect/helper/humanize.cpp
+    sailfishconnect/helper/humanize.cpp \
+    sailfishconnect/helper/latencyhistogram.cpp \
+    sailfishconnect/helper/tracing.cpp \
+    sailfishconnect/helper/packetthrottle.cpp
 
 
 # German translation is enabled as an example. If you aren't
@@ -78,11 +88,20 @@ HEADERS += \
     sailfishconnect/downloadjob.h \
     sailfishconnect/backend/lan/lanuploadjob.h \
     sailfishconnect/backend/lan/lannetworklistener.h \
+    sailfishconnect/backend/lan/announcescheduler.h \
+    sailfishconnect/backend/loopback/loopbacklinkprovider.h \
+    sailfishconnect/backend/loopback/loopbackdevicelink.h \
     sailfishconnect/io/jobmanager.h \
+    sailfishconnect/io/configstore.h \
+    sailfishconnect/io/diskcache.h \
+    sailfishconnect/io/httpfetcher.h \
     sailfishconnect/networkpacket.h \
     sailfishconnect/networkpackettypes.h \
     sailfishconnect/helper/humanize.h \
-    sailfishconnect/helper/functools.h
+    sailfishconnect/helper/functools.h \
+    sailfishconnect/helper/latencyhistogram.h \
+    sailfishconnect/helper/tracing.h \
+    sailfishconnect/helper/packetthrottle.h
 
 DISTFILES += \
     lib.pri
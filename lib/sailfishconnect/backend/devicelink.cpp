@@ -19,6 +19,9 @@
  */
 
 #include "devicelink.h"
+
+#include <cmath>
+
 #include "../kdeconnectconfig.h"
 #include "linkprovider.h"
 #include "../device.h"
@@ -34,6 +37,77 @@ DeviceLink::DeviceLink(const QString& deviceId, LinkProvider* parent)
     Q_ASSERT(Device::sanitizeDeviceId(deviceId) == deviceId);
 
     setProperty("deviceId", deviceId);
+
+    connect(this, &DeviceLink::receivedPacket,
+            this, &DeviceLink::resetSendErrors);
+}
+
+constexpr int DeviceLink::SEND_ERROR_HALF_LIFE;
+
+void DeviceLink::setStatistics(int rtt, qreal packetLoss)
+{
+    if (m_rtt != rtt || !qFuzzyCompare(1.0 + m_packetLoss, 1.0 + packetLoss)) {
+        m_rtt = rtt;
+        m_packetLoss = packetLoss;
+        Q_EMIT statisticsChanged();
+    }
+}
+
+void DeviceLink::addThroughputSample(qint64 bytes, qint64 msecs)
+{
+    if (bytes <= 0 || msecs <= 0)
+        return;
+
+    const qreal sample = bytes * 1000.0 / msecs;
+    m_throughput = m_throughput == 0.0
+            ? sample
+            : 0.75 * m_throughput + 0.25 * sample;
+    Q_EMIT statisticsChanged();
+}
+
+void DeviceLink::reportSendResult(bool success)
+{
+    if (success) {
+        resetSendErrors();
+        return;
+    }
+
+    m_sendErrors += 1;
+    m_lastSendError.start();
+    Q_EMIT statisticsChanged();
+}
+
+void DeviceLink::resetSendErrors()
+{
+    if (m_sendErrors != 0) {
+        m_sendErrors = 0;
+        Q_EMIT statisticsChanged();
+    }
+}
+
+qreal DeviceLink::score() const
+{
+    qreal result = m_linkProvider->priority();
+
+    // every 10 ms of latency cost one point
+    if (m_rtt >= 0) {
+        result -= m_rtt / 10.0;
+    }
+    result -= m_packetLoss * 100.0;
+
+    // every MiB/s is worth one point, but a fast link is not preferred
+    // over a responsive one
+    result += qMin(m_throughput / (1024.0 * 1024.0), 20.0);
+
+    // two failures in a row demote even a high priority link. The penalty
+    // fades, so a link that gets no packets to prove itself is retried.
+    if (m_sendErrors > 0) {
+        const qreal age = m_lastSendError.elapsed();
+        result -= m_sendErrors * 60.0
+                * std::pow(0.5, age / SEND_ERROR_HALF_LIFE);
+    }
+
+    return result;
 }
 
 void DeviceLink::setPairStatus(DeviceLink::PairStatus status)
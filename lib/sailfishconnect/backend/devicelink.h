@@ -23,6 +23,7 @@
 
 #include <QObject>
 #include <QString>
+#include <QElapsedTimer>
 
 #include "../networkpacket.h"
 
@@ -61,17 +62,54 @@ public:
     //The daemon will periodically destroy unpaired links if this returns false
     virtual bool linkShouldBeKeptAlive() { return false; }
 
+    // Round trip time in milliseconds or -1 if not measured by the link
+    int rtt() const { return m_rtt; }
+    // Fraction of lost heartbeats (0.0 - 1.0)
+    qreal packetLoss() const { return m_packetLoss; }
+    // Payload throughput in bytes per second or 0 if not measured yet
+    qreal throughput() const { return m_throughput; }
+    // Number of consecutive failed sends
+    int sendErrors() const { return m_sendErrors; }
+
+    // Called by the device after every send attempt over this link
+    void reportSendResult(bool success);
+    // Forget send errors because the link proved to work, e.g. by
+    // receiving a packet
+    void resetSendErrors();
+
+    // Time in ms after which the penalty of send errors is halved
+    static constexpr int SEND_ERROR_HALF_LIFE = 30000;
+
+    /**
+     * Quality of the link: the higher, the better.
+     *
+     * Starts with the priority of the provider and takes measured round trip
+     * time, packet loss, payload throughput and recent send errors into
+     * account.
+     */
+    qreal score() const;
+
 Q_SIGNALS:
     void pairingRequest(PairingHandler* handler);
     void pairingRequestExpired(PairingHandler* handler);
     void pairStatusChanged(DeviceLink::PairStatus status);
     void pairingError(const QString& error);
     void receivedPacket(const NetworkPacket& np);
+    void statisticsChanged();
+
+protected:
+    void setStatistics(int rtt, qreal packetLoss);
+    void addThroughputSample(qint64 bytes, qint64 msecs);
 
 private:
     const QString m_deviceId;
     LinkProvider* m_linkProvider;
     PairStatus m_pairStatus;
+    int m_rtt = -1;
+    qreal m_packetLoss = 0.0;
+    qreal m_throughput = 0.0;
+    int m_sendErrors = 0;
+    QElapsedTimer m_lastSendError;
 
 };
 
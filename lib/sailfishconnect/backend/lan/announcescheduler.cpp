@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "announcescheduler.h"
+
+#include <algorithm>
+
+#include <sailfishconnect/corelogging.h>
+
+namespace SailfishConnect {
+
+AnnounceScheduler::AnnounceScheduler(QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &AnnounceScheduler::onTimeout);
+}
+
+void AnnounceScheduler::setBurst(const QVector<int>& offsetsMs)
+{
+    Q_ASSERT(!offsetsMs.isEmpty());
+    m_burst = offsetsMs;
+}
+
+void AnnounceScheduler::setCoalesceInterval(int ms)
+{
+    m_coalesceInterval = ms;
+}
+
+void AnnounceScheduler::setIdleInterval(int minMs, int maxMs)
+{
+    Q_ASSERT(minMs > 0 && minMs <= maxMs);
+    m_minIdleInterval = minMs;
+    m_maxIdleInterval = maxMs;
+}
+
+void AnnounceScheduler::setSatisfied(bool value)
+{
+    if (m_satisfied == value)
+        return;
+
+    m_satisfied = value;
+    if (m_satisfied) {
+        qCDebug(coreLogger) << "All trusted devices reachable, stop announcing";
+        stop();
+    } else if (!isBursting()) {
+        m_idleInterval = m_minIdleInterval;
+        scheduleIdle();
+    }
+}
+
+void AnnounceScheduler::trigger(const QString& reason)
+{
+    m_triggers += 1;
+
+    if (m_burstIndex == 0 && m_timer.isActive()) {
+        qCDebug(coreLogger) << "Coalescing announce trigger:" << reason;
+        m_coalescedTriggers += 1;
+        return;
+    }
+
+    qCDebug(coreLogger) << "Starting announce burst:" << reason;
+    m_burstIndex = 0;
+    m_burstClock.start();
+    scheduleBurst();
+}
+
+void AnnounceScheduler::stop()
+{
+    m_timer.stop();
+    m_burstIndex = -1;
+}
+
+void AnnounceScheduler::onTimeout()
+{
+    m_announcements += 1;
+    Q_EMIT announce();
+
+    if (isBursting()) {
+        m_burstIndex += 1;
+        if (m_burstIndex < m_burst.size()) {
+            scheduleBurst();
+            return;
+        }
+
+        m_burstIndex = -1;
+        m_idleInterval = m_minIdleInterval;
+    } else {
+        m_idleInterval = std::min(m_idleInterval * 2, m_maxIdleInterval);
+    }
+
+    scheduleIdle();
+}
+
+void AnnounceScheduler::scheduleBurst()
+{
+    const qint64 due = m_coalesceInterval + m_burst[m_burstIndex];
+    m_timer.start(int(std::max<qint64>(due - m_burstClock.elapsed(), 0)));
+}
+
+void AnnounceScheduler::scheduleIdle()
+{
+    if (m_satisfied) {
+        m_timer.stop();
+        return;
+    }
+
+    m_timer.start(m_idleInterval);
+}
+
+} // namespace SailfishConnect
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANNOUNCESCHEDULER_H
+#define ANNOUNCESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+
+namespace SailfishConnect {
+
+/**
+ * Decides when to announce ourselves in the network.
+ *
+ * Every trigger (network change, discovery mode, ...) starts a short burst of
+ * announcements because a single UDP datagram gets lost easily. Triggers
+ * arriving before the first announcement of a burst are coalesced. After the
+ * burst the announcements continue with exponential backoff as long as the
+ * scheduler is not satisfied, i.e. not all trusted devices are reachable.
+ * Becoming satisfied also ends a running burst.
+ */
+class AnnounceScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AnnounceScheduler(QObject *parent = nullptr);
+
+    /**
+     * Offsets of the announcements of a burst relative to the first one.
+     */
+    void setBurst(const QVector<int>& offsetsMs);
+    void setCoalesceInterval(int ms);
+    void setIdleInterval(int minMs, int maxMs);
+
+    void setSatisfied(bool value);
+    bool isSatisfied() const { return m_satisfied; }
+
+    void trigger(const QString& reason);
+    void stop();
+
+    bool isBursting() const { return m_burstIndex >= 0; }
+
+    quint64 triggers() const { return m_triggers; }
+    quint64 coalescedTriggers() const { return m_coalescedTriggers; }
+    quint64 announcements() const { return m_announcements; }
+
+signals:
+    void announce();
+
+private:
+    void onTimeout();
+    void scheduleBurst();
+    void scheduleIdle();
+
+    QTimer m_timer;
+    QElapsedTimer m_burstClock;
+    QVector<int> m_burst = { 0, 1000, 3000, 7000 };
+    int m_coalesceInterval = 200;
+    int m_minIdleInterval = 30 * 1000;
+    int m_maxIdleInterval = 15 * 60 * 1000;
+
+    int m_burstIndex = -1;
+    int m_idleInterval = 0;
+    bool m_satisfied = false;
+
+    quint64 m_triggers = 0;
+    quint64 m_coalescedTriggers = 0;
+    quint64 m_announcements = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // ANNOUNCESCHEDULER_H
@@ -21,6 +21,7 @@
 
 #include "landevicelink.h"
 
+#include <QElapsedTimer>
 #include <QTimer>
 
 #include "../../kdeconnectconfig.h"
@@ -31,6 +32,7 @@
 #include "lanuploadjob.h"
 #include <sailfishconnect/device.h>
 #include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/helper/tracing.h>
 #include <KJobTrackerInterface>
 
 using namespace SailfishConnect;
@@ -39,6 +41,7 @@ LanDeviceLink::LanDeviceLink(const QString& deviceId, LanLinkProvider *parent, Q
     : DeviceLink(deviceId, parent)
     , m_socketLineReader(nullptr)
     , m_debounceTimer(new QTimer(this))
+    , m_heartbeatTimer(new QTimer(this))
 {
     reset(socket, connectionSource);
 
@@ -46,6 +49,10 @@ LanDeviceLink::LanDeviceLink(const QString& deviceId, LanLinkProvider *parent, Q
     m_debounceTimer->setSingleShot(true);
     connect(m_debounceTimer, &QTimer::timeout,
             this, &LanDeviceLink::socketDisconnected);
+
+    m_heartbeatTimer->setInterval(HEARTBEAT_INTERVAL);
+    connect(m_heartbeatTimer, &QTimer::timeout,
+            this, &LanDeviceLink::sendHeartbeat);
 }
 
 LanDeviceLink::~LanDeviceLink() = default;
@@ -68,6 +75,10 @@ void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource
     //destroyed as well
     socket->setParent(m_socketLineReader.data());
 
+    // outstanding heartbeats were sent over the old socket
+    m_heartbeatPending = false;
+    m_missedHeartbeats = 0;
+
     QString certString = config()->getDeviceProperty(deviceId(), QStringLiteral("certificate"));
     DeviceLink::setPairStatus(certString.isEmpty()? PairStatus::NotPaired : PairStatus::Paired);
 }
@@ -96,23 +107,49 @@ QString LanDeviceLink::name()
 
 bool LanDeviceLink::sendPacket(NetworkPacket& np, KJobTrackerInterface* jobMgr)
 {
+    SC_TRACE_SCOPE("LanDeviceLink::sendPacket");
+    // Do not pretend success on a link that stopped answering heartbeats,
+    // so the packet can be sent over another link
+    if (m_missedHeartbeats > 1) {
+        return false;
+    }
+
+    LanUploadJob* uploadJob = nullptr;
     if (np.hasPayload()) {
-        auto* uploadJob = sendPayload(np, jobMgr);
-        if (uploadJob->isOkay())
-            np.setPayloadTransferInfo(uploadJob->transferInfo());
+        uploadJob = sendPayload(np, jobMgr);
+        if (!uploadJob->isOkay()) {
+            // leave the payload to another link
+            return false;
+        }
+        np.setPayloadTransferInfo(uploadJob->transferInfo());
     }
 
     int written = m_socketLineReader->write(np.serialize());
+    if (written == -1 && uploadJob) {
+        uploadJob->kill();
+    }
 
     //Actually we can't detect if a packet is received or not. We keep TCP
     //"ESTABLISHED" connections that look legit (return true when we use them),
-    //but that are actually broken (until keepalive detects that they are down).
+    //but that are actually broken (until keepalive or heartbeats detect that
+    //they are down).
     return (written != -1);
 }
 
 LanUploadJob* LanDeviceLink::sendPayload(const NetworkPacket& np, KJobTrackerInterface* jobMgr)
 {
     LanUploadJob* job = new LanUploadJob(np, deviceId(), provider(), this);
+
+    QElapsedTimer timer;
+    timer.start();
+    connect(job, &KJob::result, this, [this, timer](KJob* finishedJob) {
+        if (finishedJob->error() == 0) {
+            addThroughputSample(
+                        finishedJob->processedAmount(KJob::Bytes),
+                        timer.elapsed());
+        }
+    });
+
     job->start();
     if (jobMgr) {
         jobMgr->registerJob(job);
@@ -123,6 +160,7 @@ LanUploadJob* LanDeviceLink::sendPayload(const NetworkPacket& np, KJobTrackerInt
 
 void LanDeviceLink::dataReceived()
 {
+    SC_TRACE_SCOPE("LanDeviceLink::dataReceived");
     if (m_socketLineReader->bytesAvailable() == 0) return;
 
     const QByteArray serializedPacket = m_socketLineReader->readLine();
@@ -132,12 +170,25 @@ void LanDeviceLink::dataReceived()
     qCDebug(coreLogger).noquote()
             << "LanDeviceLink dataReceived" << serializedPacket;
 
-    if (packet.type() == PACKET_TYPE_PAIR) {
+    // every packet proves that the link is alive
+    m_missedHeartbeats = 0;
+
+    if (packet.type() == PACKET_TYPE_HEARTBEAT) {
+        heartbeatReceived(packet);
+    } else if (packet.type() == PACKET_TYPE_PAIR) {
         //TODO: Handle pair/unpair requests and forward them (to the pairing handler?)
         provider()->incomingPairPacket(this, packet);
-        return;
+    } else {
+        processPacket(packet);
     }
 
+    if (m_socketLineReader->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    }
+}
+
+void LanDeviceLink::processPacket(NetworkPacket& packet)
+{
     if (packet.hasPayloadTransferInfo()) {
         if (packet.payloadSize() < -1) {
             qCWarning(coreLogger)
@@ -165,12 +216,82 @@ void LanDeviceLink::dataReceived()
     }
 
     Q_EMIT receivedPacket(packet);
+}
 
-    if (m_socketLineReader->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+void LanDeviceLink::setHeartbeatEnabled(bool enabled)
+{
+    if (enabled == heartbeatEnabled())
+        return;
+
+    if (enabled) {
+        m_heartbeatTimer->start();
+    } else {
+        m_heartbeatTimer->stop();
+        m_heartbeatPending = false;
+        m_missedHeartbeats = 0;
     }
 }
 
+bool LanDeviceLink::heartbeatEnabled() const
+{
+    return m_heartbeatTimer->isActive();
+}
+
+void LanDeviceLink::setHeartbeatInterval(int ms)
+{
+    m_heartbeatTimer->setInterval(ms);
+}
+
+void LanDeviceLink::sendHeartbeat()
+{
+    if (m_heartbeatPending) {
+        m_missedHeartbeats += 1;
+        m_heartbeatLoss = 0.9 * m_heartbeatLoss + 0.1;
+        setStatistics(rtt(), m_heartbeatLoss);
+
+        if (m_missedHeartbeats >= MAX_MISSED_HEARTBEATS) {
+            qCWarning(coreLogger)
+                    << "Link to" << deviceId() << "missed"
+                    << m_missedHeartbeats << "heartbeats, closing it";
+            m_heartbeatTimer->stop();
+            // results in socketDisconnected
+            m_socketLineReader->m_socket->abort();
+            return;
+        }
+    }
+
+    m_heartbeatSeq += 1;
+    m_heartbeatPending = true;
+    m_heartbeatClock.start();
+
+    NetworkPacket np(PACKET_TYPE_HEARTBEAT);
+    np.set(QStringLiteral("seq"), m_heartbeatSeq);
+    m_socketLineReader->write(np.serialize());
+}
+
+void LanDeviceLink::heartbeatReceived(const NetworkPacket& np)
+{
+    const qint64 seq = np.get<qint64>(QStringLiteral("seq"));
+
+    if (!np.get<bool>(QStringLiteral("pong"))) {
+        NetworkPacket pong(PACKET_TYPE_HEARTBEAT);
+        pong.set(QStringLiteral("seq"), seq);
+        pong.set(QStringLiteral("pong"), true);
+        m_socketLineReader->write(pong.serialize());
+        return;
+    }
+
+    if (!m_heartbeatPending || seq != m_heartbeatSeq)
+        return;  // late answer, already counted as lost
+
+    m_heartbeatPending = false;
+    resetSendErrors();
+    const qint64 rtt = m_heartbeatClock.elapsed();
+    m_smoothedRtt = m_smoothedRtt < 0 ? rtt : (7 * m_smoothedRtt + rtt) / 8;
+    m_heartbeatLoss = 0.9 * m_heartbeatLoss;
+    setStatistics(qRound(m_smoothedRtt), m_heartbeatLoss);
+}
+
 void LanDeviceLink::socketDisconnected()
 {
     // Maybe LanDeviceLink::reset was called
@@ -230,10 +351,11 @@ void LanDeviceLink::setPairStatus(PairStatus status)
 
     DeviceLink::setPairStatus(status);
     if (status == Paired) {
-        Q_ASSERT(config()->trustedDevices().contains(deviceId()));
+        Q_ASSERT(config()->isTrustedDevice(deviceId()));
         Q_ASSERT(!m_socketLineReader->peerCertificate().isNull());
         config()->setDeviceProperty(
                     deviceId(), QStringLiteral("certificate"), m_socketLineReader->peerCertificate().toPem());
+        provider()->invalidateSslConfiguration(deviceId());
     }
 }
 
@@ -23,6 +23,7 @@
 
 #include <QScopedPointer>
 #include <QHostAddress>
+#include <QElapsedTimer>
 
 #include "../devicelink.h"
 
@@ -66,15 +67,41 @@ public:
 
     QHostAddress hostAddress() const;
 
+    /**
+     * Send heartbeats to detect dead links and measure the round trip time.
+     *
+     * Only enabled for peers announcing heartbeat support in their
+     * identity, other peers rely on TCP keepalive.
+     */
+    void setHeartbeatEnabled(bool enabled);
+    bool heartbeatEnabled() const;
+    void setHeartbeatInterval(int ms);
+    int missedHeartbeats() const { return m_missedHeartbeats; }
+
+    const static int HEARTBEAT_INTERVAL = 2000;
+    const static int MAX_MISSED_HEARTBEATS = 3;
+
 private Q_SLOTS:
     void dataReceived();
     void socketDisconnected();
+    void sendHeartbeat();
 
 private:
+    void heartbeatReceived(const NetworkPacket& np);
+    void processPacket(NetworkPacket& packet);
+
     QScopedPointer<SocketLineReader> m_socketLineReader;
     QHostAddress m_hostAddress;
     QTimer* m_debounceTimer;
 
+    QTimer* m_heartbeatTimer;
+    QElapsedTimer m_heartbeatClock;
+    qint64 m_heartbeatSeq = 0;
+    int m_missedHeartbeats = 0;
+    bool m_heartbeatPending = false;
+    qreal m_smoothedRtt = -1;
+    qreal m_heartbeatLoss = 0.0;
+
     LanLinkProvider* provider();
     KdeConnectConfig* config();
 };
@@ -27,6 +27,8 @@
 #include <QNetworkProxy>
 #include <QSslCipher>
 #include <QSslConfiguration>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include "../../corelogging.h"
 #include "../../kdeconnectconfig.h"
@@ -34,23 +36,36 @@
 #include "landevicelink.h"
 #include "lanpairinghandler.h"
 #include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/helper/tracing.h>
 
 #define MIN_VERSION_WITH_SSL_SUPPORT 6
 
 using namespace SailfishConnect;
 
+constexpr int LanLinkProvider::HandshakeStageCount;
+
+static int stageTimeout(LanLinkProvider::HandshakeStage stage)
+{
+    switch (stage) {
+    case LanLinkProvider::HandshakeStage::Connecting:
+        return LanLinkProvider::CONNECT_TIMEOUT;
+    case LanLinkProvider::HandshakeStage::SendingIdentity:
+    case LanLinkProvider::HandshakeStage::ReceivingIdentity:
+        return LanLinkProvider::IDENTITY_TIMEOUT;
+    case LanLinkProvider::HandshakeStage::Encrypting:
+        return LanLinkProvider::ENCRYPTION_TIMEOUT;
+    }
+    return LanLinkProvider::CONNECT_TIMEOUT;
+}
+
 LanLinkProvider::LanLinkProvider(KdeConnectConfig* config, bool testMode)
     : m_testMode(testMode)
     , m_config(config)
     , m_udpSocket(this)
-    , m_combineBroadcastsTimer(this)
 {
     m_tcpPort = 0;
 
-    // increase this if waiting a single event-loop iteration is not enough
-    m_combineBroadcastsTimer.setInterval(200);
-    m_combineBroadcastsTimer.setSingleShot(true);
-    connect(&m_combineBroadcastsTimer, &QTimer::timeout,
+    connect(&m_announceScheduler, &AnnounceScheduler::announce,
             this, &LanLinkProvider::broadcastToNetwork);
 
     connect(&m_udpSocket, &QIODevice::readyRead,
@@ -65,6 +80,13 @@ LanLinkProvider::LanLinkProvider(KdeConnectConfig* config, bool testMode)
 
     connect(&m_networkListener, &LanNetworkListener::networkChanged,
             this, [this](){ onNetworkChange("network change"); });
+
+    connect(m_config, &KdeConnectConfig::deviceTrustChanged,
+            this, &LanLinkProvider::updateAnnounceScheduler);
+    connect(m_config, &KdeConnectConfig::deviceTrustChanged,
+            this, &LanLinkProvider::invalidateSslConfiguration);
+    connect(m_config, &KdeConnectConfig::certificateChanged,
+            this, &LanLinkProvider::invalidateSslConfigurations);
 }
 
 LanLinkProvider::~LanLinkProvider()
@@ -73,6 +95,7 @@ LanLinkProvider::~LanLinkProvider()
 
 void LanLinkProvider::onStart()
 {
+    SC_TRACE_SCOPE("LanLinkProvider::onStart");
     const QHostAddress bindAddress = m_testMode? QHostAddress::LocalHost : QHostAddress::Any;
 
     // TODO: only bind to WLAN, Ethernet and Bluetooth networks
@@ -97,18 +120,100 @@ void LanLinkProvider::onStart()
 void LanLinkProvider::onStop()
 {
     qCDebug(coreLogger) << "onStop";
+    m_announceScheduler.stop();
     m_udpSocket.close();
     m_server->close();
 }
 
 void LanLinkProvider::onNetworkChange(const QString& reason)
 {
+    connectToKnownDevices();
+
     qCInfo(coreLogger) << "Trying to send broadcast:" << reason;
-    if (m_combineBroadcastsTimer.isActive()) {
-        qCDebug(coreLogger()) << "Preventing duplicate broadcasts";
+    updateAnnounceScheduler();
+    m_announceScheduler.trigger(reason);
+}
+
+// Without trusted devices waiting for us there is no need to announce
+// ourselves regularly. Explicit triggers still cause a burst.
+void LanLinkProvider::updateAnnounceScheduler()
+{
+    const QStringList trustedDevices = m_config->trustedDevices();
+    const bool allReachable = std::all_of(
+                trustedDevices.begin(), trustedDevices.end(),
+                [this](const QString& deviceId) {
+        return m_links.contains(deviceId);
+    });
+    m_announceScheduler.setSatisfied(allReachable);
+}
+
+// Dial the last known endpoints of all trusted devices without a link in
+// parallel. Broadcasting stays as fallback for devices that moved.
+void LanLinkProvider::connectToKnownDevices()
+{
+    if (!m_server->isListening()) {
+        // Not started
         return;
     }
-    m_combineBroadcastsTimer.start();
+
+    const QStringList trustedDevices = m_config->trustedDevices();
+    for (const QString& deviceId : trustedDevices) {
+        if (m_links.contains(deviceId) || isConnecting(deviceId))
+            continue;
+
+        const KdeConnectConfig::Endpoint endpoint =
+                m_config->lastEndpoint(deviceId);
+        if (!endpoint.isValid())
+            continue;
+        if (endpoint.address.isLoopback() && !m_testMode)
+            continue;
+
+        qCDebug(coreLogger)
+                << "Connecting to last known endpoint of" << deviceId
+                << endpoint.address << endpoint.tcpPort;
+
+        QSslSocket* socket = new QSslSocket(this);
+        socket->setProxy(QNetworkProxy::NoProxy);
+        PendingConnect& pending = m_receivedIdentityPackets[socket];
+        pending.np = lastIdentityPacket(deviceId);
+        pending.sender = endpoint.address;
+        pending.dialed = true;
+        startHandshake(socket, HandshakeStage::Connecting);
+        connect(socket, &QAbstractSocket::connected, this, &LanLinkProvider::connected);
+        connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(connectError()));
+        socket->connectToHost(endpoint.address, endpoint.tcpPort);
+    }
+}
+
+bool LanLinkProvider::isConnecting(const QString& deviceId) const
+{
+    for (const PendingConnect& pending : m_receivedIdentityPackets) {
+        if (pending.stage == HandshakeStage::Connecting
+                && pending.np.get<QString>(QStringLiteral("deviceId")) == deviceId)
+            return true;
+    }
+    return false;
+}
+
+// Identity of a trusted device as seen on the last connection. We do not get
+// a fresh one when dialing the device directly.
+NetworkPacket LanLinkProvider::lastIdentityPacket(const QString& deviceId) const
+{
+    const QString lastIdentity = m_config->getDeviceProperty(
+                deviceId, QStringLiteral("lastIdentity"));
+    const QVariantMap body =
+            QJsonDocument::fromJson(lastIdentity.toUtf8()).object().toVariantMap();
+    if (body.value(QStringLiteral("deviceId")).toString() == deviceId) {
+        return NetworkPacket(PACKET_TYPE_IDENTITY, body);
+    }
+
+    const KdeConnectConfig::DeviceInfo info = m_config->getTrustedDevice(deviceId);
+    NetworkPacket np(PACKET_TYPE_IDENTITY);
+    np.set(QStringLiteral("deviceId"), deviceId);
+    np.set(QStringLiteral("deviceName"), info.deviceName);
+    np.set(QStringLiteral("deviceType"), info.deviceType);
+    np.set(QStringLiteral("protocolVersion"), NetworkPacket::s_protocolVersion);
+    return np;
 }
 
 //I'm in a new network, let's be polite and introduce myself
@@ -129,6 +234,7 @@ void LanLinkProvider::broadcastToNetwork()
 
     if (m_testMode) {
         m_udpSocket.writeDatagram(np.serialize(), QHostAddress::LocalHost, UDP_PORT);
+        m_datagramsSent += 1;
         return;
     }
 
@@ -136,6 +242,7 @@ void LanLinkProvider::broadcastToNetwork()
         // TODO: support IPv6 with multicast FF02::1
         m_udpSocket.writeDatagram(
                     np.serialize(), QHostAddress::Broadcast, UDP_PORT);
+        m_datagramsSent += 1;
     }
 }
 
@@ -165,6 +272,7 @@ bool LanLinkProvider::hasUsefulNetworkInterfaces() {
 //I will create a TcpSocket and try to connect. This can result in either connected() or connectError().
 void LanLinkProvider::newUdpConnection() //udpBroadcastReceived
 {
+    SC_TRACE_SCOPE("LanLinkProvider::newUdpConnection");
     QByteArray datagram;
 
     while (m_udpSocket.hasPendingDatagrams()) {
@@ -201,6 +309,8 @@ void LanLinkProvider::newUdpConnection() //udpBroadcastReceived
         }
 
         int tcpPort = receivedPacket.get<int>(QStringLiteral("tcpPort"));
+        if (m_config->isTrustedDevice(deviceId))
+            m_announcedTcpPorts.insert(deviceId, quint16(tcpPort));
 
         qCDebug(coreLogger)
                 << "Received UDP identity packet from" << sender
@@ -208,9 +318,10 @@ void LanLinkProvider::newUdpConnection() //udpBroadcastReceived
 
         QSslSocket* socket = new QSslSocket(this);
         socket->setProxy(QNetworkProxy::NoProxy);
-        m_receivedIdentityPackets.insert(
-                    socket,
-                    PendingConnect { std::move(receivedPacket), sender });
+        PendingConnect& pending = m_receivedIdentityPackets[socket];
+        pending.np = std::move(receivedPacket);
+        pending.sender = sender;
+        startHandshake(socket, HandshakeStage::Connecting);
         connect(socket, &QAbstractSocket::connected, this, &LanLinkProvider::connected);
         connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(connectError()));
         socket->connectToHost(sender, tcpPort);
@@ -221,19 +332,13 @@ void LanLinkProvider::connectError()
 {
     QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
     if (!socket) return;
-    disconnect(socket, &QAbstractSocket::connected, this, &LanLinkProvider::connected);
-    disconnect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(connectError()));
 
     qCDebug(coreLogger) << "Fallback (1), try reverse connection (send udp packet)" << socket->errorString();
-    NetworkPacket np(QLatin1String(""));
-    NetworkPacket::createIdentityPacket(m_config, &np);
-    np.set(QStringLiteral("tcpPort"), m_tcpPort);
-    m_udpSocket.writeDatagram(np.serialize(), m_receivedIdentityPackets[socket].sender, UDP_PORT);
+    sendReverseConnectionRequest(m_receivedIdentityPackets.value(socket).sender);
 
     //The socket we created didn't work, and we didn't manage
     //to create a LanDeviceLink from it, deleting everything.
-    m_receivedIdentityPackets.remove(socket);
-    socket->deleteLater();
+    abortHandshake(socket);
 }
 
 //We received a UDP packet and answered by connecting to them by TCP. This gets called on a succesful connection.
@@ -250,69 +355,98 @@ void LanLinkProvider::connected()
     // If socket disconnects due to any reason after connection, link on ssl faliure
     connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
 
-    const NetworkPacket& receivedPacket = m_receivedIdentityPackets[socket].np;
-    QString deviceId = receivedPacket.get<QString>(QStringLiteral("deviceId"));
     qCDebug(coreLogger) << "Connected" << socket << socket->isWritable();
+    advanceHandshake(socket, HandshakeStage::SendingIdentity);
 
     // If network is on ssl, do not believe when they are connected, believe when handshake is completed
     NetworkPacket np2;
     NetworkPacket::createIdentityPacket(m_config, &np2);
-    socket->write(np2.serialize());
-    bool success = socket->waitForBytesWritten();
-
-    if (success) {
-
-        qCDebug(coreLogger) << socket << "TCP connection done (i'm the existing device)";
-
-        // if ssl supported
-        if (receivedPacket.get<int>(QStringLiteral("protocolVersion")) >= MIN_VERSION_WITH_SSL_SUPPORT) {
-
-            bool isDeviceTrusted = m_config->trustedDevices().contains(deviceId);
-            configureSslSocket(socket, deviceId, isDeviceTrusted);
-
-            qCDebug(coreLogger) << socket << "Starting server ssl (I'm the client TCP socket)";
+    connect(socket, &QIODevice::bytesWritten,
+            this, &LanLinkProvider::identitySent);
+    if (socket->write(np2.serialize()) == -1) {
+        qCDebug(coreLogger) << "Fallback (2), try reverse connection (send udp packet)";
+        sendReverseConnectionRequest(m_receivedIdentityPackets.value(socket).sender);
+        abortHandshake(socket);
+    }
+}
 
-            connect(socket, &QSslSocket::encrypted, this, &LanLinkProvider::encrypted);
+// The identity packet is on its way, continue with TLS
+void LanLinkProvider::identitySent()
+{
+    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket || socket->bytesToWrite() > 0) return;
 
-            if (isDeviceTrusted) {
-                connect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslErrors(QList<QSslError>)));
-            }
+    disconnect(socket, &QIODevice::bytesWritten,
+               this, &LanLinkProvider::identitySent);
 
-            socket->startServerEncryption();
+    auto pending = m_receivedIdentityPackets.constFind(socket);
+    if (pending == m_receivedIdentityPackets.constEnd()) return;
 
-            return; // Return statement prevents from deleting received packet, needed in slot "encrypted"
-        } else {
-            qWarning() << receivedPacket.get<QString>(QStringLiteral("deviceName")) << "uses an old protocol version, this won't work";
-            //addLink(deviceId, socket, receivedPacket, LanDeviceLink::Remotely);
-        }
+    qCDebug(coreLogger) << socket << "TCP connection done (i'm the existing device)";
 
-    } else {
-        //I think this will never happen, but if it happens the deviceLink
-        //(or the socket that is now inside it) might not be valid. Delete them.
-        qCDebug(coreLogger) << "Fallback (2), try reverse connection (send udp packet)";
-        m_udpSocket.writeDatagram(np2.serialize(), m_receivedIdentityPackets[socket].sender, UDP_PORT);
+    // if ssl supported
+    const NetworkPacket& receivedPacket = pending->np;
+    if (receivedPacket.get<int>(QStringLiteral("protocolVersion")) < MIN_VERSION_WITH_SSL_SUPPORT) {
+        qWarning() << receivedPacket.get<QString>(QStringLiteral("deviceName")) << "uses an old protocol version, this won't work";
+        abortHandshake(socket);
+        return;
     }
 
-    m_receivedIdentityPackets.remove(socket);
-    //We don't delete the socket because now it's owned by the LanDeviceLink
+    advanceHandshake(socket, HandshakeStage::Encrypting);
+    prepareEncryption(
+                socket, receivedPacket.get<QString>(QStringLiteral("deviceId")));
+
+    qCDebug(coreLogger) << socket << "Starting server ssl (I'm the client TCP socket)";
+    socket->startServerEncryption();
 }
 
 void LanLinkProvider::encrypted()
 {
+    SC_TRACE_SCOPE("LanLinkProvider::encrypted");
     QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
     if (!socket) return;
 
     qCDebug(coreLogger) << "Socket successfully stablished an SSL connection" << socket;
 
-    disconnect(socket, &QSslSocket::encrypted, this, &LanLinkProvider::encrypted);
-    disconnect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslErrors(QList<QSslError>)));
-
     Q_ASSERT(socket->mode() != QSslSocket::UnencryptedMode);
     LanDeviceLink::ConnectionStarted connectionOrigin = (socket->mode() == QSslSocket::SslClientMode)? LanDeviceLink::Locally : LanDeviceLink::Remotely;
 
     PendingConnect pending = m_receivedIdentityPackets.take(socket);
+    if (pending.stageTimer.isValid()) {
+        auto& histogram = m_handshakeLatency[int(HandshakeStage::Encrypting)];
+        histogram.add(pending.stageTimer.elapsed());
+        qCDebug(coreLogger) << "TLS handshake latency" << histogram.toString();
+    }
+    delete pending.timeout;
+
+    // From now on the socket belongs to the link
+    disconnect(socket, nullptr, this, nullptr);
+
     QString deviceId = pending.np.get<QString>(QStringLiteral("deviceId"));
 
+    if (m_config->isTrustedDevice(deviceId)) {
+        // Only UDP identities carry the TCP port of the device. When the
+        // device connected to us, its identity came over TCP without one,
+        // so use the port it announced last.
+        KdeConnectConfig::Endpoint endpoint;
+        endpoint.address = socket->peerAddress();
+        if (pending.np.has(QStringLiteral("tcpPort"))) {
+            endpoint.tcpPort = quint16(
+                        pending.np.get<int>(QStringLiteral("tcpPort")));
+        } else {
+            endpoint.tcpPort = m_announcedTcpPorts.value(deviceId);
+        }
+        m_config->setLastEndpoint(deviceId, endpoint);
+
+        const QString identity = QString::fromUtf8(
+                    QJsonDocument(QJsonObject::fromVariantMap(pending.np.body()))
+                    .toJson(QJsonDocument::Compact));
+        if (identity != m_config->getDeviceProperty(
+                    deviceId, QStringLiteral("lastIdentity"))) {
+            m_config->setDeviceProperty(
+                        deviceId, QStringLiteral("lastIdentity"), identity);
+        }
+    }
     addLink(deviceId, socket, &pending.np, connectionOrigin);
 }
 
@@ -321,6 +455,20 @@ void LanLinkProvider::sslErrors(const QList<QSslError>& errors)
     QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
     if (!socket) return;
 
+    const PendingConnect pending = m_receivedIdentityPackets.value(socket);
+    if (pending.dialed) {
+        // The remembered address may belong to another peer by now. That
+        // says nothing about the trusted device, so only forget the address.
+        const QString deviceId =
+                pending.np.get<QString>(QStringLiteral("deviceId"));
+        qCWarning(coreLogger)
+                << "Last known endpoint of" << deviceId << "is stale:"
+                << errors;
+        m_config->setLastEndpoint(deviceId, KdeConnectConfig::Endpoint());
+        abortHandshake(socket);
+        return;
+    }
+
     disconnect(socket, &QSslSocket::encrypted, this, &LanLinkProvider::encrypted);
     disconnect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslErrors(QList<QSslError>)));
 
@@ -331,17 +479,111 @@ void LanLinkProvider::sslErrors(const QList<QSslError>& errors)
     }
 
     m_receivedIdentityPackets.remove(socket);
+    delete pending.timeout;
     // Socket disconnects itself on ssl error and will be deleted by deleteLater slot, no need to delete manually
 }
 
+void LanLinkProvider::startHandshake(QSslSocket* socket, HandshakeStage stage)
+{
+    PendingConnect& pending = m_receivedIdentityPackets[socket];
+    pending.stage = stage;
+    pending.stageTimer.start();
+
+    pending.timeout = new QTimer(socket);
+    pending.timeout->setSingleShot(true);
+    connect(pending.timeout, &QTimer::timeout,
+            this, &LanLinkProvider::handshakeTimeout);
+    pending.timeout->start(stageTimeout(stage));
+
+    // forget sockets that die while we are still waiting for them
+    connect(socket, &QObject::destroyed, this, [this, socket]() {
+        m_receivedIdentityPackets.remove(socket);
+    });
+}
+
+void LanLinkProvider::advanceHandshake(QSslSocket* socket, HandshakeStage stage)
+{
+    auto pending = m_receivedIdentityPackets.find(socket);
+    if (pending == m_receivedIdentityPackets.end()) return;
+
+    m_handshakeLatency[int(pending->stage)].add(pending->stageTimer.restart());
+    pending->stage = stage;
+    pending->timeout->start(stageTimeout(stage));
+}
+
+void LanLinkProvider::handshakeTimeout()
+{
+    QTimer* timer = qobject_cast<QTimer*>(sender());
+    QSslSocket* socket = timer
+            ? qobject_cast<QSslSocket*>(timer->parent()) : nullptr;
+    if (!socket) return;
+
+    auto pending = m_receivedIdentityPackets.constFind(socket);
+    if (pending == m_receivedIdentityPackets.constEnd()) return;
+
+    m_handshakeTimeouts += 1;
+    qCWarning(coreLogger)
+            << "Handshake with" << socket->peerAddress()
+            << "timed out in stage" << int(pending->stage);
+
+    if (pending->stage == HandshakeStage::Connecting) {
+        sendReverseConnectionRequest(pending->sender);
+    }
+    abortHandshake(socket);
+}
+
+void LanLinkProvider::abortHandshake(QSslSocket* socket)
+{
+    m_receivedIdentityPackets.remove(socket);
+    disconnect(socket, nullptr, this, nullptr);
+    socket->abort();
+    socket->deleteLater();
+}
+
+void LanLinkProvider::sendReverseConnectionRequest(const QHostAddress& address)
+{
+    if (address.isNull()) return;
+
+    NetworkPacket np(QLatin1String(""));
+    NetworkPacket::createIdentityPacket(m_config, &np);
+    np.set(QStringLiteral("tcpPort"), m_tcpPort);
+    m_udpSocket.writeDatagram(np.serialize(), address, UDP_PORT);
+    m_datagramsSent += 1;
+}
+
+void LanLinkProvider::prepareEncryption(QSslSocket* socket, const QString& deviceId)
+{
+    bool isDeviceTrusted = m_config->isTrustedDevice(deviceId);
+    configureSslSocket(socket, deviceId, isDeviceTrusted);
+
+    connect(socket, &QSslSocket::encrypted, this, &LanLinkProvider::encrypted);
+
+    if (isDeviceTrusted) {
+        connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
+                this, SLOT(sslErrors(QList<QSslError>)));
+
+        connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+                this, SLOT(error(QAbstractSocket::SocketError)));
+    }
+}
+
+const LatencyHistogram& LanLinkProvider::handshakeLatency(
+        HandshakeStage stage) const
+{
+    return m_handshakeLatency[int(stage)];
+}
+
 //I'm the new device and this is the answer to my UDP identity packet (no data received yet). They are connecting to us through TCP, and they should send an identity.
 void LanLinkProvider::newConnection()
 {
+    SC_TRACE_SCOPE("LanLinkProvider::newConnection");
     qCDebug(coreLogger) << "LanLinkProvider newConnection";
 
     while (m_server->hasPendingConnections()) {
         QSslSocket* socket = m_server->nextPendingConnection();
         configureSocket(socket);
+        m_receivedIdentityPackets[socket].sender = socket->peerAddress();
+        startHandshake(socket, HandshakeStage::ReceivingIdentity);
         //This socket is still managed by us (and child of the QTcpServer), if
         //it disconnects before we manage to pass it to a LanDeviceLink, it's
         //our responsibility to delete it. We do so with this connection.
@@ -356,10 +598,11 @@ void LanLinkProvider::newConnection()
 //I'm the new device and this is the answer to my UDP identity packet (data received)
 void LanLinkProvider::dataReceived()
 {
+    SC_TRACE_SCOPE("LanLinkProvider::dataReceived");
     // TODO: use Socket line reader
     QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
 
-    if (!socket->canReadLine()) {
+    if (!socket || !socket->canReadLine()) {
         return;
     }
 
@@ -390,27 +633,22 @@ void LanLinkProvider::dataReceived()
 
     qCDebug(coreLogger) << "Handshaking done (i'm the new device)" << deviceId;
 
+    auto pending = m_receivedIdentityPackets.find(socket);
+    if (pending == m_receivedIdentityPackets.end()) {
+        qCWarning(coreLogger) << "Identity received after handshake timeout";
+        return;
+    }
+
     // Needed in "encrypted" if ssl is used, similar to "connected"
-    m_receivedIdentityPackets[socket].np = std::move(np);
+    pending->np = std::move(np);
+    advanceHandshake(socket, HandshakeStage::Encrypting);
 
     //This socket will now be owned by the LanDeviceLink or we don't want more data to be received, forget about it
     disconnect(socket, &QIODevice::readyRead, this, &LanLinkProvider::dataReceived);
 
-    bool isDeviceTrusted = m_config->trustedDevices().contains(deviceId);
-    configureSslSocket(socket, deviceId, isDeviceTrusted);
+    prepareEncryption(socket, deviceId);
 
     qCDebug(coreLogger) << "Starting client ssl (but I'm the server TCP socket)" << socket;
-
-    connect(socket, &QSslSocket::encrypted, this, &LanLinkProvider::encrypted);
-
-    if (isDeviceTrusted) {
-        connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
-                this, SLOT(sslErrors(QList<QSslError>)));
-
-        connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
-                this, SLOT(error(QAbstractSocket::SocketError)));
-    }
-
     socket->startClientEncryption();
 }
 
@@ -430,48 +668,80 @@ void LanLinkProvider::deviceLinkDestroyed(QObject* destroyedDeviceLink)
         if (pairingHandler) {
             pairingHandler->deleteLater();
         }
+        updateAnnounceScheduler();
     }
 }
 
-void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+LanLinkProvider::SslConfiguration LanLinkProvider::sslConfiguration(
+        const QString& deviceId, bool isDeviceTrusted)
 {
-    // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
-    QList<QSslCipher> socketCiphers;
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
+    if (m_baseSslConfiguration.isNull()) {
+        // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
+        QList<QSslCipher> socketCiphers;
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
+
+        // Configure for ssl
+        m_baseSslConfiguration.setCiphers(socketCiphers);
+        m_baseSslConfiguration.setProtocol(QSsl::TlsV1_0);
+        m_baseSslConfiguration.setLocalCertificate(m_config->certificate());
+        m_baseSslConfiguration.setPrivateKey(m_config->privateKey());
+    }
 
-    // Configure for ssl
-    QSslConfiguration sslConfig;
-    sslConfig.setCiphers(socketCiphers);
-    sslConfig.setProtocol(QSsl::TlsV1_0);
+    SslConfiguration result { m_baseSslConfiguration, deviceId };
+    if (!isDeviceTrusted) {
+        result.configuration.setPeerVerifyMode(QSslSocket::QueryPeer);
+        return result;
+    }
 
-    socket->setSslConfiguration(sslConfig);
-    socket->setLocalCertificate(m_config->certificate());
-    socket->setPrivateKey(m_config->privateKeyPath());
-    socket->setPeerVerifyName(deviceId);
+    auto iter = m_sslConfigurations.constFind(deviceId);
+    if (iter != m_sslConfigurations.constEnd()) {
+        return iter.value();
+    }
 
-    if (isDeviceTrusted) {
-        QString certString = m_config->getDeviceProperty(
-                    deviceId, QStringLiteral("certificate"), QString());
-        QSslCertificate cert(certString.toLatin1());
-
-        // use unsanitized device id as peer verify name
-        QStringList commonName = cert.issuerInfo(QSslCertificate::CommonName);
-        if (cert.isNull() || commonName.length() != 1) {
-            qCWarning(coreLogger)
-                    << "Certificate of" << deviceId
-                    << "is missing or corrupt. Maybe pairing was incomplete.";
-            socket->setPeerVerifyMode(QSslSocket::VerifyPeer);
-        } else {
-            socket->setPeerVerifyName(commonName.constFirst());
-            socket->addCaCertificate(cert);
-            socket->setPeerVerifyMode(QSslSocket::VerifyPeer);
-        }
-    } else {
-        socket->setPeerVerifyMode(QSslSocket::QueryPeer);
+    result.configuration.setPeerVerifyMode(QSslSocket::VerifyPeer);
+
+    QString certString = m_config->getDeviceProperty(
+                deviceId, QStringLiteral("certificate"), QString());
+    QSslCertificate cert(certString.toLatin1());
+
+    // use unsanitized device id as peer verify name
+    QStringList commonName = cert.issuerInfo(QSslCertificate::CommonName);
+    if (cert.isNull() || commonName.length() != 1) {
+        qCWarning(coreLogger)
+                << "Certificate of" << deviceId
+                << "is missing or corrupt. Maybe pairing was incomplete.";
+        // not cached, the certificate may be stored later on
+        return result;
     }
 
+    result.peerVerifyName = commonName.constFirst();
+    result.configuration.setCaCertificates({ cert });
+    m_sslConfigurations.insert(deviceId, result);
+    return result;
+}
+
+void LanLinkProvider::invalidateSslConfiguration(const QString& deviceId)
+{
+    m_sslConfigurations.remove(deviceId);
+}
+
+void LanLinkProvider::invalidateSslConfigurations()
+{
+    m_baseSslConfiguration = QSslConfiguration();
+    m_sslConfigurations.clear();
+}
+
+void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+{
+    const SslConfiguration sslConfig =
+            sslConfiguration(deviceId, isDeviceTrusted);
+
+    // implicitly shared, no copy
+    socket->setSslConfiguration(sslConfig.configuration);
+    socket->setPeerVerifyName(sslConfig.peerVerifyName);
+
 #ifndef QT_NO_DEBUG_OUTPUT
     // Usually SSL errors are only bad for trusted devices.
     QObject::connect(socket, Overload<const QList<QSslError>&>::of(&QSslSocket::sslErrors), [socket](const QList<QSslError>& errors)
@@ -529,10 +799,20 @@ void LanLinkProvider::addLink(const QString& deviceId, QSslSocket* socket, Netwo
             //Crash if debug, recover if release (by setting the new devicelink to the old pairinghandler)
             m_pairingHandlers[deviceId]->setDeviceLink(deviceLink);
         }
+        updateAnnounceScheduler();
     }
+
+    deviceLink->setHeartbeatEnabled(supportsHeartbeat(*receivedPacket));
+
     Q_EMIT onConnectionReceived(*receivedPacket, deviceLink);
 }
 
+bool LanLinkProvider::supportsHeartbeat(const NetworkPacket& identity)
+{
+    return identity.get<QStringList>(QStringLiteral("incomingCapabilities"))
+            .contains(PACKET_TYPE_HEARTBEAT);
+}
+
 LanPairingHandler* LanLinkProvider::createPairingHandler(DeviceLink* link)
 {
     LanPairingHandler* ph = m_pairingHandlers.value(link->deviceId());
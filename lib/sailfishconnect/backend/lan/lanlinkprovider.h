@@ -26,12 +26,16 @@
 #include <QString>
 #include <QHostAddress>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QSslConfiguration>
 
 #include "../linkprovider.h"
 #include "server.h"
 #include "landevicelink.h"
 #include "lannetworklistener.h"
+#include "announcescheduler.h"
 #include <sailfishconnect/networkpacket.h>
+#include <sailfishconnect/helper/latencyhistogram.h>
 
 class LanPairingHandler;
 class KdeConnectConfig;
@@ -53,14 +57,52 @@ public:
     void incomingPairPacket(DeviceLink* device, const NetworkPacket& np);
 
     void configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted);
+    /**
+     * Drops the cached TLS configuration, needed when the stored
+     * certificate of the device changed
+     */
+    void invalidateSslConfiguration(const QString& deviceId);
     static void configureSocket(QSslSocket* socket);
+    /**
+     * Whether the device of the identity packet answers heartbeats
+     */
+    static bool supportsHeartbeat(const NetworkPacket& identity);
 
     KdeConnectConfig* config() { return m_config; }
 
+    /**
+     * Stages of a TCP handshake.
+     *
+     * The existing device connects to the new device (Connecting), sends
+     * its identity (SendingIdentity) and starts TLS. The new device waits
+     * for the identity (ReceivingIdentity) and starts TLS. Both end in
+     * Encrypting until the TLS handshake succeeded.
+     */
+    enum class HandshakeStage {
+        Connecting,
+        SendingIdentity,
+        ReceivingIdentity,
+        Encrypting,
+    };
+    static constexpr int HandshakeStageCount = 4;
+
+    const SailfishConnect::LatencyHistogram& handshakeLatency(
+            HandshakeStage stage) const;
+    quint64 handshakeTimeouts() const { return m_handshakeTimeouts; }
+
+    const SailfishConnect::AnnounceScheduler& announceScheduler() const {
+        return m_announceScheduler;
+    }
+    quint64 datagramsSent() const { return m_datagramsSent; }
+
     const static quint16 UDP_PORT = 1716;
     const static quint16 MIN_TCP_PORT = 1716;
     const static quint16 MAX_TCP_PORT = 1764;
 
+    const static int CONNECT_TIMEOUT = 5000;
+    const static int IDENTITY_TIMEOUT = 5000;
+    const static int ENCRYPTION_TIMEOUT = 10000;
+
 public Q_SLOTS:
     void onNetworkChange(const QString &reason) override;
     void onStart() override;
@@ -73,6 +115,8 @@ private Q_SLOTS:
     void newUdpConnection();
     void newConnection();
     void dataReceived();
+    void identitySent();
+    void handshakeTimeout();
     void deviceLinkDestroyed(QObject* destroyedDeviceLink);
     void sslErrors(const QList<QSslError>& errors);
     void broadcastToNetwork();
@@ -85,8 +129,27 @@ private:
     void onNetworkConfigurationChanged(const QNetworkConfiguration& config);
     void addLink(const QString& deviceId, QSslSocket* socket, NetworkPacket* receivedPacket, LanDeviceLink::ConnectionStarted connectionOrigin);
 
+    void startHandshake(QSslSocket* socket, HandshakeStage stage);
+    void advanceHandshake(QSslSocket* socket, HandshakeStage stage);
+    void prepareEncryption(QSslSocket* socket, const QString& deviceId);
+    void abortHandshake(QSslSocket* socket);
+    void sendReverseConnectionRequest(const QHostAddress& address);
+
+    void connectToKnownDevices();
+    bool isConnecting(const QString& deviceId) const;
+    void updateAnnounceScheduler();
+    NetworkPacket lastIdentityPacket(const QString& deviceId) const;
+
     bool hasUsefulNetworkInterfaces();
 
+    struct SslConfiguration {
+        QSslConfiguration configuration;
+        QString peerVerifyName;
+    };
+    SslConfiguration sslConfiguration(
+            const QString& deviceId, bool isDeviceTrusted);
+    void invalidateSslConfigurations();
+
     // TODO: use pimple
     const bool m_testMode;
     KdeConnectConfig* m_config;
@@ -97,15 +160,30 @@ private:
 
     QHash<QString, LanDeviceLink*> m_links;
     QHash<QString, LanPairingHandler*> m_pairingHandlers;
+    // TCP ports from the UDP identities of devices, see encrypted()
+    QHash<QString, quint16> m_announcedTcpPorts;
 
     struct PendingConnect {
         NetworkPacket np;
         QHostAddress sender;
+        HandshakeStage stage = HandshakeStage::Connecting;
+        QElapsedTimer stageTimer;
+        QTimer* timeout = nullptr;
+        // dialed from a remembered endpoint, see connectToKnownDevices
+        bool dialed = false;
     };
     QHash<QSslSocket*, PendingConnect> m_receivedIdentityPackets;
-    QTimer m_combineBroadcastsTimer;
+    SailfishConnect::LatencyHistogram m_handshakeLatency[HandshakeStageCount];
+    quint64 m_handshakeTimeouts = 0;
+    SailfishConnect::AnnounceScheduler m_announceScheduler;
+    quint64 m_datagramsSent = 0;
 
     SailfishConnect::LanNetworkListener m_networkListener;
+
+    // TLS configuration without peer, see sslConfiguration()
+    QSslConfiguration m_baseSslConfiguration;
+    // TLS configuration of trusted devices by device id
+    QHash<QString, SslConfiguration> m_sslConfigurations;
 };
 
 #endif
@@ -49,30 +49,22 @@ LanNetworkListener::LanNetworkListener(QObject *parent) : QObject(parent)
 void LanNetworkListener::onNetworkConfigurationChanged(
         const QNetworkConfiguration &config)
 {
-    int activeConfigs = m_activeConfigurations.size();
     QString id = config.identifier();
 
     if (config.state().testFlag(QNetworkConfiguration::Active)) {
-        m_activeConfigurations.insert(id);
-#ifndef QT_NO_DEBUG_OUTPUT
-        if (!m_activeConfigurations.contains(id)) {
-            qCDebug(coreLogger) << "New active network configuration:";
-            printConfig(config);
-        }
-#endif
-    } else {
-        m_activeConfigurations.remove(id);
-#ifndef QT_NO_DEBUG_OUTPUT
-        if (m_activeConfigurations.contains(id)) {
-            qCDebug(coreLogger) << "Inactivated network configuration:";
-            printConfig(config);
-        }
-#endif
-    }
+        if (m_activeConfigurations.contains(id))
+            return;
+
+        qCDebug(coreLogger) << "New active network configuration:";
+        printConfig(config);
 
-    int newActiveConfigs = m_activeConfigurations.size();
-    if (newActiveConfigs > activeConfigs) {
+        // Announce in every newly activated network, even if another one
+        // went away at the same time (e.g. roaming between access points)
+        m_activeConfigurations.insert(id);
         Q_EMIT networkChanged();
+    } else if (m_activeConfigurations.remove(id)) {
+        qCDebug(coreLogger) << "Inactivated network configuration:";
+        printConfig(config);
     }
 }
 
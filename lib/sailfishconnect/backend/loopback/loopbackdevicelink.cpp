@@ -0,0 +1,110 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loopbackdevicelink.h"
+
+#include <QBuffer>
+#include <QTimer>
+
+#include "loopbacklinkprovider.h"
+#include "../lan/lanpairinghandler.h"
+#include "../../corelogging.h"
+
+LoopbackDeviceLink::LoopbackDeviceLink(
+        const QString& deviceId, LoopbackLinkProvider* parent)
+    : DeviceLink(deviceId, parent)
+    , m_pairingHandler(new LanPairingHandler(this))
+{
+    // the pairing protocol does not depend on the transport
+    connect(m_pairingHandler, &LanPairingHandler::pairingError,
+            this, &DeviceLink::pairingError);
+}
+
+LoopbackDeviceLink::~LoopbackDeviceLink()
+{
+    // like a socket, a connection always has two ends
+    if (m_peer) {
+        m_peer->m_peer = nullptr;
+        m_peer->deleteLater();
+    }
+}
+
+bool LoopbackDeviceLink::sendPacket(NetworkPacket& np, KJobTrackerInterface* jobMgr)
+{
+    Q_UNUSED(jobMgr);
+
+    if (!m_peer)
+        return false;
+
+    QByteArray payload;
+    if (np.hasPayload()) {
+        QSharedPointer<QIODevice> source = np.payload();
+        if (!source || (!source->isOpen() && !source->open(QIODevice::ReadOnly))) {
+            qCWarning(coreLogger) << "Loopback: cannot read payload";
+            return false;
+        }
+        payload = source->readAll();
+        np.setPayloadTransferInfo({{QStringLiteral("loopback"), true}});
+    }
+
+    const QByteArray serializedPacket = np.serialize();
+    m_packetsSent += 1;
+    m_bytesSent += quint64(serializedPacket.size() + payload.size());
+
+    // deliver asynchronously like a real connection would
+    QPointer<LoopbackDeviceLink> peer = m_peer;
+    QTimer::singleShot(0, peer.data(), [peer, serializedPacket, payload]() {
+        if (peer) {
+            peer->deliver(serializedPacket, payload);
+        }
+    });
+    return true;
+}
+
+void LoopbackDeviceLink::deliver(
+        const QByteArray& serializedPacket, const QByteArray& payload)
+{
+    NetworkPacket packet;
+    if (!NetworkPacket::unserialize(serializedPacket, &packet)) {
+        qCWarning(coreLogger) << "Loopback: invalid packet" << serializedPacket;
+        return;
+    }
+
+    if (packet.type() == PACKET_TYPE_PAIR) {
+        m_pairingHandler->packetReceived(packet);
+        return;
+    }
+
+    if (packet.hasPayloadTransferInfo()) {
+        QSharedPointer<QBuffer> buffer(new QBuffer());
+        buffer->setData(payload);
+        buffer->open(QIODevice::ReadOnly);
+        packet.setPayload(buffer, payload.size());
+    }
+
+    Q_EMIT receivedPacket(packet);
+}
+
+void LoopbackDeviceLink::userRequestsPair()
+{
+    m_pairingHandler->requestPairing();
+}
+
+void LoopbackDeviceLink::userRequestsUnpair()
+{
+    m_pairingHandler->unpair();
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOOPBACKDEVICELINK_H
+#define LOOPBACKDEVICELINK_H
+
+#include <QPointer>
+
+#include "../devicelink.h"
+
+class LoopbackLinkProvider;
+class LanPairingHandler;
+
+class LoopbackDeviceLink
+    : public DeviceLink
+{
+    Q_OBJECT
+
+public:
+    LoopbackDeviceLink(const QString& deviceId, LoopbackLinkProvider* parent);
+    ~LoopbackDeviceLink() override;
+
+    QString name() override { return QStringLiteral("LoopbackLink"); }
+    bool sendPacket(NetworkPacket& np, KJobTrackerInterface* jobMgr) override;
+
+    void userRequestsPair() override;
+    void userRequestsUnpair() override;
+
+    bool linkShouldBeKeptAlive() override { return true; }
+
+    void setPeer(LoopbackDeviceLink* peer) { m_peer = peer; }
+    LoopbackDeviceLink* peer() const { return m_peer; }
+
+    quint64 packetsSent() const { return m_packetsSent; }
+    quint64 bytesSent() const { return m_bytesSent; }
+
+private:
+    void deliver(const QByteArray& serializedPacket, const QByteArray& payload);
+
+    QPointer<LoopbackDeviceLink> m_peer;
+    LanPairingHandler* m_pairingHandler;
+
+    quint64 m_packetsSent = 0;
+    quint64 m_bytesSent = 0;
+};
+
+#endif // LOOPBACKDEVICELINK_H
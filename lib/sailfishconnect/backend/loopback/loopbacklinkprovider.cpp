@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loopbacklinkprovider.h"
+
+#include "loopbackdevicelink.h"
+#include "../../corelogging.h"
+
+LoopbackLinkProvider::LoopbackLinkProvider(const NetworkPacket& identity)
+    : m_identity(identity)
+{
+    Q_ASSERT(identity.type() == PACKET_TYPE_IDENTITY);
+}
+
+LoopbackLinkProvider::~LoopbackLinkProvider()
+{
+    onStop();
+}
+
+QString LoopbackLinkProvider::deviceId() const
+{
+    return m_identity.get<QString>(QStringLiteral("deviceId"));
+}
+
+void LoopbackLinkProvider::connectTo(LoopbackLinkProvider* peer)
+{
+    Q_ASSERT(peer != this);
+    m_peer = peer;
+    peer->m_peer = this;
+    establishLinks();
+}
+
+void LoopbackLinkProvider::onStart()
+{
+    m_started = true;
+    establishLinks();
+}
+
+void LoopbackLinkProvider::onStop()
+{
+    m_started = false;
+    // the peer link follows
+    delete m_link.data();
+}
+
+void LoopbackLinkProvider::onNetworkChange(const QString& reason)
+{
+    Q_UNUSED(reason);
+    establishLinks();
+}
+
+void LoopbackLinkProvider::establishLinks()
+{
+    if (!m_started || !m_peer || !m_peer->m_started || m_link)
+        return;
+
+    qCDebug(coreLogger) << "Connecting loopback" << deviceId()
+                        << "with" << m_peer->deviceId();
+
+    LoopbackDeviceLink* link = createLink(m_peer->m_identity);
+    LoopbackDeviceLink* peerLink = m_peer->createLink(m_identity);
+    link->setPeer(peerLink);
+    peerLink->setPeer(link);
+
+    Q_EMIT onConnectionReceived(m_peer->m_identity, link);
+    Q_EMIT m_peer->onConnectionReceived(m_identity, peerLink);
+}
+
+LoopbackDeviceLink* LoopbackLinkProvider::createLink(
+        const NetworkPacket& peerIdentity)
+{
+    m_link = new LoopbackDeviceLink(
+                peerIdentity.get<QString>(QStringLiteral("deviceId")), this);
+    return m_link;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOOPBACKLINKPROVIDER_H
+#define LOOPBACKLINKPROVIDER_H
+
+#include <QPointer>
+
+#include "../linkprovider.h"
+#include <sailfishconnect/networkpacket.h>
+
+class LoopbackDeviceLink;
+
+/**
+ * Connects two endpoints inside the same process.
+ *
+ * Every packet is serialized and unserialized like on a real link and
+ * delivered asynchronously through the event loop, so tests can run whole
+ * stack scenarios (pairing, plugin dispatch, payloads) without a network.
+ *
+ * Each provider represents one endpoint described by its identity packet.
+ * Two started providers connected with connectTo() create a link on each
+ * side.
+ */
+class LoopbackLinkProvider
+    : public LinkProvider
+{
+    Q_OBJECT
+
+public:
+    explicit LoopbackLinkProvider(const NetworkPacket& identity);
+    ~LoopbackLinkProvider() override;
+
+    QString name() override { return QStringLiteral("LoopbackLinkProvider"); }
+    int priority() override { return PRIORITY_LOW; }
+
+    const NetworkPacket& identity() const { return m_identity; }
+    QString deviceId() const;
+
+    void connectTo(LoopbackLinkProvider* peer);
+    LoopbackDeviceLink* link() const { return m_link; }
+
+public Q_SLOTS:
+    void onStart() override;
+    void onStop() override;
+    void onNetworkChange(const QString& reason) override;
+
+private:
+    void establishLinks();
+    LoopbackDeviceLink* createLink(const NetworkPacket& peerIdentity);
+
+    NetworkPacket m_identity;
+    QPointer<LoopbackLinkProvider> m_peer;
+    QPointer<LoopbackDeviceLink> m_link;
+    bool m_started = false;
+};
+
+#endif // LOOPBACKLINKPROVIDER_H
@@ -23,7 +23,9 @@
 
 #include <QNetworkAccessManager>
 #include <QDebug>
+#include <QHash>
 #include <QPointer>
+#include <QTimer>
 
 #include "corelogging.h"
 #include "kdeconnectconfig.h"
@@ -36,6 +38,7 @@
 #include "backend/linkprovider.h"
 #include "corelogging.h"
 #include "helper/cpphelper.h"
+#include "helper/tracing.h"
 #include "io/jobmanager.h"
 #include "kdeconnectconfig.h"
 #include "systeminfo.h"
@@ -44,6 +47,11 @@ using namespace SailfishConnect;
 
 static Daemon* s_instance = nullptr;
 
+// Delay before generating the certificate again after a failure, doubled
+// after every further failure
+static const int CERTIFICATE_RETRY_INTERVAL = 30 * 1000;
+static const int MAX_CERTIFICATE_RETRY_INTERVAL = 30 * 60 * 1000;
+
 struct DaemonPrivate
 {
     //Different ways to find devices and connect to them
@@ -51,14 +59,20 @@ struct DaemonPrivate
 
     //Every known device
     QHash<QString, Device*> m_devices;
+    //Every known device by name and the name it is indexed with
+    QMultiHash<QString, Device*> m_devicesByName;
+    QHash<Device*, QString> m_indexedNames;
 
     QSet<QString> m_discoveryModeAcquisitions;
 
     KdeConnectConfig m_config;
     JobManager* m_jobManager;
+    bool m_linkProvidersStarted = false;
+    int m_certificateRetryInterval = CERTIFICATE_RETRY_INTERVAL;
+    bool m_certificateErrorReported = false;
 
     DaemonPrivate(std::unique_ptr<SystemInfo> systemInfo)
-    : m_config(std::move(systemInfo))
+    : m_config(std::move(systemInfo), KdeConnectConfig::CreateInBackground)
     { }
 };
 
@@ -78,22 +92,32 @@ Daemon::Daemon(std::unique_ptr<SystemInfo> systemInfo, const QList<LinkProvider*
     : QObject(parent)
     , d(new DaemonPrivate(std::move(systemInfo)))
 {
+    SC_TRACE_SCOPE("Daemon::Daemon");
     Q_ASSERT(s_instance == nullptr);
     s_instance = this;
     qCDebug(coreLogger) << "KdeConnect daemon starting";
 
     d->m_jobManager = new JobManager(this);
 
-    // Loading config
+    // Link providers need our certificate, it may still be generated or be
+    // regenerated later
     if (!d->m_config.valid()) {
-        qCCritical(coreLogger) << "no valid configuation. aborting!";
-        return;
+        qCInfo(coreLogger) << "waiting for certificate";
     }
+    connect(&d->m_config, &KdeConnectConfig::certificateChanged,
+            this, &Daemon::certificateReady);
+    connect(&d->m_config, &KdeConnectConfig::certificateLost,
+            this, &Daemon::certificateLost);
+    connect(&d->m_config, &KdeConnectConfig::certificateGenerationFailed,
+            this, &Daemon::certificateFailed);
 
     //Read remebered paired devices
-    const QStringList& list = d->m_config.trustedDevices();
-    for (const QString& id : list) {
-        addDevice(new Device(this, &d->m_config, id));
+    {
+        SC_TRACE_SCOPE("Daemon: load trusted devices");
+        const QStringList& list = d->m_config.trustedDevices();
+        for (const QString& id : list) {
+            addDevice(new Device(this, &d->m_config, id));
+        }
     }
 
     setLinkProviders(link_providers);
@@ -126,6 +150,7 @@ void Daemon::releaseDiscoveryMode(const QString& key)
 void Daemon::removeDevice(Device* device)
 {
     d->m_devices.remove(device->id());
+    d->m_devicesByName.remove(d->m_indexedNames.take(device), device);
     device->deleteLater();
     Q_EMIT deviceRemoved(device->id());
     Q_EMIT deviceListChanged();
@@ -165,12 +190,91 @@ void Daemon::setLinkProviders(const QList<LinkProvider *> &linkProviders)
     for (LinkProvider* a : asConst(d->m_linkProviders)) {
         connect(a, &LinkProvider::onConnectionReceived,
                 this, &Daemon::onNewDeviceLink);
+    }
+
+    if (isReady()) {
+        startLinkProviders();
+    }
+}
+
+void Daemon::stopLinkProviders()
+{
+    if (!d->m_linkProvidersStarted)
+        return;
+
+    for (LinkProvider* a : asConst(d->m_linkProviders)) {
+        a->onStop();
+    }
+    d->m_linkProvidersStarted = false;
+}
+
+void Daemon::startLinkProviders()
+{
+    if (d->m_linkProvidersStarted)
+        return;
+
+    SC_TRACE_SCOPE("Daemon::startLinkProviders");
+    for (LinkProvider* a : asConst(d->m_linkProviders)) {
         a->onStart();
     }
+    d->m_linkProvidersStarted = !d->m_linkProviders.isEmpty();
+}
+
+void Daemon::certificateReady()
+{
+    qCDebug(coreLogger) << "Certificate ready";
+    d->m_certificateRetryInterval = CERTIFICATE_RETRY_INTERVAL;
+    d->m_certificateErrorReported = false;
+
+    // restart so that new connections use the new certificate
+    stopLinkProviders();
+    startLinkProviders();
+    Q_EMIT readyChanged(true);
+}
+
+void Daemon::certificateLost()
+{
+    // without an identity no connection can be accepted or offered
+    qCWarning(coreLogger) << "Certificate lost, waiting for a new one";
+    stopLinkProviders();
+    Q_EMIT readyChanged(false);
+}
+
+void Daemon::certificateFailed(const QString& error, bool permanent)
+{
+    if (!d->m_certificateErrorReported) {
+        d->m_certificateErrorReported = true;
+        reportError(tr("Certificate generation failed"), error);
+    }
+
+    if (permanent) {
+        qCCritical(coreLogger)
+                << "Certificate generation failed:" << error
+                << "- not retrying until the configuration is fixed";
+        return;
+    }
+
+    qCCritical(coreLogger)
+            << "Certificate generation failed:" << error
+            << "- retrying in" << d->m_certificateRetryInterval << "ms";
+    QTimer::singleShot(
+                d->m_certificateRetryInterval,
+                &d->m_config, &KdeConnectConfig::regenerateCertificate);
+    d->m_certificateRetryInterval = qMin(
+                d->m_certificateRetryInterval * 2,
+                MAX_CERTIFICATE_RETRY_INTERVAL);
+}
+
+bool Daemon::isReady() const
+{
+    return d->m_config.valid();
 }
 
 void Daemon::forceOnNetworkChange(const QString& reason)
 {
+    if (!isReady())
+        return;
+
     qCDebug(coreLogger)
             << "Sending onNetworkChange to"
             << d->m_linkProviders.size() << "LinkProviders";
@@ -181,12 +285,7 @@ void Daemon::forceOnNetworkChange(const QString& reason)
 
 Device* Daemon::getDevice(const QString& deviceId)
 {
-    for (Device* device : asConst(d->m_devices)) {
-        if (device->id() == deviceId) {
-            return device;
-        }
-    }
-    return Q_NULLPTR;
+    return d->m_devices.value(deviceId);
 }
 
 QStringList Daemon::devices(bool onlyReachable, bool onlyTrusted)
@@ -202,6 +301,7 @@ QStringList Daemon::devices(bool onlyReachable, bool onlyTrusted)
 
 void Daemon::onNewDeviceLink(const NetworkPacket& identityPacket, DeviceLink* dl)
 {
+    SC_TRACE_SCOPE("Daemon::onNewDeviceLink");
     const QString& id = identityPacket.get<QString>(QStringLiteral("deviceId"));
 
     qCDebug(coreLogger) << "Device discovered" << id << "via" << dl->provider()->name();
@@ -285,13 +385,29 @@ bool Daemon::isDiscoveringDevices() const
 
 QString Daemon::deviceIdByName(const QString& name)
 {
-    for (Device* device : asConst(d->m_devices)) {
-        if (device->name() == name && device->isTrusted())
-            return device->id();
+    auto iter = d->m_devicesByName.constFind(name);
+    for (; iter != d->m_devicesByName.constEnd() && iter.key() == name; ++iter) {
+        if (iter.value()->isTrusted())
+            return iter.value()->id();
     }
     return {};
 }
 
+void Daemon::updateDeviceName(Device* device)
+{
+    const QString name = device->name();
+    auto oldName = d->m_indexedNames.find(device);
+    if (oldName != d->m_indexedNames.end()) {
+        if (oldName.value() == name)
+            return;
+
+        d->m_devicesByName.remove(oldName.value(), device);
+    }
+
+    d->m_indexedNames.insert(device, name);
+    d->m_devicesByName.insert(name, device);
+}
+
 void Daemon::addDevice(Device* device)
 {
     const QString id = device->id();
@@ -302,7 +418,11 @@ void Daemon::addDevice(Device* device)
         if (hasPairingRequests)
             askPairingConfirmation(device);
     } );
+    connect(device, &Device::nameChanged, this, [this, device]() {
+        updateDeviceName(device);
+    });
     d->m_devices[id] = device;
+    updateDeviceName(device);
 
     Q_EMIT deviceAdded(id);
     Q_EMIT deviceListChanged();
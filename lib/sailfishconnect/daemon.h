@@ -41,6 +41,7 @@ class Daemon : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(bool isDiscoveringDevices READ isDiscoveringDevices)
+    Q_PROPERTY(bool isReady READ isReady NOTIFY readyChanged)
     Q_PROPERTY(QStringList pairingRequests READ pairingRequests NOTIFY pairingRequestsChanged)
 
 public:
@@ -67,6 +68,11 @@ public:
 
     QStringList pairingRequests() const;
 
+    /**
+     * False until our certificate exists, devices can not be reached before
+     */
+    bool isReady() const;
+
     Q_SCRIPTABLE QString selfId() const;
 public Q_SLOTS:
     Q_SCRIPTABLE void acquireDiscoveryMode(const QString& id);
@@ -90,19 +96,26 @@ Q_SIGNALS:
     Q_SCRIPTABLE void deviceListChanged(); //Emitted when any of deviceAdded, deviceRemoved or deviceVisibilityChanged is emitted
     Q_SCRIPTABLE void announcedNameChanged(const QString& announcedName);
     Q_SCRIPTABLE void pairingRequestsChanged();
+    Q_SCRIPTABLE void readyChanged(bool ready);
 
 private Q_SLOTS:
     void onNewDeviceLink(const NetworkPacket& identityPacket, DeviceLink* dl);
     void onDeviceStatusChanged();
+    void certificateReady();
+    void certificateLost();
+    void certificateFailed(const QString& error, bool permanent);
 
 private:
     void addDevice(Device* device);
     bool isDiscoveringDevices() const;
     void removeDevice(Device* d);
+    void updateDeviceName(Device* device);
     void cleanDevices();
 
     QList<LinkProvider*> standardLinkProviders();
     void setLinkProviders(const QList<LinkProvider*>& linkProviders);
+    void startLinkProviders();
+    void stopLinkProviders();
 
     QScopedPointer<struct DaemonPrivate> d;
 };
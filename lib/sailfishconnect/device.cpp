@@ -27,7 +27,6 @@
 
 #include <QtGlobal>
 #include <QSslCertificate>
-#include <QSettings>
 #include <QHostAddress>
 #include <QRegularExpression>
 #include <QDir>
@@ -42,6 +41,8 @@
 #include "backend/pairinghandler.h"
 #include <sailfishconnect/helper/cpphelper.h>
 #include <sailfishconnect/helper/functools.h>
+#include <sailfishconnect/helper/tracing.h>
+#include <sailfishconnect/io/configstore.h>
 
 using namespace SailfishConnect;
 
@@ -52,13 +53,24 @@ struct DevicePrivate {
     int m_protocolVersion;
 
     QVector<DeviceLink*> m_deviceLinks;
+    // enabled plugins, nullptr for plugins loaded on demand and not used yet
     QHash<QString, KdeConnectPlugin*> m_plugins;
 
     //Capabilities stuff
-    QMultiMap<QString, KdeConnectPlugin*> m_pluginsByIncomingCapability;
+    // plugins by the id of the packet type they receive,
+    // see NetworkPacket::typeId()
+    QVector<QVector<KdeConnectPlugin*>> m_pluginsByIncomingType;
+    // ids of plugins still to be loaded by the packet type they receive
+    QVector<QVector<QString>> m_pendingPluginsByIncomingType;
     QSet<QString> m_supportedPlugins;
     QSet<PairingHandler*> m_pairRequests;
     bool m_waitsForPairing = false;
+    // set while we change the trust ourselves
+    bool m_updatingTrust = false;
+
+    // plugin enablement by plugin id, filled on first lookup
+    QHash<QString, bool> m_pluginEnabled;
+    QSharedPointer<ConfigStore> m_pluginStates;
 
     KdeConnectConfig* m_config;
 
@@ -105,11 +117,13 @@ Device::Device(QObject* parent, KdeConnectConfig* config, const QString& id, con
     }
 
     //Assume every plugin is supported until addLink is called and we can get the actual list
-    d->m_supportedPlugins = PluginManager::instance()->getPluginList().toSet();
+    d->m_supportedPlugins = PluginManager::instance()->getPluginSet();
 
     connect(this, &Device::pairingError, this, [](const QString& info) {
         qWarning() << "Device pairing error" << info;
     });
+    connect(config, &KdeConnectConfig::deviceTrustChanged,
+            this, &Device::configTrustChanged);
 }
 
 Device::Device(QObject* parent, KdeConnectConfig* config, const NetworkPacket& identityPacket, DeviceLink* dl)
@@ -154,10 +168,28 @@ QStringList Device::loadedPlugins() const
     return d->m_plugins.keys();
 }
 
+template<typename T>
+static void addForIncomingTypes(
+        QVector<QVector<T>>& table, const QStringList& packetTypes, const T& value)
+{
+    for (const QString& packetType : packetTypes) {
+        const int typeId = NetworkPacket::internType(packetType);
+        if (typeId < 0)
+            continue;
+
+        if (typeId >= table.size()) {
+            table.resize(typeId + 1);
+        }
+        table[typeId].append(value);
+    }
+}
+
 void Device::reloadPlugins()
 {
+    SC_TRACE_SCOPE("Device::reloadPlugins");
     QHash<QString, KdeConnectPlugin*> newPluginMap, oldPluginMap = d->m_plugins;
-    QMultiMap<QString, KdeConnectPlugin*> newPluginsByIncomingCapability;
+    QVector<QVector<KdeConnectPlugin*>> newPluginsByIncomingType;
+    QVector<QVector<QString>> newPendingPluginsByIncomingType;
 
     // Do not load any plugin for unpaired devices, nor useless loading them for
     // unreachable devices
@@ -169,16 +201,22 @@ void Device::reloadPlugins()
             const bool pluginEnabled = isPluginEnabled(pluginId);
             if (pluginEnabled) {
                 KdeConnectPlugin* plugin = d->m_plugins.take(pluginId);
-                if (!plugin) {
+                if (!plugin && !pluginManager->loadOnDemand(pluginId)) {
                     plugin = pluginManager->instantiatePluginForDevice(
                                 pluginId, this);
+                    Q_ASSERT(plugin);
                 }
-                Q_ASSERT(plugin);
 
                 const auto incomingCapabilities =
                         pluginManager->incomingCapabilities(pluginId);
-                for (const QString& interface : incomingCapabilities) {
-                    newPluginsByIncomingCapability.insert(interface, plugin);
+                if (plugin) {
+                    addForIncomingTypes(
+                                newPluginsByIncomingType,
+                                incomingCapabilities, plugin);
+                } else {
+                    addForIncomingTypes(
+                                newPendingPluginsByIncomingType,
+                                incomingCapabilities, pluginId);
                 }
 
                 newPluginMap[pluginId] = plugin;
@@ -192,16 +230,54 @@ void Device::reloadPlugins()
     // them anymore, otherwise they would have been moved to the newPluginMap)
     qDeleteAll(d->m_plugins);
     d->m_plugins = newPluginMap;
-    d->m_pluginsByIncomingCapability = newPluginsByIncomingCapability;
+    d->m_pluginsByIncomingType = newPluginsByIncomingType;
+    d->m_pendingPluginsByIncomingType = newPendingPluginsByIncomingType;
 
     if (differentPlugins) {
         Q_EMIT pluginsChanged();
     }
 }
 
+KdeConnectPlugin* Device::loadPlugin(const QString& pluginId)
+{
+    auto iter = d->m_plugins.find(pluginId);
+    if (iter == d->m_plugins.end())
+        return nullptr;
+    if (iter.value())
+        return iter.value();
+
+    SC_TRACE_SCOPE("Device::loadPlugin");
+    PluginManager* pluginManager = PluginManager::instance();
+    KdeConnectPlugin* plugin =
+            pluginManager->instantiatePluginForDevice(pluginId, this);
+    if (!plugin)
+        return nullptr;
+
+    // the constructor of the plugin may have reloaded the plugins
+    iter = d->m_plugins.find(pluginId);
+    if (iter == d->m_plugins.end() || iter.value()) {
+        delete plugin;
+        return iter != d->m_plugins.end() ? iter.value() : nullptr;
+    }
+    iter.value() = plugin;
+
+    const auto incomingCapabilities =
+            pluginManager->incomingCapabilities(pluginId);
+    addForIncomingTypes(
+                d->m_pluginsByIncomingType, incomingCapabilities, plugin);
+    for (const QString& packetType : incomingCapabilities) {
+        const int typeId = NetworkPacket::internType(packetType);
+        if (typeId >= 0 && typeId < d->m_pendingPluginsByIncomingType.size()) {
+            d->m_pendingPluginsByIncomingType[typeId].removeAll(pluginId);
+        }
+    }
+
+    return plugin;
+}
+
 QString Device::pluginsConfigFile() const
 {
-    return KdeConnectConfig::instance()->deviceConfigDir(id()).absoluteFilePath(QStringLiteral("config"));
+    return d->m_config->deviceConfigDir(id()).absoluteFilePath(QStringLiteral("config"));
 }
 
 void Device::requestPair()
@@ -231,7 +307,9 @@ void Device::unpair()
         dl->userRequestsUnpair();
     }
 
+    d->m_updatingTrust = true;
     d->m_config->removeTrustedDevice(id());
+    d->m_updatingTrust = false;
     Q_EMIT trustedChanged(false);
 }
 
@@ -240,6 +318,7 @@ void Device::pairStatusChanged(DeviceLink::PairStatus status)
     // FIXME: check all pairing handlers
     setWaitsForPairing(false);
 
+    d->m_updatingTrust = true;
     if (status == DeviceLink::NotPaired) {
         d->m_config->removeTrustedDevice(id());
 
@@ -251,6 +330,7 @@ void Device::pairStatusChanged(DeviceLink::PairStatus status)
     } else {
         d->m_config->addTrustedDevice(id(), name(), type());
     }
+    d->m_updatingTrust = false;
 
     reloadPlugins(); // Will load/unload plugins
 
@@ -259,6 +339,16 @@ void Device::pairStatusChanged(DeviceLink::PairStatus status)
     Q_ASSERT(isTrusted == this->isTrusted());
 }
 
+void Device::configTrustChanged(const QString& deviceId, bool trusted)
+{
+    // changes we made ourselves are announced by the caller
+    if (deviceId != id() || d->m_updatingTrust)
+        return;
+
+    reloadPlugins();
+    Q_EMIT trustedChanged(trusted);
+}
+
 static void printCapabilities(
         const QSet<QString>& localCapabilities,
         const QSet<QString>& remoteCapabilities
@@ -301,6 +391,8 @@ void Device::addLink(const NetworkPacket& identityPacket, DeviceLink* link)
 
     connect(link, &DeviceLink::receivedPacket,
             this, &Device::privateReceivedPacket);
+    connect(link, &DeviceLink::statisticsChanged,
+            this, &Device::linkStatisticsChanged);
 
     std::sort(
         d->m_deviceLinks.begin(), d->m_deviceLinks.end(),
@@ -308,32 +400,33 @@ void Device::addLink(const NetworkPacket& identityPacket, DeviceLink* link)
 
     const bool capabilitiesSupported = identityPacket.has(QStringLiteral("incomingCapabilities")) || identityPacket.has(QStringLiteral("outgoingCapabilities"));
     if (capabilitiesSupported) {
-        const QSet<QString> outgoingCapabilities =
+        PluginManager* pluginManager = PluginManager::instance();
+        const QStringList outgoingCapabilities =
                 identityPacket.get<QStringList>(
-                    QStringLiteral("outgoingCapabilities")).toSet();
-        const QSet<QString> incomingCapabilities =
+                    QStringLiteral("outgoingCapabilities"));
+        const QStringList incomingCapabilities =
                 identityPacket.get<QStringList>(
-                    QStringLiteral("incomingCapabilities")).toSet();
+                    QStringLiteral("incomingCapabilities"));
 
-        d->m_supportedPlugins =
-                PluginManager::instance()->pluginsForCapabilities(
-                    incomingCapabilities, outgoingCapabilities);
+        d->m_supportedPlugins = pluginManager->pluginsForCapabilities(
+                    pluginManager->capabilities(incomingCapabilities),
+                    pluginManager->capabilities(outgoingCapabilities));
 
 #ifndef QT_NO_DEBUG_OUTPUT
         qDebug() << "Outgoing capabilities for" << d->m_deviceName;
         printCapabilities(
-                    PluginManager::instance()->outgoingCapabilities().toSet(),
-                    incomingCapabilities);
+                    pluginManager->outgoingCapabilities().toSet(),
+                    incomingCapabilities.toSet());
 
         qDebug() << "Incoming capabilities for" << d->m_deviceName;
         printCapabilities(
-                    PluginManager::instance()->incomingCapabilities().toSet(),
-                    outgoingCapabilities);
+                    pluginManager->incomingCapabilities().toSet(),
+                    outgoingCapabilities.toSet());
 
         qDebug() << "Plugins for" << d->m_deviceName << d->m_supportedPlugins;
 #endif
     } else {
-        d->m_supportedPlugins = PluginManager::instance()->getPluginList().toSet();
+        d->m_supportedPlugins = PluginManager::instance()->getPluginSet();
     }
 
     reloadPlugins();
@@ -416,6 +509,7 @@ void Device::removeLink(DeviceLink* link)
     d->m_deviceLinks.removeAll(link);
 
     qCDebug(coreLogger) << "RemoveLink" << d->m_deviceLinks.size() << "links remaining";
+    Q_EMIT linkStatisticsChanged();
 
     if (d->m_deviceLinks.isEmpty()) {
         setWaitsForPairing(false);
@@ -426,23 +520,71 @@ void Device::removeLink(DeviceLink* link)
 
 bool Device::sendPacket(NetworkPacket& np, KJobTrackerInterface* jobMgr)
 {
+    SC_TRACE_SCOPE("Device::sendPacket");
     Q_ASSERT(np.type() != PACKET_TYPE_PAIR);
     Q_ASSERT(isTrusted());
 
+    // Try the best link first and fall back to the others if it fails
+    QVector<DeviceLink*> links = d->m_deviceLinks;
+    std::stable_sort(
+        links.begin(), links.end(),
+        byKeyDesc([](DeviceLink* p) { return p->score(); }));
+
     // Maybe we could block here any packet that is not an identity or a
     // pairing packet to prevent sending non encrypted data
-    for (DeviceLink* dl : asConst(d->m_deviceLinks)) {
-        if (dl->sendPacket(np, jobMgr)) return true;
+    for (DeviceLink* dl : asConst(links)) {
+        const bool success = dl->sendPacket(np, jobMgr);
+        dl->reportSendResult(success);
+        if (success) return true;
+
+        qCDebug(coreLogger) << "Sending" << np.type() << "to" << name()
+                            << "via" << dl->name() << "failed";
+
+        // the failed link may have read or closed the payload already
+        if (np.hasPayload() && !rewindPayload(np)) {
+            qCWarning(coreLogger)
+                    << "Payload of" << np.type()
+                    << "can not be sent again over another link";
+            return false;
+        }
     }
 
     return false;
 }
 
+bool Device::rewindPayload(NetworkPacket& np)
+{
+    const QSharedPointer<QIODevice> payload = np.payload();
+    if (!payload)
+        return true;
+
+    // a closed payload is opened from the start by the next upload
+    if (!payload->isOpen())
+        return true;
+    if (payload->isSequential())
+        return false;
+    return payload->seek(0);
+}
+
 void Device::privateReceivedPacket(const NetworkPacket& np)
 {
+    SC_TRACE_SCOPE("Device::privateReceivedPacket");
     Q_ASSERT(np.type() != PACKET_TYPE_PAIR);
     if (isTrusted()) {
-        const QList<KdeConnectPlugin*> plugins = d->m_pluginsByIncomingCapability.values(np.type());
+        const int typeId = np.typeId();
+        if (typeId >= 0 && typeId < d->m_pendingPluginsByIncomingType.size()) {
+            const QVector<QString> pending =
+                    d->m_pendingPluginsByIncomingType.at(typeId);
+            for (const QString& pluginId : pending) {
+                loadPlugin(pluginId);
+            }
+        }
+
+        // a shallow copy: plugins may reload the plugins of this device
+        const QVector<KdeConnectPlugin*> plugins =
+                typeId >= 0 && typeId < d->m_pluginsByIncomingType.size()
+                ? d->m_pluginsByIncomingType.at(typeId)
+                : QVector<KdeConnectPlugin*>();
         if (plugins.isEmpty()) {
             qWarning() << "discarding unsupported packet" << np.type() << "for" << name();
         }
@@ -458,7 +600,7 @@ void Device::privateReceivedPacket(const NetworkPacket& np)
 
 bool Device::isTrusted() const
 {
-    return d->m_config->trustedDevices().contains(id());
+    return d->m_config->isTrustedDevice(id());
 }
 
 QStringList Device::availableLinks() const
@@ -475,6 +617,17 @@ bool Device::isReachable() const {
     return !d->m_deviceLinks.isEmpty();
 }
 
+int Device::rtt() const
+{
+    int result = -1;
+    for (DeviceLink* dl : asConst(d->m_deviceLinks)) {
+        if (dl->rtt() >= 0 && (result < 0 || dl->rtt() < result)) {
+            result = dl->rtt();
+        }
+    }
+    return result;
+}
+
 void Device::cleanUnneededLinks() {
     if (isTrusted()) {
         return;
@@ -582,28 +735,56 @@ void Device::setWaitsForPairing(bool value)
 
 KdeConnectPlugin* Device::plugin(const QString& pluginName) const
 {
-    return d->m_plugins.value(pluginName);
+    KdeConnectPlugin* plugin = d->m_plugins.value(pluginName);
+    if (plugin || !d->m_plugins.contains(pluginName))
+        return plugin;
+
+    // plugins loaded on demand are created on first access
+    return const_cast<Device*>(this)->loadPlugin(pluginName);
 }
 
-void Device::setPluginEnabled(const QString& pluginName, bool enabled)
+static QString pluginEnabledKey(const QString& pluginId)
+{
+    return QStringLiteral("Plugins/") + pluginId + QStringLiteral("Enabled");
+}
+
+ConfigStore* Device::pluginStates() const
 {
-    QSettings pluginStates(pluginsConfigFile(), QSettings::IniFormat);
-    pluginStates.beginGroup("Plugins");
+    if (!d->m_pluginStates) {
+        d->m_pluginStates = ConfigStore::forFile(pluginsConfigFile());
+
+        connect(d->m_pluginStates.data(), &ConfigStore::changed,
+                this, &Device::pluginStatesChanged);
+    }
+    return d->m_pluginStates.data();
+}
 
-    const QString enabledKey = pluginName + QStringLiteral("Enabled");
-    pluginStates.setValue(enabledKey, enabled);
+void Device::pluginStatesChanged()
+{
+    // changed by someone else
+    d->m_pluginEnabled.clear();
+    reloadPlugins();
+}
+
+void Device::setPluginEnabled(const QString& pluginName, bool enabled)
+{
+    d->m_pluginEnabled.insert(pluginName, enabled);
+    pluginStates()->setValue(pluginEnabledKey(pluginName), enabled);
     reloadPlugins();
 }
 
 bool Device::isPluginEnabled(const QString& pluginId) const
 {
-    const QString enabledKey = pluginId + QStringLiteral("Enabled");
-    QSettings pluginStates(pluginsConfigFile(), QSettings::IniFormat);
-    pluginStates.beginGroup("Plugins");
+    auto iter = d->m_pluginEnabled.constFind(pluginId);
+    if (iter != d->m_pluginEnabled.constEnd())
+        return iter.value();
 
-    return pluginStates.contains(enabledKey)
-        ? pluginStates.value(enabledKey).toBool()
+    const QVariant value = pluginStates()->value(pluginEnabledKey(pluginId));
+    const bool enabled = value.isValid()
+        ? value.toBool()
         : PluginManager::instance()->enabledByDefault(pluginId);
+    d->m_pluginEnabled.insert(pluginId, enabled);
+    return enabled;
 }
 
 QString Device::encryptionInfo() const
@@ -36,6 +36,10 @@ class QStringList;
 class PairingHandler;
 class KJobTrackerInterface;
 
+namespace SailfishConnect {
+class ConfigStore;
+} // namespace SailfishConnect
+
 
 class Device
     : public QObject
@@ -51,6 +55,7 @@ class Device
     Q_PROPERTY(QStringList supportedPlugins READ supportedPlugins NOTIFY pluginsChanged)
     Q_PROPERTY(bool hasPairingRequests READ hasPairingRequests NOTIFY hasPairingRequestsChanged)
     Q_PROPERTY(bool waitsForPairing READ waitsForPairing NOTIFY waitsForPairingChanged)
+    Q_PROPERTY(int rtt READ rtt NOTIFY linkStatisticsChanged)
 
 public:
 
@@ -102,6 +107,11 @@ public:
     Q_SCRIPTABLE QStringList availableLinks() const;
     bool isReachable() const;
 
+    /**
+     * Round trip time in milliseconds of the fastest link or -1 if unknown
+     */
+    int rtt() const;
+
     Q_SCRIPTABLE QStringList loadedPlugins() const;
     Q_SCRIPTABLE bool hasPlugin(const QString& name) const;
 
@@ -152,6 +162,8 @@ private Q_SLOTS:
     void privateReceivedPacket(const NetworkPacket& np);
     void linkDestroyed(QObject* o);
     void pairStatusChanged(DeviceLink::PairStatus current);
+    void configTrustChanged(const QString& deviceId, bool trusted);
+    void pluginStatesChanged();
     void addPairingRequest(PairingHandler* handler);
     void removePairingRequest(PairingHandler* handler);
 
@@ -164,15 +176,19 @@ Q_SIGNALS:
 
     Q_SCRIPTABLE void hasPairingRequestsChanged(bool hasPairingRequests);
     Q_SCRIPTABLE void waitsForPairingChanged(bool waitsForPairing);
+    Q_SCRIPTABLE void linkStatisticsChanged();
 
 private: //Methods
     static DeviceType str2type(const QString& deviceType);
     static QString type2str(DeviceType deviceType);
+    static bool rewindPayload(NetworkPacket& np);
 
     void setName(const QString& name);
     void setType(const QString& type);
     void setWaitsForPairing(bool value);
     QString iconForStatus(bool reachable, bool paired) const;
+    SailfishConnect::ConfigStore* pluginStates() const;
+    KdeConnectPlugin* loadPlugin(const QString& pluginId);
 
 private:
     QScopedPointer<struct DevicePrivate> d;
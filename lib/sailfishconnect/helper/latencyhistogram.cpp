@@ -0,0 +1,79 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "latencyhistogram.h"
+
+#include <algorithm>
+
+namespace SailfishConnect {
+
+constexpr int LatencyHistogram::BucketCount;
+
+void LatencyHistogram::add(qint64 ms)
+{
+    ms = std::max<qint64>(ms, 0);
+
+    int i = 0;
+    while (i < BucketCount - 1 && ms > bucketUpperBound(i)) {
+        ++i;
+    }
+    m_buckets[i] += 1;
+
+    m_min = m_count ? std::min(m_min, ms) : ms;
+    m_max = std::max(m_max, ms);
+    m_sum += ms;
+    m_count += 1;
+}
+
+void LatencyHistogram::reset()
+{
+    *this = LatencyHistogram();
+}
+
+qint64 LatencyHistogram::mean() const
+{
+    return m_count ? m_sum / qint64(m_count) : 0;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int i)
+{
+    return i < BucketCount - 1 ? (qint64(1) << i) : -1;
+}
+
+qint64 LatencyHistogram::percentile(int p) const
+{
+    if (m_count == 0)
+        return 0;
+
+    const quint64 rank = (m_count * quint64(qBound(0, p, 100)) + 99) / 100;
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount - 1; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank && seen > 0)
+            return bucketUpperBound(i);
+    }
+    return m_max;
+}
+
+QString LatencyHistogram::toString() const
+{
+    return QStringLiteral("n=%1 min=%2ms mean=%3ms p50=%4ms p90=%5ms max=%6ms")
+            .arg(m_count).arg(min()).arg(mean())
+            .arg(percentile(50)).arg(percentile(90)).arg(m_max);
+}
+
+} // namespace SailfishConnect
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+
+#include <QtGlobal>
+#include <QString>
+
+namespace SailfishConnect {
+
+/**
+ * Histogram of durations in milliseconds with exponential buckets.
+ *
+ * Bucket i counts samples up to 2^i ms, the last bucket collects everything
+ * above. Recording a sample is cheap enough to be done on every handshake or
+ * packet.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int BucketCount = 17;
+
+    void add(qint64 ms);
+    void reset();
+
+    quint64 count() const { return m_count; }
+    qint64 min() const { return m_count ? m_min : 0; }
+    qint64 max() const { return m_max; }
+    qint64 mean() const;
+
+    quint64 bucket(int i) const { return m_buckets[i]; }
+    static qint64 bucketUpperBound(int i);
+
+    /**
+     * Upper bound of the bucket containing the p-th percentile
+     * (0 <= p <= 100) or 0 if no samples were recorded.
+     */
+    qint64 percentile(int p) const;
+
+    QString toString() const;
+
+private:
+    std::array<quint64, BucketCount> m_buckets{};
+    quint64 m_count = 0;
+    qint64 m_sum = 0;
+    qint64 m_min = 0;
+    qint64 m_max = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // LATENCYHISTOGRAM_H
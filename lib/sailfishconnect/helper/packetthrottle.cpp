@@ -0,0 +1,161 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packetthrottle.h"
+
+#include "../corelogging.h"
+#include "cpphelper.h"
+
+namespace SailfishConnect {
+
+PacketThrottle::PacketThrottle(QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &PacketThrottle::sendDue);
+    connect(&m_pruneTimer, &QTimer::timeout, this, &PacketThrottle::prune);
+    m_elapsed.start();
+    m_clock = [this]() { return m_elapsed.elapsed(); };
+}
+
+void PacketThrottle::setClock(const Clock& clock)
+{
+    m_clock = clock;
+}
+
+void PacketThrottle::setCoalesceWindow(int ms)
+{
+    m_coalesceWindow = ms;
+}
+
+void PacketThrottle::setMinInterval(int ms)
+{
+    m_minInterval = ms;
+}
+
+void PacketThrottle::setForgetAfter(int ms)
+{
+    Q_ASSERT(ms > 0);
+    m_forgetAfter = ms;
+    if (m_pruneTimer.isActive()) {
+        m_pruneTimer.start(m_forgetAfter);
+    }
+}
+
+void PacketThrottle::submit(const QString& key, const NetworkPacket& np)
+{
+    const qint64 now = m_clock();
+
+    auto iter = m_entries.find(key);
+    if (iter == m_entries.end()) {
+        Entry& entry = m_entries[key];
+        entry.lastSubmit = now;
+        entry.lastSent = now;
+        if (!m_pruneTimer.isActive()) {
+            m_pruneTimer.start(m_forgetAfter);
+        }
+        ++m_sentPackets;
+        Q_EMIT send(np);
+        return;
+    }
+
+    Entry& entry = iter.value();
+    entry.lastSubmit = now;
+    if (entry.isPending()) {
+        ++m_droppedPackets;
+        qCDebug(coreLogger) << "Replace pending update of" << key;
+    } else {
+        entry.due = qMax(now + m_coalesceWindow,
+                         entry.lastSent + m_minInterval);
+    }
+    entry.packet = np;
+
+    schedule();
+}
+
+bool PacketThrottle::remove(const QString& key)
+{
+    auto iter = m_entries.find(key);
+    if (iter == m_entries.end())
+        return false;
+
+    if (iter->isPending()) {
+        ++m_droppedPackets;
+    }
+    m_entries.erase(iter);
+    schedule();
+    return true;
+}
+
+void PacketThrottle::sendDue()
+{
+    const qint64 now = m_clock();
+
+    // collect first, receivers of send may submit or remove
+    QList<NetworkPacket> due;
+    for (auto iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+        Entry& entry = iter.value();
+        if (entry.isPending() && entry.due <= now) {
+            due.append(entry.packet);
+            entry.packet = NetworkPacket();
+            entry.due = -1;
+            entry.lastSent = now;
+        }
+    }
+    m_sentPackets += due.size();
+    schedule();
+
+    for (const NetworkPacket& np : asConst(due)) {
+        Q_EMIT send(np);
+    }
+}
+
+void PacketThrottle::prune()
+{
+    const qint64 now = m_clock();
+
+    for (auto iter = m_entries.begin(); iter != m_entries.end();) {
+        if (!iter->isPending() && now - iter->lastSubmit >= m_forgetAfter) {
+            qCDebug(coreLogger) << "Forget updates of" << iter.key();
+            iter = m_entries.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+
+    if (m_entries.isEmpty()) {
+        m_pruneTimer.stop();
+    }
+}
+
+void PacketThrottle::schedule()
+{
+    qint64 next = -1;
+    for (const Entry& entry : asConst(m_entries)) {
+        if (entry.isPending() && (next < 0 || entry.due < next))
+            next = entry.due;
+    }
+
+    if (next < 0) {
+        m_timer.stop();
+        return;
+    }
+
+    m_timer.start(int(qMax<qint64>(0, next - m_clock())));
+}
+
+} // namespace SailfishConnect
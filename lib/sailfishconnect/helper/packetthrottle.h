@@ -0,0 +1,109 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETTHROTTLE_H
+#define PACKETTHROTTLE_H
+
+#include <functional>
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "../networkpacket.h"
+
+namespace SailfishConnect {
+
+/**
+ * Limits how often updates of the same thing are sent.
+ *
+ * The first packet for a key is sent right away. Later packets for it are
+ * collected for the coalesce window, so only the latest state of a burst is
+ * sent, and at least the minimum interval lies between two sent packets.
+ * Keys that were not submitted for forgetAfter() ms are dropped, in case
+ * remove() was never called for them.
+ */
+class PacketThrottle : public QObject
+{
+    Q_OBJECT
+public:
+    // milliseconds from an arbitrary but fixed start
+    using Clock = std::function<qint64()>;
+
+    explicit PacketThrottle(QObject *parent = nullptr);
+
+    /**
+     * Replace the monotonic clock all intervals are measured with, e.g. to
+     * control time in tests. Timers only wake the throttle up, nothing is
+     * sent before this clock says so.
+     */
+    void setClock(const Clock& clock);
+
+    void setCoalesceWindow(int ms);
+    void setMinInterval(int ms);
+    void setForgetAfter(int ms);
+    int forgetAfter() const { return m_forgetAfter; }
+
+    void submit(const QString& key, const NetworkPacket& np);
+
+    /**
+     * Forget @p key and drop its pending packet.
+     *
+     * @return whether @p key was known
+     */
+    bool remove(const QString& key);
+
+    bool contains(const QString& key) const { return m_entries.contains(key); }
+    int count() const { return m_entries.size(); }
+
+    quint64 sentPackets() const { return m_sentPackets; }
+    quint64 droppedPackets() const { return m_droppedPackets; }
+
+signals:
+    void send(const NetworkPacket& np);
+
+private:
+    struct Entry {
+        qint64 lastSent = -1;
+        qint64 lastSubmit = -1;
+        qint64 due = -1;
+        NetworkPacket packet;
+
+        bool isPending() const { return due >= 0; }
+    };
+
+    void sendDue();
+    void prune();
+    void schedule();
+
+    QHash<QString, Entry> m_entries;
+    QTimer m_timer;
+    QTimer m_pruneTimer;
+    QElapsedTimer m_elapsed;
+    Clock m_clock;
+    int m_coalesceWindow = 250;
+    int m_minInterval = 1000;
+    int m_forgetAfter = 60 * 60 * 1000;
+
+    quint64 m_sentPackets = 0;
+    quint64 m_droppedPackets = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // PACKETTHROTTLE_H
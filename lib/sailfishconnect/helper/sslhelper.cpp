@@ -18,6 +18,7 @@
 #include "sslhelper.h"
 
 #include <openssl/bn.h>
+#include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>
 #include <openssl/err.h>
@@ -54,6 +55,7 @@ using BigNumPtr = std::unique_ptr<BIGNUM, BigNumDeleter>;
 
 SSL_PTR(X509, X509)
 SSL_PTR(Rsa, RSA)
+SSL_PTR(EcKey, EC_KEY)
 SSL_PTR(Bio, BIO)
 SSL_PTR(EvpPkey, EVP_PKEY)
 
@@ -107,6 +109,29 @@ QSslKey KeyGenerator::generateRsa(int bits)
                 QSsl::Rsa, QSsl::Pem, QSsl::PrivateKey);
 }
 
+QSslKey KeyGenerator::generateEc()
+{
+    EcKeyPtr ec(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+    if (!ec) {
+        return QSslKey();
+    }
+    // peers only understand named curves
+    EC_KEY_set_asn1_flag(ec.get(), OPENSSL_EC_NAMED_CURVE);
+
+    bool success = EC_KEY_generate_key(ec.get());
+    if (!success) {
+        return QSslKey();
+    }
+
+    BioPtr memIo(BIO_new(BIO_s_mem()));
+    PEM_write_bio_ECPrivateKey(
+                memIo.get(), ec.get(), nullptr,
+                nullptr, 0, nullptr, nullptr);
+
+    return QSslKey(
+                getByteArray(memIo.get()),
+                QSsl::Ec, QSsl::Pem, QSsl::PrivateKey);
+}
 
 static void addInfoEntry(X509_NAME* name, int nid, const QString &val)
 {
@@ -173,7 +198,7 @@ QSslCertificate CertificateBuilder::selfSigned(const QSslKey &key) const
     X509_set_issuer_name(cert.get(), name);
 
     // sign
-    int bytes = X509_sign(cert.get(), pkey.get(), EVP_sha1());
+    int bytes = X509_sign(cert.get(), pkey.get(), EVP_sha256());
     if (bytes == 0) {
         qCWarning(logger) << "certificate signing failed (X509_sign)";
         return QSslCertificate();
@@ -32,6 +32,11 @@ struct KeyGenerator {
     KeyGenerator() = delete;
 
     static QSslKey generateRsa(int bits);
+
+    /**
+     * Generates an ECDSA key on the NIST P-256 curve
+     */
+    static QSslKey generateEc();
 };
 
 
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "tracing.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+
+#include "../corelogging.h"
+
+namespace SailfishConnect {
+namespace Tracing {
+
+namespace {
+
+struct Event {
+    const char* name;
+    qint64 start;
+    qint64 duration;
+    quintptr threadId;
+};
+
+struct Trace {
+    QMutex mutex;
+    QVector<Event> events;
+    QElapsedTimer timer;
+
+    Trace()
+    {
+        timer.start();
+    }
+};
+
+Trace& trace()
+{
+    static Trace instance;
+    return instance;
+}
+
+QByteArray escaped(const char* name)
+{
+    QByteArray result(name);
+    result.replace('\\', "\\\\");
+    result.replace('"', "\\\"");
+    return result;
+}
+
+QByteArray microseconds(qint64 ns)
+{
+    return QByteArray::number(double(ns) / 1000., 'f', 3);
+}
+
+} // namespace
+
+qint64 now()
+{
+    return trace().timer.nsecsElapsed();
+}
+
+void addEvent(const char* name, qint64 start, qint64 duration)
+{
+    Trace& t = trace();
+    const quintptr threadId = quintptr(QThread::currentThreadId());
+
+    QMutexLocker lock(&t.mutex);
+    if (t.events.size() < MAX_EVENTS) {
+        t.events.append(Event { name, start, duration, threadId });
+    }
+}
+
+int eventCount()
+{
+    Trace& t = trace();
+    QMutexLocker lock(&t.mutex);
+    return t.events.size();
+}
+
+void clear()
+{
+    Trace& t = trace();
+    QMutexLocker lock(&t.mutex);
+    t.events.clear();
+}
+
+bool writeTrace(const QString& path)
+{
+    Trace& t = trace();
+    QVector<Event> events;
+    {
+        QMutexLocker lock(&t.mutex);
+        events = t.events;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(coreLogger) << "Could not write trace to" << path;
+        return false;
+    }
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (int i = 0; i < events.size(); ++i) {
+        const Event& event = events[i];
+        if (i != 0)
+            json += ",\n";
+        json += "{\"name\":\"" + escaped(event.name)
+                + "\",\"ph\":\"X\",\"ts\":" + microseconds(event.start)
+                + ",\"dur\":" + microseconds(event.duration)
+                + ",\"pid\":" + pid
+                + ",\"tid\":" + QByteArray::number(quint64(event.threadId))
+                + "}";
+    }
+    json += "]}\n";
+
+    file.write(json);
+    qCInfo(coreLogger) << "Wrote" << events.size() << "trace events to" << path;
+    return true;
+}
+
+void writeTraceOnQuit(QCoreApplication* app)
+{
+    const QString path = QString::fromLocal8Bit(
+                qgetenv("SAILFISHCONNECT_TRACE_FILE"));
+    if (path.isEmpty())
+        return;
+
+    QObject::connect(app, &QCoreApplication::aboutToQuit, [path]() {
+        writeTrace(path);
+    });
+}
+
+} // namespace Tracing
+} // namespace SailfishConnect
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QtGlobal>
+#include <QString>
+
+class QCoreApplication;
+
+namespace SailfishConnect {
+
+/**
+ * Records the duration of named phases and writes them in the Chrome trace
+ * event format, which can be opened with chrome://tracing or Perfetto.
+ *
+ * Use SC_TRACE_SCOPE instead of the functions directly, it is compiled out
+ * unless SAILFISHCONNECT_TRACING is defined (qmake CONFIG+=tracing).
+ */
+namespace Tracing {
+
+/**
+ * Maximal number of recorded events, later events are dropped
+ */
+static const int MAX_EVENTS = 1 << 20;
+
+/**
+ * Nanoseconds since the first traced event
+ */
+qint64 now();
+
+/**
+ * @param name string literal, it is not copied
+ */
+void addEvent(const char* name, qint64 start, qint64 duration);
+
+int eventCount();
+void clear();
+
+bool writeTrace(const QString& path);
+
+/**
+ * Writes the trace to the file in SAILFISHCONNECT_TRACE_FILE when @p app
+ * is about to quit. Does nothing if the variable is not set.
+ */
+void writeTraceOnQuit(QCoreApplication* app);
+
+} // namespace Tracing
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name)
+        : m_name(name), m_start(Tracing::now())
+    { }
+
+    ~TraceScope()
+    {
+        Tracing::addEvent(m_name, m_start, Tracing::now() - m_start);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    qint64 m_start;
+};
+
+} // namespace SailfishConnect
+
+#define SC_TRACE_CONCAT_(a, b) a##b
+#define SC_TRACE_CONCAT(a, b) SC_TRACE_CONCAT_(a, b)
+
+#ifdef SAILFISHCONNECT_TRACING
+#define SC_TRACE_SCOPE(name) \
+    ::SailfishConnect::TraceScope SC_TRACE_CONCAT(scTraceScope, __LINE__)(name)
+#else
+#define SC_TRACE_SCOPE(name) do { } while (false)
+#endif
+
+#endif // TRACING_H
@@ -0,0 +1,646 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "configstore.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QRunnable>
+#include <QSet>
+#include <QSettings>
+#include <QThreadPool>
+#include <QWeakPointer>
+
+#include "../corelogging.h"
+#include "../helper/cpphelper.h"
+
+namespace SailfishConnect {
+
+/**
+ * Content of a store handed to a write task.
+ */
+struct ConfigSnapshot {
+    QMap<QString, QVariant> values;
+    // keys set or removed since the file was loaded
+    QSet<QString> changedKeys;
+    quint64 generation = 0;
+    // state of the file the values are based on
+    QDateTime baseModified;
+    qint64 baseSize = -1;
+};
+
+/**
+ * File side of a store. Shared with the write tasks, so it outlives the
+ * store until the last write finished.
+ */
+struct ConfigStoreFile {
+    explicit ConfigStoreFile(const QString& path) : path(path) { }
+
+    const QString path;
+
+    // serializes writes, only held by writers
+    QMutex writeMutex;
+
+    // protects the members below, never held during file I/O
+    QMutex mutex;
+    quint64 writtenGeneration = 0;
+    QDateTime writtenModified;
+    qint64 writtenSize = -1;
+    quint64 conflicts = 0;
+
+    void write(const ConfigSnapshot& snapshot);
+
+private:
+    bool changedExternally(const ConfigSnapshot& snapshot);
+    static QMap<QString, QVariant> merge(
+            const QString& path, const ConfigSnapshot& snapshot);
+    static void syncDirectory(const QString& path);
+};
+
+bool ConfigStoreFile::changedExternally(const ConfigSnapshot& snapshot)
+{
+    const QFileInfo info(path);
+    const qint64 size = info.exists() ? info.size() : -1;
+    const QDateTime modified = info.lastModified();
+    if (size == snapshot.baseSize && modified == snapshot.baseModified)
+        return false;
+
+    QMutexLocker lock(&mutex);
+    return size != writtenSize || modified != writtenModified;
+}
+
+// Content of the file with the changes of the store applied
+QMap<QString, QVariant> ConfigStoreFile::merge(
+        const QString& path, const ConfigSnapshot& snapshot)
+{
+    QMap<QString, QVariant> result;
+    QSettings settings(path, QSettings::IniFormat);
+    const QStringList keys = settings.allKeys();
+    for (const QString& key : keys) {
+        result.insert(key, settings.value(key));
+    }
+
+    for (const QString& key : snapshot.changedKeys) {
+        auto iter = snapshot.values.constFind(key);
+        if (iter != snapshot.values.constEnd()) {
+            result.insert(key, iter.value());
+        } else {
+            result.remove(key);
+        }
+    }
+    return result;
+}
+
+void ConfigStoreFile::syncDirectory(const QString& path)
+{
+    const QByteArray directory =
+            QFile::encodeName(QFileInfo(path).absolutePath());
+    const int fd = ::open(directory.constData(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+void ConfigStoreFile::write(const ConfigSnapshot& snapshot)
+{
+    QMutexLocker writeLock(&writeMutex);
+    {
+        QMutexLocker lock(&mutex);
+        if (snapshot.generation <= writtenGeneration) {
+            // a newer snapshot was written already
+            return;
+        }
+    }
+
+    // Someone else edited the file since it was loaded. Keep their
+    // changes except for the keys changed here.
+    const bool conflict = changedExternally(snapshot);
+    QMap<QString, QVariant> merged;
+    if (conflict) {
+        qCWarning(coreLogger)
+                << "Config" << path << "was changed externally,"
+                << "merging changes";
+        merged = merge(path, snapshot);
+    }
+    const QMap<QString, QVariant>& values = conflict ? merged : snapshot.values;
+
+    const QString tempPath = path + QStringLiteral(".tmp");
+    {
+        QFile::remove(tempPath);
+        QSettings settings(tempPath, QSettings::IniFormat);
+        for (auto iter = values.constBegin(); iter != values.constEnd(); ++iter) {
+            settings.setValue(iter.key(), iter.value());
+        }
+        settings.sync();
+        if (settings.status() != QSettings::NoError) {
+            qCWarning(coreLogger) << "Could not write config" << tempPath;
+            return;
+        }
+    }
+
+    QFile tempFile(tempPath);
+    if (tempFile.open(QIODevice::ReadOnly)) {
+        ::fsync(tempFile.handle());
+        tempFile.close();
+    }
+
+    // The rename keeps modification time and size. Record them before, so
+    // the store sees its own file when the watcher reports the rename.
+    const QFileInfo info(tempPath);
+    {
+        QMutexLocker lock(&mutex);
+        if (conflict) {
+            // not our content alone, so the store has to reload it
+            writtenModified = QDateTime();
+            writtenSize = -1;
+        } else {
+            writtenModified = info.lastModified();
+            writtenSize = info.size();
+        }
+    }
+
+    if (std::rename(QFile::encodeName(tempPath).constData(),
+                    QFile::encodeName(path).constData()) != 0) {
+        qCWarning(coreLogger) << "Could not replace config" << path;
+        return;
+    }
+    syncDirectory(path);
+
+    QMutexLocker lock(&mutex);
+    writtenGeneration = snapshot.generation;
+    if (conflict) {
+        conflicts += 1;
+    }
+}
+
+/**
+ * Watches the files of all stores with a single QFileSystemWatcher. Each
+ * watcher is an inotify instance and there are only 128 per user by
+ * default, but there is a store for every plugin of every device.
+ *
+ * Exists as long as there are stores.
+ */
+class ConfigStoreWatcher : public QObject
+{
+public:
+    static void add(ConfigStore* store);
+    static void remove(ConfigStore* store);
+    static void watchFile(const QString& path);
+
+private:
+    ConfigStoreWatcher();
+
+    void directoryChanged(const QString& directory);
+    void fileChanged(const QString& path);
+    void dispatch(const QList<ConfigStore*>& stores);
+
+    static ConfigStoreWatcher* s_instance;
+
+    // receivers of changed() may destroy stores, even the last one
+    bool m_dispatching = false;
+    bool m_orphaned = false;
+
+    QFileSystemWatcher m_watcher;
+    QMultiHash<QString, ConfigStore*> m_storesByDirectory;
+    QHash<QString, ConfigStore*> m_storesByPath;
+};
+
+ConfigStoreWatcher* ConfigStoreWatcher::s_instance = nullptr;
+
+ConfigStoreWatcher::ConfigStoreWatcher()
+{
+    // The file is replaced on every write, which ends its watch. The
+    // directory watch notices the new file.
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged,
+            this, &ConfigStoreWatcher::fileChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged,
+            this, &ConfigStoreWatcher::directoryChanged);
+}
+
+void ConfigStoreWatcher::add(ConfigStore* store)
+{
+    if (!s_instance) {
+        s_instance = new ConfigStoreWatcher();
+    }
+
+    const QString path = store->fileName();
+    const QString directory = QFileInfo(path).absolutePath();
+    if (!s_instance->m_storesByDirectory.contains(directory)) {
+        s_instance->m_watcher.addPath(directory);
+    }
+    s_instance->m_storesByDirectory.insert(directory, store);
+    s_instance->m_storesByPath.insert(path, store);
+    watchFile(path);
+}
+
+void ConfigStoreWatcher::remove(ConfigStore* store)
+{
+    if (!s_instance)
+        return;
+
+    const QString path = store->fileName();
+    const QString directory = QFileInfo(path).absolutePath();
+    s_instance->m_storesByPath.remove(path);
+    s_instance->m_storesByDirectory.remove(directory, store);
+    if (s_instance->m_watcher.files().contains(path)) {
+        s_instance->m_watcher.removePath(path);
+    }
+    if (!s_instance->m_storesByDirectory.contains(directory)) {
+        s_instance->m_watcher.removePath(directory);
+    }
+
+    if (s_instance->m_storesByPath.isEmpty()) {
+        if (s_instance->m_dispatching) {
+            s_instance->m_orphaned = true;
+        } else {
+            delete s_instance;
+        }
+        s_instance = nullptr;
+    }
+}
+
+void ConfigStoreWatcher::watchFile(const QString& path)
+{
+    if (s_instance && !s_instance->m_watcher.files().contains(path)
+            && QFileInfo::exists(path)) {
+        s_instance->m_watcher.addPath(path);
+    }
+}
+
+void ConfigStoreWatcher::directoryChanged(const QString& directory)
+{
+    // Only a stat per store. Temporary files and renames of our own
+    // writes do not change what the stores compare against.
+    dispatch(m_storesByDirectory.values(directory));
+}
+
+void ConfigStoreWatcher::fileChanged(const QString& path)
+{
+    ConfigStore* store = m_storesByPath.value(path);
+    if (store) {
+        dispatch({ store });
+    }
+}
+
+void ConfigStoreWatcher::dispatch(const QList<ConfigStore*>& stores)
+{
+    QList<QPointer<ConfigStore>> guarded;
+    for (ConfigStore* store : stores) {
+        guarded.append(store);
+    }
+
+    const bool wasDispatching = m_dispatching;
+    m_dispatching = true;
+    for (const QPointer<ConfigStore>& store : asConst(guarded)) {
+        if (store) {
+            store->fileChanged();
+        }
+    }
+    m_dispatching = wasDispatching;
+
+    if (m_orphaned && !m_dispatching) {
+        // still inside a signal of m_watcher
+        deleteLater();
+    }
+}
+
+namespace {
+
+class ConfigWriteTask : public QRunnable
+{
+public:
+    ConfigWriteTask(
+            const QSharedPointer<ConfigStoreFile>& file,
+            const ConfigSnapshot& snapshot)
+        : m_file(file), m_snapshot(snapshot)
+    { }
+
+    void run() override
+    {
+        m_file->write(m_snapshot);
+    }
+
+private:
+    QSharedPointer<ConfigStoreFile> m_file;
+    ConfigSnapshot m_snapshot;
+};
+
+QHash<QString, QWeakPointer<ConfigStore>>& registry()
+{
+    static QHash<QString, QWeakPointer<ConfigStore>> stores;
+    return stores;
+}
+
+QString arrayKey(const QString& key, int index)
+{
+    return key + QLatin1Char('/') + QString::number(index + 1)
+            + QStringLiteral("/value");
+}
+
+} // namespace
+
+QSharedPointer<ConfigStore> ConfigStore::forFile(const QString& path)
+{
+    const QString canonicalPath =
+            QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+
+    QSharedPointer<ConfigStore> store = registry().value(canonicalPath);
+    if (!store) {
+        store = QSharedPointer<ConfigStore>(new ConfigStore(canonicalPath));
+        registry().insert(canonicalPath, store);
+    }
+    return store;
+}
+
+void ConfigStore::flushAll()
+{
+    const auto stores = registry().values();
+    for (const QWeakPointer<ConfigStore>& weakStore : stores) {
+        QSharedPointer<ConfigStore> store = weakStore;
+        if (store) {
+            store->flush();
+        }
+    }
+}
+
+ConfigStore::ConfigStore(const QString& path)
+    : m_file(new ConfigStoreFile(path))
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(FLUSH_DELAY);
+    connect(&m_flushTimer, &QTimer::timeout,
+            this, &ConfigStore::scheduleWrite);
+
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(),
+                &QCoreApplication::aboutToQuit,
+                this, &ConfigStore::flush);
+    }
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    load();
+
+    ConfigStoreWatcher::add(this);
+}
+
+ConfigStore::~ConfigStore()
+{
+    flush();
+    ConfigStoreWatcher::remove(this);
+
+    auto& stores = registry();
+    auto iter = stores.find(m_file->path);
+    if (iter != stores.end() && !iter.value()) {
+        stores.erase(iter);
+    }
+}
+
+QString ConfigStore::fileName() const
+{
+    return m_file->path;
+}
+
+void ConfigStore::load()
+{
+    const QFileInfo info(m_file->path);
+    m_loadedModified = info.lastModified();
+    m_loadedSize = info.exists() ? info.size() : -1;
+
+    m_values.clear();
+    m_changedKeys.clear();
+    QSettings settings(m_file->path, QSettings::IniFormat);
+    const QStringList keys = settings.allKeys();
+    for (const QString& key : keys) {
+        m_values.insert(key, settings.value(key));
+    }
+}
+
+void ConfigStore::reloadIfChanged()
+{
+    forgetWrittenChanges();
+
+    // pending changes would overwrite the file anyway
+    if (m_dirty)
+        return;
+
+    const QFileInfo info(m_file->path);
+    const qint64 size = info.exists() ? info.size() : -1;
+    const QDateTime modified = info.lastModified();
+    if (size == m_loadedSize && modified == m_loadedModified)
+        return;
+
+    {
+        // our own write is no change
+        QMutexLocker lock(&m_file->mutex);
+        if (size == m_file->writtenSize
+                && modified == m_file->writtenModified) {
+            m_loadedSize = size;
+            m_loadedModified = modified;
+            return;
+        }
+    }
+
+    load();
+    m_reloads += 1;
+    Q_EMIT changed();
+}
+
+void ConfigStore::fileChanged()
+{
+    ConfigStoreWatcher::watchFile(m_file->path);
+    reloadIfChanged();
+}
+
+QVariant ConfigStore::value(
+        const QString& key, const QVariant& defaultValue) const
+{
+    return m_values.value(key, defaultValue);
+}
+
+bool ConfigStore::contains(const QString& key) const
+{
+    return m_values.contains(key);
+}
+
+void ConfigStore::setValue(const QString& key, const QVariant& value)
+{
+    auto iter = m_values.find(key);
+    if (iter != m_values.end() && iter.value() == value)
+        return;
+
+    m_values.insert(key, value);
+    markDirty();
+    m_changedKeys.insert(key, m_generation);
+}
+
+void ConfigStore::remove(const QString& key)
+{
+    const QString groupPrefix = key + QLatin1Char('/');
+
+    QStringList removed;
+    if (m_values.remove(key) > 0) {
+        removed.append(key);
+    }
+    auto iter = m_values.lowerBound(groupPrefix);
+    while (iter != m_values.end() && iter.key().startsWith(groupPrefix)) {
+        removed.append(iter.key());
+        iter = m_values.erase(iter);
+    }
+
+    if (removed.isEmpty())
+        return;
+
+    markDirty();
+    for (const QString& removedKey : asConst(removed)) {
+        m_changedKeys.insert(removedKey, m_generation);
+    }
+}
+
+QStringList ConfigStore::childGroups(const QString& group) const
+{
+    const QString prefix = group.isEmpty()
+            ? QString() : group + QLatin1Char('/');
+
+    QStringList result;
+    auto iter = m_values.lowerBound(prefix);
+    for (; iter != m_values.end() && iter.key().startsWith(prefix); ++iter) {
+        const int separator = iter.key().indexOf(
+                    QLatin1Char('/'), prefix.size());
+        if (separator < 0)
+            continue;
+
+        const QString childGroup = iter.key().mid(
+                    prefix.size(), separator - prefix.size());
+        // keys are sorted, so equal groups are adjacent
+        if (result.isEmpty() || result.last() != childGroup) {
+            result.append(childGroup);
+        }
+    }
+    return result;
+}
+
+QVariantList ConfigStore::list(const QString& key) const
+{
+    const int size = value(key + QStringLiteral("/size")).toInt();
+
+    QVariantList result;
+    result.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        result.append(value(arrayKey(key, i)));
+    }
+    return result;
+}
+
+void ConfigStore::setList(const QString& key, const QVariantList& list)
+{
+    if (this->list(key) == list && contains(key + QStringLiteral("/size")))
+        return;
+
+    remove(key);
+    setValue(key + QStringLiteral("/size"), list.size());
+    for (int i = 0; i < list.size(); ++i) {
+        setValue(arrayKey(key, i), list.at(i));
+    }
+}
+
+void ConfigStore::markDirty()
+{
+    m_dirty = true;
+    m_generation += 1;
+    m_changes += 1;
+
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void ConfigStore::scheduleWrite()
+{
+    if (!m_dirty)
+        return;
+
+    m_dirty = false;
+    m_flushes += 1;
+    forgetWrittenChanges();
+    QThreadPool::globalInstance()->start(
+                new ConfigWriteTask(m_file, snapshot()));
+}
+
+// Changes that reached the file must not be applied over later external
+// edits of the same keys.
+void ConfigStore::forgetWrittenChanges()
+{
+    quint64 writtenGeneration;
+    {
+        QMutexLocker lock(&m_file->mutex);
+        writtenGeneration = m_file->writtenGeneration;
+    }
+
+    for (auto iter = m_changedKeys.begin(); iter != m_changedKeys.end();) {
+        if (iter.value() <= writtenGeneration) {
+            iter = m_changedKeys.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+ConfigSnapshot ConfigStore::snapshot() const
+{
+    ConfigSnapshot result;
+    result.values = m_values;
+    result.changedKeys = m_changedKeys.keys().toSet();
+    result.generation = m_generation;
+    result.baseModified = m_loadedModified;
+    result.baseSize = m_loadedSize;
+    return result;
+}
+
+quint64 ConfigStore::conflictCount() const
+{
+    QMutexLocker lock(&m_file->mutex);
+    return m_file->conflicts;
+}
+
+void ConfigStore::flush()
+{
+    m_flushTimer.stop();
+    if (m_dirty) {
+        m_dirty = false;
+        m_flushes += 1;
+    }
+
+    // Also waits for a write in progress. A queued write of the same
+    // generation will find nothing to do.
+    forgetWrittenChanges();
+    m_file->write(snapshot());
+    forgetWrittenChanges();
+}
+
+} // namespace SailfishConnect
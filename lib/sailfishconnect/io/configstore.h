@@ -0,0 +1,144 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONFIGSTORE_H
+#define CONFIGSTORE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QTimer>
+#include <QVariant>
+
+namespace SailfishConnect {
+
+struct ConfigStoreFile;
+struct ConfigSnapshot;
+
+/**
+ * In-memory key-value store backed by an INI file.
+ *
+ * Reads are served from memory. Changes are collected and written back
+ * after FLUSH_DELAY on a worker thread. A write goes to a temporary file
+ * that is synced to disk and then renamed over the config file, so a
+ * crash leaves either the old or the new content, never a truncated file.
+ * If someone else edited the file since it was loaded, the write keeps
+ * those edits for all keys not changed in this store.
+ *
+ * The file stays compatible with QSettings::IniFormat. Keys use "/" as
+ * group separator. Lists use the layout of QSettings::beginWriteArray():
+ * "key/size" and "key/1/value", "key/2/value", ...
+ *
+ * The file is watched, so changes by other processes are picked up
+ * without polling and announced with changed(). All stores share one
+ * file system watcher, because inotify instances are limited per user.
+ *
+ * All stores for the same path share one instance, see forFile(). A
+ * store must only be used from the main thread.
+ */
+class ConfigStore : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int FLUSH_DELAY = 500;
+
+    static QSharedPointer<ConfigStore> forFile(const QString& path);
+
+    /**
+     * Writes all changes of all stores synchronously, e.g. at shutdown.
+     */
+    static void flushAll();
+
+    ~ConfigStore() override;
+
+    QString fileName() const;
+
+    QVariant value(
+            const QString& key, const QVariant& defaultValue = QVariant()) const;
+    bool contains(const QString& key) const;
+    void setValue(const QString& key, const QVariant& value);
+
+    /**
+     * Removes @p key and all keys in the group @p key.
+     */
+    void remove(const QString& key);
+
+    QStringList childGroups(const QString& group = QString()) const;
+
+    QVariantList list(const QString& key) const;
+    void setList(const QString& key, const QVariantList& list);
+
+    /**
+     * Re-read the file if it was changed by someone else. Pending changes
+     * take precedence over the file content.
+     *
+     * Called automatically when the file changes.
+     */
+    void reloadIfChanged();
+
+    bool hasPendingChanges() const { return m_dirty; }
+
+    /**
+     * Write pending changes now and wait until they reached the disk.
+     */
+    void flush();
+
+    quint64 changeCount() const { return m_changes; }
+    quint64 flushCount() const { return m_flushes; }
+    quint64 reloadCount() const { return m_reloads; }
+    // writes that had to merge external edits
+    quint64 conflictCount() const;
+
+signals:
+    /**
+     * The file was changed by someone else and the values were reloaded.
+     */
+    void changed();
+
+private:
+    friend class ConfigStoreWatcher;
+
+    explicit ConfigStore(const QString& path);
+
+    void load();
+    void markDirty();
+    void scheduleWrite();
+    void fileChanged();
+    void forgetWrittenChanges();
+    ConfigSnapshot snapshot() const;
+
+    QSharedPointer<ConfigStoreFile> m_file;
+    QMap<QString, QVariant> m_values;
+    // changed keys with the generation of their last change
+    QHash<QString, quint64> m_changedKeys;
+    QDateTime m_loadedModified;
+    qint64 m_loadedSize = -1;
+    QTimer m_flushTimer;
+    bool m_dirty = false;
+    quint64 m_generation = 0;
+    quint64 m_changes = 0;
+    quint64 m_flushes = 0;
+    quint64 m_reloads = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // CONFIGSTORE_H
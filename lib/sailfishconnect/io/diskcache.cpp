@@ -0,0 +1,478 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diskcache.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "../corelogging.h"
+#include "../helper/cpphelper.h"
+
+namespace SailfishConnect {
+
+namespace {
+
+const quint32 INDEX_MAGIC = 0x53434443; // "SCDC"
+const quint32 INDEX_VERSION = 3;
+
+qint64 now()
+{
+    return QDateTime::currentMSecsSinceEpoch();
+}
+
+} // namespace
+
+DiskCache::DiskCache(
+        const QString& directory, qint64 maxSize, QObject* parent)
+    : QObject(parent)
+    , m_directory(QDir::cleanPath(QFileInfo(directory).absoluteFilePath()))
+    , m_maxSize(maxSize)
+{
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SAVE_DELAY);
+    connect(&m_saveTimer, &QTimer::timeout, this, &DiskCache::save);
+
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(),
+                &QCoreApplication::aboutToQuit,
+                this, &DiskCache::save);
+    }
+
+    if (!QDir().mkpath(m_directory)) {
+        qCCritical(coreLogger) << "Failed to create cache dir" << m_directory;
+    }
+
+    load();
+    shrink();
+}
+
+DiskCache::~DiskCache()
+{
+    save();
+    setGroup(nullptr);
+}
+
+QString DiskCache::indexPath() const
+{
+    return m_directory + QStringLiteral(".index");
+}
+
+QString DiskCache::lookup(const QString& key)
+{
+    auto iter = m_entries.find(key);
+    if (iter == m_entries.end() || iter->failed) {
+        ++m_misses;
+        return QString();
+    }
+
+    ++m_hits;
+    touch(key, *iter);
+    return m_directory + QLatin1Char('/') + iter->fileName;
+}
+
+bool DiskCache::contains(const QString& key) const
+{
+    auto iter = m_entries.constFind(key);
+    return iter != m_entries.constEnd() && !iter->failed;
+}
+
+QString DiskCache::filePath(const QString& key) const
+{
+    auto iter = m_entries.constFind(key);
+    if (iter == m_entries.constEnd() || iter->failed)
+        return QString();
+
+    return m_directory + QLatin1Char('/') + iter->fileName;
+}
+
+QStringList DiskCache::keys() const
+{
+    QStringList result;
+    result.reserve(m_lru.size());
+    for (const QString& key : m_lru) {
+        result.append(key);
+    }
+    return result;
+}
+
+bool DiskCache::hasFailed(const QString& key) const
+{
+    auto iter = m_entries.constFind(key);
+    return iter != m_entries.constEnd() && iter->failed
+            && now() - iter->lastAccess < m_failureTtl;
+}
+
+void DiskCache::insert(
+        const QString& key, const QString& fileName, qint64 size,
+        const QByteArray& metadata)
+{
+    auto iter = m_entries.constFind(key);
+    if (iter != m_entries.constEnd()) {
+        // keep the new file when it replaces the old one
+        removeEntry(key, iter->fileName != fileName);
+    }
+
+    Entry entry;
+    entry.fileName = fileName;
+    entry.size = size;
+    entry.lastAccess = nextAccessTime();
+    entry.metadata = metadata;
+    setEntry(key, entry);
+
+    shrink();
+    if (m_group) {
+        m_group->shrink();
+    }
+}
+
+QByteArray DiskCache::metadata(const QString& key) const
+{
+    auto iter = m_entries.constFind(key);
+    return iter != m_entries.constEnd() ? iter->metadata : QByteArray();
+}
+
+void DiskCache::setMetadata(const QString& key, const QByteArray& metadata)
+{
+    auto iter = m_entries.find(key);
+    if (iter == m_entries.end())
+        return;
+
+    iter->metadata = metadata;
+    markDirty();
+}
+
+void DiskCache::markFailed(const QString& key)
+{
+    removeEntry(key, true);
+
+    Entry entry;
+    entry.failed = true;
+    entry.lastAccess = nextAccessTime();
+    setEntry(key, entry);
+}
+
+void DiskCache::remove(const QString& key)
+{
+    removeEntry(key, true);
+}
+
+void DiskCache::setMaxSize(qint64 maxSize)
+{
+    m_maxSize = maxSize;
+    shrink();
+}
+
+void DiskCache::setGroup(DiskCacheGroup* group)
+{
+    if (m_group == group)
+        return;
+
+    if (m_group) {
+        m_group->m_caches.removeOne(this);
+    }
+    m_group = group;
+    if (m_group) {
+        m_group->m_caches.append(this);
+        m_group->shrink();
+    }
+}
+
+qint64 DiskCache::oldestAccess() const
+{
+    return m_lru.isEmpty() ? -1 : m_lru.firstKey();
+}
+
+bool DiskCache::evictOldest()
+{
+    if (m_lru.isEmpty())
+        return false;
+
+    const QString key = m_lru.first();
+    qCDebug(coreLogger) << "Evict" << key << "from" << m_directory;
+    removeEntry(key, true);
+    ++m_evictions;
+    return true;
+}
+
+void DiskCache::save()
+{
+    m_saveTimer.stop();
+    if (!m_dirty)
+        return;
+
+    QSaveFile file(indexPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(coreLogger) << "Could not write cache index" << indexPath()
+                              << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << INDEX_MAGIC << INDEX_VERSION
+           << directoryModified() << qint32(m_entries.size());
+    for (auto iter = m_entries.constBegin(); iter != m_entries.constEnd(); ++iter) {
+        stream << iter.key() << iter->fileName << iter->size
+               << iter->lastAccess << iter->failed << iter->metadata;
+    }
+
+    if (!file.commit()) {
+        qCWarning(coreLogger) << "Could not write cache index" << indexPath()
+                              << file.errorString();
+        return;
+    }
+    m_dirty = false;
+}
+
+void DiskCache::load()
+{
+    // files are only added and removed by us after the index was written
+    // unless we were interrupted before the index could be saved
+    bool upToDate = false;
+    if (readIndex(&upToDate) && upToDate) {
+        m_loadedFromIndex = true;
+    } else {
+        scanDirectory();
+        markDirty();
+    }
+
+    // drop expired failures
+    const auto keys = m_entries.keys();
+    for (const QString& key : keys) {
+        const Entry& entry = m_entries[key];
+        if (entry.failed && now() - entry.lastAccess >= m_failureTtl) {
+            removeEntry(key, true);
+        }
+    }
+
+    qCDebug(coreLogger).nospace()
+            << "Loaded cache " << m_directory << " with " << m_entries.size()
+            << " entries (" << m_size << " bytes, "
+            << (m_loadedFromIndex ? "index" : "scan") << ")";
+}
+
+qint64 DiskCache::directoryModified() const
+{
+    const QDateTime modified = QFileInfo(m_directory).lastModified();
+    return modified.isValid() ? modified.toMSecsSinceEpoch() : 0;
+}
+
+bool DiskCache::readIndex(bool* upToDate)
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 indexedModified = 0;
+    qint32 count = 0;
+    stream >> magic >> version;
+    if (version >= 3) {
+        stream >> indexedModified;
+    }
+    stream >> count;
+    if (magic != INDEX_MAGIC || version < 1 || version > INDEX_VERSION
+            || count < 0) {
+        qCWarning(coreLogger) << "Ignoring invalid cache index" << indexPath();
+        return false;
+    }
+
+    QHash<QString, Entry> entries;
+    entries.reserve(count);
+    for (qint32 i = 0; i < count; ++i) {
+        QString key;
+        Entry entry;
+        stream >> key >> entry.fileName >> entry.size
+               >> entry.lastAccess >> entry.failed;
+        if (version >= 2) {
+            stream >> entry.metadata;
+        }
+        entries.insert(key, entry);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(coreLogger) << "Ignoring truncated cache index" << indexPath();
+        return false;
+    }
+
+    for (auto iter = entries.constBegin(); iter != entries.constEnd(); ++iter) {
+        setEntry(iter.key(), iter.value());
+    }
+    m_dirty = false;
+
+    if (upToDate) {
+        // Comparing against the mtime of the index file itself would miss
+        // writes in the same timestamp tick, so the index records the
+        // directory modification time it belongs to.
+        *upToDate = version >= 3 && indexedModified == directoryModified();
+    }
+    return true;
+}
+
+void DiskCache::scanDirectory()
+{
+    // keep access times of a stale index
+    readIndex();
+    const QHash<QString, Entry> indexed = m_entries;
+    m_entries.clear();
+    m_lru.clear();
+    m_size = 0;
+
+    const QFileInfoList files = QDir(m_directory).entryInfoList(
+                QDir::Files | QDir::NoDotAndDotDot);
+    for (const QFileInfo& file : files) {
+        const QString key = file.baseName();
+        const Entry known = indexed.value(key);
+
+        Entry entry;
+        entry.fileName = file.fileName();
+        entry.size = file.size();
+        // empty files mark failed downloads
+        entry.failed = entry.size == 0;
+        if (!entry.failed && known.fileName == entry.fileName) {
+            entry.lastAccess = known.lastAccess;
+            entry.metadata = known.metadata;
+        } else {
+            entry.lastAccess = file.lastModified().toMSecsSinceEpoch();
+        }
+        setEntry(key, entry);
+    }
+
+    for (auto iter = indexed.constBegin(); iter != indexed.constEnd(); ++iter) {
+        if (iter->failed && iter->fileName.isEmpty()
+                && !m_entries.contains(iter.key())) {
+            setEntry(iter.key(), iter.value());
+        }
+    }
+}
+
+void DiskCache::touch(const QString& key, Entry& entry)
+{
+    m_lru.remove(entry.lastAccess, key);
+    entry.lastAccess = nextAccessTime();
+    m_lru.insert(entry.lastAccess, key);
+    markDirty();
+}
+
+void DiskCache::setEntry(const QString& key, const Entry& entry)
+{
+    m_entries.insert(key, entry);
+    m_lastAccess = qMax(m_lastAccess, entry.lastAccess);
+    if (!entry.failed) {
+        m_lru.insert(entry.lastAccess, key);
+        m_size += entry.size;
+    }
+    markDirty();
+
+    if (!entry.failed) {
+        emit inserted(key);
+    }
+}
+
+void DiskCache::removeEntry(const QString& key, bool removeFile)
+{
+    auto iter = m_entries.find(key);
+    if (iter == m_entries.end())
+        return;
+
+    const bool cached = !iter->failed;
+    if (cached) {
+        m_lru.remove(iter->lastAccess, key);
+        m_size -= iter->size;
+    }
+    if (removeFile && !iter->fileName.isEmpty()) {
+        QFile::remove(m_directory + QLatin1Char('/') + iter->fileName);
+    }
+    m_entries.erase(iter);
+    markDirty();
+
+    if (cached) {
+        emit removed(key);
+    }
+}
+
+void DiskCache::shrink()
+{
+    while (m_size > m_maxSize && evictOldest()) { }
+}
+
+qint64 DiskCache::nextAccessTime()
+{
+    m_lastAccess = qMax(now(), m_lastAccess + 1);
+    return m_lastAccess;
+}
+
+void DiskCache::markDirty()
+{
+    m_dirty = true;
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+DiskCacheGroup::~DiskCacheGroup()
+{
+    for (DiskCache* cache : asConst(m_caches)) {
+        cache->m_group = nullptr;
+    }
+}
+
+void DiskCacheGroup::setMaxSize(qint64 maxSize)
+{
+    m_maxSize = maxSize;
+    shrink();
+}
+
+qint64 DiskCacheGroup::size() const
+{
+    qint64 result = 0;
+    for (DiskCache* cache : m_caches) {
+        result += cache->size();
+    }
+    return result;
+}
+
+void DiskCacheGroup::shrink()
+{
+    while (size() > m_maxSize) {
+        DiskCache* oldest = nullptr;
+        for (DiskCache* cache : asConst(m_caches)) {
+            qint64 access = cache->oldestAccess();
+            if (access >= 0
+                    && (oldest == nullptr || access < oldest->oldestAccess())) {
+                oldest = cache;
+            }
+        }
+        if (oldest == nullptr)
+            return;
+
+        oldest->evictOldest();
+    }
+}
+
+} // namespace SailfishConnect
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+namespace SailfishConnect {
+
+class DiskCacheGroup;
+
+/**
+ * Size bounded cache of files in one directory with LRU eviction.
+ *
+ * Entries are files in directory() named by key plus an optional
+ * extension. The index with size and last access time of every entry is
+ * kept in memory and persisted to a compact binary file next to the
+ * directory, so opening the cache does not need to list or stat the
+ * entries. The directory is only scanned again when it was changed after
+ * the index was written, e.g. when the application crashed before
+ * saving the index.
+ *
+ * Failed fetches are remembered for failureTtl() without a file on disk,
+ * so they are retried after the TTL expired.
+ *
+ * Caches can share an additional budget through a DiskCacheGroup. A cache
+ * must only be used from the thread it lives in.
+ */
+class DiskCache : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int SAVE_DELAY = 1000;
+    static constexpr qint64 DEFAULT_FAILURE_TTL = 10 * 60 * 1000;
+
+    DiskCache(
+            const QString& directory, qint64 maxSize,
+            QObject* parent = nullptr);
+    ~DiskCache() override;
+
+    QString directory() const { return m_directory; }
+    QString indexPath() const;
+
+    /**
+     * Absolute path of the file for @p key or a null string, if it is not
+     * cached. Counts as access for LRU and hit/miss statistics.
+     */
+    QString lookup(const QString& key);
+
+    /**
+     * Whether a file for @p key is cached. No access is recorded.
+     */
+    bool contains(const QString& key) const;
+
+    /**
+     * Absolute path of the file for @p key like lookup(), but no access is
+     * recorded.
+     */
+    QString filePath(const QString& key) const;
+
+    /**
+     * Keys of all cached files.
+     */
+    QStringList keys() const;
+
+    /**
+     * Whether the last fetch for @p key failed less than failureTtl() ago.
+     */
+    bool hasFailed(const QString& key) const;
+
+    /**
+     * Add file @p fileName in directory() as entry @p key and evict least
+     * recently used entries until the budgets are met again.
+     *
+     * @param metadata stored with the entry in the index, e.g. validators
+     *     of a HTTP response
+     */
+    void insert(
+            const QString& key, const QString& fileName, qint64 size,
+            const QByteArray& metadata = QByteArray());
+
+    QByteArray metadata(const QString& key) const;
+    void setMetadata(const QString& key, const QByteArray& metadata);
+
+    /**
+     * Remember that fetching @p key failed. A cached file is removed.
+     */
+    void markFailed(const QString& key);
+
+    /**
+     * Remove entry @p key together with its file.
+     */
+    void remove(const QString& key);
+
+    qint64 size() const { return m_size; }
+    int count() const { return m_entries.size(); }
+
+    qint64 maxSize() const { return m_maxSize; }
+    void setMaxSize(qint64 maxSize);
+
+    qint64 failureTtl() const { return m_failureTtl; }
+    void setFailureTtl(qint64 msecs) { m_failureTtl = msecs; }
+
+    /**
+     * Share the budget of @p group with other caches. Pass nullptr to
+     * leave the group.
+     */
+    void setGroup(DiskCacheGroup* group);
+
+    /**
+     * Last access time of the least recently used entry in milliseconds
+     * since epoch or -1 if the cache is empty.
+     */
+    qint64 oldestAccess() const;
+
+    /**
+     * Remove the least recently used entry.
+     *
+     * @return false if the cache was empty
+     */
+    bool evictOldest();
+
+    /**
+     * Write the index now, pending changes are written after SAVE_DELAY
+     * otherwise.
+     */
+    void save();
+
+    quint64 hitCount() const { return m_hits; }
+    quint64 missCount() const { return m_misses; }
+    quint64 evictionCount() const { return m_evictions; }
+    bool loadedFromIndex() const { return m_loadedFromIndex; }
+
+signals:
+    /**
+     * A file for @p key was added to the cache.
+     */
+    void inserted(const QString& key);
+
+    /**
+     * The file for @p key was evicted or removed from the cache.
+     */
+    void removed(const QString& key);
+
+private:
+    struct Entry {
+        QString fileName;
+        qint64 size = 0;
+        qint64 lastAccess = 0;
+        bool failed = false;
+        QByteArray metadata;
+    };
+
+    void load();
+    bool readIndex(bool* upToDate = nullptr);
+    qint64 directoryModified() const;
+    void scanDirectory();
+    void touch(const QString& key, Entry& entry);
+    void setEntry(const QString& key, const Entry& entry);
+    void removeEntry(const QString& key, bool removeFile);
+    void shrink();
+    void markDirty();
+    qint64 nextAccessTime();
+
+    QString m_directory;
+    qint64 m_maxSize;
+    qint64 m_failureTtl = DEFAULT_FAILURE_TTL;
+    DiskCacheGroup* m_group = nullptr;
+
+    QHash<QString, Entry> m_entries;
+    // last access time -> key of cached files, oldest first
+    QMultiMap<qint64, QString> m_lru;
+    qint64 m_size = 0;
+    // keeps access times unique and increasing
+    qint64 m_lastAccess = 0;
+
+    QTimer m_saveTimer;
+    bool m_dirty = false;
+    bool m_loadedFromIndex = false;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    quint64 m_evictions = 0;
+};
+
+/**
+ * Budget shared by several DiskCaches, e.g. the caches of all devices.
+ *
+ * When the caches together exceed maxSize() the globally least recently
+ * used entries are evicted.
+ */
+class DiskCacheGroup
+{
+public:
+    explicit DiskCacheGroup(qint64 maxSize) : m_maxSize(maxSize) { }
+    ~DiskCacheGroup();
+
+    qint64 maxSize() const { return m_maxSize; }
+    void setMaxSize(qint64 maxSize);
+
+    qint64 size() const;
+
+    /**
+     * Evict entries until size() fits into maxSize().
+     */
+    void shrink();
+
+private:
+    friend class DiskCache;
+
+    qint64 m_maxSize;
+    QList<DiskCache*> m_caches;
+};
+
+} // namespace SailfishConnect
+
+#endif // DISKCACHE_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpfetcher.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+
+#include "../corelogging.h"
+
+namespace SailfishConnect {
+
+HttpFetcher::HttpFetcher(QNetworkAccessManager* network, QObject* parent)
+    : QObject(parent)
+    , m_network(network)
+{ }
+
+HttpFetcher::~HttpFetcher()
+{
+    const auto replies = m_running.keys();
+    for (QNetworkReply* reply : replies) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+void HttpFetcher::fetch(const QUrl& url, const Validators& validators)
+{
+    for (Request& request : m_queue) {
+        if (request.url == url) {
+            ++m_coalesced;
+            if (validators.isEmpty()) {
+                // not started yet, so ask for the content right away
+                request.validators = Validators();
+            }
+            return;
+        }
+    }
+
+    for (Request& request : m_running) {
+        if (request.url == url) {
+            ++m_coalesced;
+            if (validators.isEmpty() && !request.validators.isEmpty()) {
+                request.needsContent = true;
+            }
+            return;
+        }
+    }
+
+    Request request;
+    request.url = url;
+    request.validators = validators;
+    m_queue.append(request);
+    startQueued();
+}
+
+bool HttpFetcher::isFetching(const QUrl& url) const
+{
+    for (const Request& request : m_queue) {
+        if (request.url == url)
+            return true;
+    }
+    for (const Request& request : m_running) {
+        if (request.url == url)
+            return true;
+    }
+    return false;
+}
+
+void HttpFetcher::setMaxConcurrent(int maxConcurrent)
+{
+    m_maxConcurrent = maxConcurrent;
+    startQueued();
+}
+
+void HttpFetcher::startQueued()
+{
+    while (m_running.size() < m_maxConcurrent && !m_queue.isEmpty()) {
+        start(m_queue.takeFirst());
+    }
+}
+
+void HttpFetcher::start(const Request& request)
+{
+    QNetworkRequest networkRequest(request.url);
+    networkRequest.setAttribute(
+                QNetworkRequest::FollowRedirectsAttribute, true);
+    networkRequest.setMaximumRedirectsAllowed(MAX_REDIRECTS);
+    if (!request.validators.etag.isEmpty()) {
+        networkRequest.setRawHeader(
+                    "If-None-Match", request.validators.etag);
+    }
+    if (!request.validators.lastModified.isEmpty()) {
+        networkRequest.setRawHeader(
+                    "If-Modified-Since", request.validators.lastModified);
+    }
+
+    QNetworkReply* reply = m_network->get(networkRequest);
+    m_running.insert(reply, request);
+    connect(reply, &QNetworkReply::finished,
+            this, [this, reply]() { replyFinished(reply); });
+
+    auto* deadline = new QTimer(reply);
+    deadline->setSingleShot(true);
+    connect(deadline, &QTimer::timeout,
+            this, [this, reply]() { replyTimedOut(reply); });
+    deadline->start(m_timeout);
+}
+
+void HttpFetcher::replyTimedOut(QNetworkReply* reply)
+{
+    auto iter = m_running.find(reply);
+    if (iter == m_running.end())
+        return;
+
+    qCDebug(coreLogger) << "Fetching" << iter->url << "timed out";
+    iter->timedOut = true;
+    ++m_timeouts;
+    reply->abort();
+}
+
+void HttpFetcher::replyFinished(QNetworkReply* reply)
+{
+    auto iter = m_running.find(reply);
+    if (iter == m_running.end())
+        return;
+
+    Request request = iter.value();
+    m_running.erase(iter);
+    reply->deleteLater();
+
+    Result result;
+    const int status = reply->attribute(
+                QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (request.timedOut) {
+        result.errorString = QStringLiteral("Timed out");
+    } else if (reply->error() != QNetworkReply::NoError) {
+        result.errorString = reply->errorString();
+    } else if (status == 304) {
+        if (request.needsContent) {
+            // a coalesced requester has no cached copy
+            request.validators = Validators();
+            request.needsContent = false;
+            m_queue.prepend(request);
+            startQueued();
+            return;
+        }
+
+        ++m_notModified;
+        result.status = NotModified;
+        result.validators = request.validators;
+    } else if (status == 200) {
+        result.status = Ok;
+        result.data = reply->readAll();
+        result.validators.etag = reply->rawHeader("ETag");
+        result.validators.lastModified = reply->rawHeader("Last-Modified");
+    } else {
+        result.errorString = QStringLiteral("HTTP status %1").arg(status);
+    }
+
+    if (result.status == Failed) {
+        qCDebug(coreLogger) << "Failed to fetch" << request.url
+                            << result.errorString;
+    }
+
+    startQueued();
+    emit finished(request.url, result);
+}
+
+} // namespace SailfishConnect
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPFETCHER_H
+#define HTTPFETCHER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+namespace SailfishConnect {
+
+/**
+ * Downloads small files like album art over HTTP.
+ *
+ * Requests for an url that is already queued or running are coalesced,
+ * all requesters get the same finished() signal. At most maxConcurrent()
+ * requests run at the same time, the others wait in a queue. A request
+ * is aborted when it did not finish after timeout() milliseconds.
+ *
+ * Responses carry their validators (ETag and Last-Modified). Passed to
+ * fetch() again, the server can answer with NotModified instead of
+ * sending the content again.
+ */
+class HttpFetcher : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int DEFAULT_TIMEOUT = 20000;
+    static constexpr int DEFAULT_MAX_CONCURRENT = 4;
+    static constexpr int MAX_REDIRECTS = 10;
+
+    struct Validators {
+        QByteArray etag;
+        QByteArray lastModified;
+
+        bool isEmpty() const { return etag.isEmpty() && lastModified.isEmpty(); }
+    };
+
+    enum Status { Ok, NotModified, Failed };
+
+    struct Result {
+        Status status = Failed;
+        QByteArray data;
+        Validators validators;
+        QString errorString;
+    };
+
+    explicit HttpFetcher(
+            QNetworkAccessManager* network, QObject* parent = nullptr);
+    ~HttpFetcher() override;
+
+    /**
+     * Fetch @p url, finished() is emitted in any case.
+     *
+     * With @p validators of a cached copy the result can be NotModified.
+     */
+    void fetch(const QUrl& url, const Validators& validators = Validators());
+
+    bool isFetching(const QUrl& url) const;
+
+    int timeout() const { return m_timeout; }
+    void setTimeout(int msecs) { m_timeout = msecs; }
+
+    int maxConcurrent() const { return m_maxConcurrent; }
+    void setMaxConcurrent(int maxConcurrent);
+
+    int runningCount() const { return m_running.size(); }
+    int queuedCount() const { return m_queue.size(); }
+
+    quint64 coalescedCount() const { return m_coalesced; }
+    quint64 notModifiedCount() const { return m_notModified; }
+    quint64 timeoutCount() const { return m_timeouts; }
+
+signals:
+    void finished(const QUrl& url, const HttpFetcher::Result& result);
+
+private:
+    struct Request {
+        QUrl url;
+        Validators validators;
+        // someone without a cached copy joined a revalidation
+        bool needsContent = false;
+        bool timedOut = false;
+    };
+
+    void startQueued();
+    void start(const Request& request);
+    void replyFinished(QNetworkReply* reply);
+    void replyTimedOut(QNetworkReply* reply);
+
+    QNetworkAccessManager* m_network;
+    int m_timeout = DEFAULT_TIMEOUT;
+    int m_maxConcurrent = DEFAULT_MAX_CONCURRENT;
+
+    QList<Request> m_queue;
+    QHash<QNetworkReply*, Request> m_running;
+
+    quint64 m_coalesced = 0;
+    quint64 m_notModified = 0;
+    quint64 m_timeouts = 0;
+};
+
+} // namespace SailfishConnect
+
+#endif // HTTPFETCHER_H
@@ -29,18 +29,120 @@
 #include <QStandardPaths>
 #include <QCoreApplication>
 #include <QHostInfo>
-#include <QSettings>
+#include <QSet>
 #include <QSslCertificate>
 #include <QSslKey>
+#include <QThread>
 
 #include "corelogging.h"
 #include <sailfishconnect/helper/sslhelper.h>
+#include <sailfishconnect/helper/tracing.h>
+#include <sailfishconnect/io/configstore.h>
 #include "systeminfo.h"
 #include "daemon.h"
 #include "device.h"
 
 using namespace SailfishConnect;
 
+namespace {
+
+struct Credentials {
+    QSslKey privateKey;
+    QSslCertificate certificate;
+    bool keyGenerated = false;
+    QString error;
+    // the configuration is wrong, trying again fails the same way
+    bool permanentError = false;
+};
+
+Credentials generateCredentials(
+        const QString& deviceId, QSsl::KeyAlgorithm algorithm,
+        const QSslKey& privateKey)
+{
+    SC_TRACE_SCOPE("generateCredentials");
+    Credentials result;
+    result.privateKey = privateKey;
+    if (result.privateKey.isNull()) {
+        if (algorithm == QSsl::Ec) {
+            result.privateKey = Ssl::KeyGenerator::generateEc();
+        } else if (algorithm == QSsl::Rsa) {
+            result.privateKey = Ssl::KeyGenerator::generateRsa(2048);
+        } else {
+            result.error = QStringLiteral("unsupported key algorithm");
+            result.permanentError = true;
+            qCCritical(coreLogger) << result.error;
+            return result;
+        }
+        result.keyGenerated = true;
+        if (result.privateKey.isNull()) {
+            result.error = QStringLiteral("generating private key failed");
+            qCCritical(coreLogger) << result.error;
+            return result;
+        }
+    }
+
+    Ssl::CertificateInfo certificateInfo;
+    certificateInfo.insert(Ssl::CommonName, deviceId);
+    certificateInfo.insert(
+        Ssl::Organization, QStringLiteral("Richard Liebscher"));
+    certificateInfo.insert(
+        Ssl::OrganizationalUnit, QStringLiteral("SailfishConnect"));
+
+    QDateTime startTime = QDateTime::currentDateTime().addYears(-1);
+
+    result.certificate = Ssl::CertificateBuilder()
+            .info(certificateInfo)
+            .serialNumber(10)
+            .notBefore(startTime)
+            .notAfter(startTime.addYears(10))
+            .selfSigned(result.privateKey);
+    if (result.certificate.isNull()) {
+        result.error = QStringLiteral("generating certificate failed");
+        qCCritical(coreLogger) << result.error;
+    }
+    return result;
+}
+
+class CertificateGenerator : public QThread
+{
+public:
+    CertificateGenerator(
+            const QString& deviceId, QSsl::KeyAlgorithm algorithm,
+            const QSslKey& privateKey, QObject* parent)
+        : QThread(parent)
+        , m_deviceId(deviceId)
+        , m_algorithm(algorithm)
+        , m_privateKey(privateKey)
+    { }
+
+    // only valid after the thread finished
+    Credentials credentials;
+
+protected:
+    void run() override
+    {
+        credentials = generateCredentials(
+                    m_deviceId, m_algorithm, m_privateKey);
+    }
+
+private:
+    QString m_deviceId;
+    QSsl::KeyAlgorithm m_algorithm;
+    QSslKey m_privateKey;
+};
+
+QSslKey readPrivateKey(QFile* keyFile)
+{
+    const QByteArray pem = keyFile->readAll();
+    QSslKey key(pem, QSsl::Rsa, QSsl::Pem);
+    if (key.isNull()) {
+        key = QSslKey(pem, QSsl::Ec, QSsl::Pem);
+    }
+    return key;
+}
+
+} // namespace
+
 struct KdeConnectConfigPrivate {
     QDir m_configBaseDir;
 
@@ -49,10 +151,15 @@ struct KdeConnectConfigPrivate {
     QString m_deviceId;
     QString m_name;
 
-    QSettings* m_config;
-    QSettings* m_trustedDevices;
+    QSharedPointer<ConfigStore> m_config;
+    QSharedPointer<ConfigStore> m_trustedDevices;
+
+    // authoritative copy of the groups in m_trustedDevices
+    QSet<QString> m_trustedDeviceIds;
 
     std::unique_ptr<SailfishConnect::SystemInfo> systemInfo;
+
+    CertificateGenerator* m_certificateGenerator = nullptr;
 };
 
 static const QFile::Permissions strictFilePermissions =
@@ -64,19 +171,31 @@ KdeConnectConfig* KdeConnectConfig::instance()
     return Daemon::instance()->config();
 }
 
-KdeConnectConfig::KdeConnectConfig(std::unique_ptr<SailfishConnect::SystemInfo> systemInfo)
+KdeConnectConfig::KdeConnectConfig(
+        std::unique_ptr<SailfishConnect::SystemInfo> systemInfo,
+        CertificateCreation certificateCreation)
     : d(new KdeConnectConfigPrivate)
 {
+    SC_TRACE_SCOPE("KdeConnectConfig::KdeConnectConfig");
     d->systemInfo = std::move(systemInfo);
 
     createBaseConfigDir();
-    d->m_config = new QSettings(configPath(), QSettings::IniFormat);
-    d->m_trustedDevices = new QSettings(
-                trustedDevicesConfigPath(),
-                QSettings::IniFormat);
+    d->m_config = ConfigStore::forFile(configPath());
+    d->m_trustedDevices = ConfigStore::forFile(trustedDevicesConfigPath());
+    d->m_trustedDeviceIds = d->m_trustedDevices->childGroups().toSet();
+    connect(d->m_trustedDevices.data(), &ConfigStore::changed,
+            this, &KdeConnectConfig::reloadTrustedDevices);
 
     createName();
-    createCertificate();
+    createCertificate(certificateCreation);
+}
+
+KdeConnectConfig::~KdeConnectConfig()
+{
+    if (d->m_certificateGenerator) {
+        d->m_certificateGenerator->wait();
+    }
+    delete d;
 }
 
 void KdeConnectConfig::createBaseConfigDir()
@@ -89,36 +208,28 @@ void KdeConnectConfig::createBaseConfigDir()
     QDir().mkpath(d->m_configBaseDir.absolutePath());
 }
 
-void KdeConnectConfig::createCertificate()
+void KdeConnectConfig::createCertificate(
+        CertificateCreation certificateCreation)
 {
+    if (d->m_certificateGenerator) {
+        // already generating, certificateGenerated will report the result
+        return;
+    }
+
+    // forget what was loaded before, the files may be gone by now
+    d->m_privateKey = QSslKey();
+    d->m_certificate = QSslCertificate();
+
     QString keyPath = privateKeyPath();
     QFile keyFile(keyPath);
     if (keyFile.exists() && keyFile.open(QIODevice::ReadOnly)) {
-        qCInfo(coreLogger) << "using exitsing RSA key at" << keyPath;
-        d->m_privateKey = QSslKey(&keyFile, QSsl::Rsa, QSsl::Pem);
+        qCInfo(coreLogger) << "using exitsing private key at" << keyPath;
+        d->m_privateKey = readPrivateKey(&keyFile);
         if (d->m_privateKey.isNull()) {
             qCCritical(coreLogger) << "reading private key failed";
         }
         keyFile.close();
     }
-    if (d->m_privateKey.isNull()) {
-        qCInfo(coreLogger) << "generate private RSA key to" << keyPath;
-
-        d->m_privateKey = Ssl::KeyGenerator::generateRsa(2048);
-        if (d->m_privateKey.isNull()) {
-            qCCritical(coreLogger) << "generating private key failed";
-            return;
-        }
-
-        if (!keyFile.open(QIODevice::ReadWrite | QIODevice::Truncate))  {
-            qCCritical(coreLogger)
-                    << "Could not store private key file:" << keyPath;
-        } else {
-            keyFile.setPermissions(strictFilePermissions);
-            keyFile.write(d->m_privateKey.toPem());
-            keyFile.close();
-        }
-    }
 
     QString certPath = certificatePath();
     QFile certFile(certPath);
@@ -127,47 +238,120 @@ void KdeConnectConfig::createCertificate()
         if (d->m_certificate.isNull()) {
             qCCritical(coreLogger) << "reading certificate failed";
         }
-        createDeviceId();
         certFile.close();
     }
-    if (d->m_certificate.isNull()) {
-        // No certificate yet. Probably first run. Let's generate one!
+    createDeviceId();
 
-        qCInfo(coreLogger) << "generate certificate to" << certPath;
+    if (!d->m_privateKey.isNull() && !d->m_certificate.isNull()) {
+        checkPrivateKeyPermissions();
+        return;
+    }
 
-        createDeviceId();
+    // No certificate yet. Probably first run. Let's generate one!
+    // A certificate for another key is useless, but we keep its device id.
+    d->m_certificate = QSslCertificate();
+
+    // QSsl::Opaque marks an unknown algorithm, generating fails then
+    const QString algorithmName =
+            d->m_config->value(QStringLiteral("keyAlgorithm")).toString();
+    QSsl::KeyAlgorithm algorithm = QSsl::Opaque;
+    if (algorithmName.isEmpty() || algorithmName == QLatin1String("rsa")) {
+        algorithm = QSsl::Rsa;
+    } else if (algorithmName == QLatin1String("ec")) {
+        algorithm = QSsl::Ec;
+    }
 
-        Ssl::CertificateInfo certificateInfo;
-        certificateInfo.insert(Ssl::CommonName, d->m_deviceId);
-        certificateInfo.insert(
-            Ssl::Organization, QStringLiteral("Richard Liebscher"));
-        certificateInfo.insert(
-            Ssl::OrganizationalUnit, QStringLiteral("SailfishConnect"));
+    if (certificateCreation == CreateInBackground) {
+        qCInfo(coreLogger) << "generate certificate in background";
 
-        QDateTime startTime = QDateTime::currentDateTime().addYears(-1);
+        d->m_certificateGenerator = new CertificateGenerator(
+                    d->m_deviceId, algorithm, d->m_privateKey, this);
+        connect(d->m_certificateGenerator, &QThread::finished,
+                this, &KdeConnectConfig::certificateGenerated);
+        d->m_certificateGenerator->start(QThread::LowPriority);
+    } else {
+        const Credentials credentials = generateCredentials(
+                    d->m_deviceId, algorithm, d->m_privateKey);
+        setCredentials(
+                    credentials.privateKey, credentials.certificate,
+                    credentials.keyGenerated);
+    }
+}
 
-        d->m_certificate = Ssl::CertificateBuilder()
-                .info(certificateInfo)
-                .serialNumber(10)
-                .notBefore(startTime)
-                .notAfter(startTime.addYears(10))
-                .selfSigned(d->m_privateKey);
-        if (d->m_certificate.isNull()) {
-            qCCritical(coreLogger) << "generating certificate failed";
-            return;
-        }
+void KdeConnectConfig::certificateGenerated()
+{
+    const Credentials credentials = d->m_certificateGenerator->credentials;
+    d->m_certificateGenerator->deleteLater();
+    d->m_certificateGenerator = nullptr;
+
+    setCredentials(
+                credentials.privateKey, credentials.certificate,
+                credentials.keyGenerated);
+    if (valid()) {
+        Q_EMIT certificateChanged();
+    } else {
+        Q_EMIT certificateGenerationFailed(
+                    credentials.error, credentials.permanentError);
+    }
+}
+
+void KdeConnectConfig::regenerateCertificate()
+{
+    const bool wasValid = valid();
+    createCertificate(CreateInBackground);
+    if (valid()) {
+        // credentials could be loaded without generating new ones
+        Q_EMIT certificateChanged();
+    } else if (wasValid) {
+        Q_EMIT certificateLost();
+    }
+}
+
+void KdeConnectConfig::setCredentials(
+        const QSslKey& privateKey, const QSslCertificate& certificate,
+        bool keyGenerated)
+{
+    if (certificate.isNull())
+        return;
+
+    QString keyPath = privateKeyPath();
+    if (keyGenerated) {
+        qCInfo(coreLogger) << "store generated private key to" << keyPath;
 
-        if (!certFile.open(QIODevice::ReadWrite | QIODevice::Truncate))  {
+        QFile keyFile(keyPath);
+        if (!keyFile.open(QIODevice::ReadWrite | QIODevice::Truncate))  {
             qCCritical(coreLogger)
-                    << "Could not store certificate file:" << certPath;
+                    << "Could not store private key file:" << keyPath;
         } else {
-            certFile.setPermissions(strictFilePermissions);
-            certFile.write(d->m_certificate.toPem());
-            certFile.close();
+            keyFile.setPermissions(strictFilePermissions);
+            keyFile.write(privateKey.toPem());
+            keyFile.close();
         }
     }
 
+    QString certPath = certificatePath();
+    qCInfo(coreLogger) << "store generated certificate to" << certPath;
+
+    QFile certFile(certPath);
+    if (!certFile.open(QIODevice::ReadWrite | QIODevice::Truncate))  {
+        qCCritical(coreLogger)
+                << "Could not store certificate file:" << certPath;
+    } else {
+        certFile.setPermissions(strictFilePermissions);
+        certFile.write(certificate.toPem());
+        certFile.close();
+    }
+
+    d->m_privateKey = privateKey;
+    d->m_certificate = certificate;
+
+    checkPrivateKeyPermissions();
+}
+
+void KdeConnectConfig::checkPrivateKeyPermissions()
+{
     // Extra security check
+    QString keyPath = privateKeyPath();
     if (QFile::permissions(keyPath) != strictFilePermissions) {
         qCWarning(coreLogger)
                 << "Warning: KDE Connect private key file has too open permissions"
@@ -205,7 +389,6 @@ QString KdeConnectConfig::name() const
 void KdeConnectConfig::setName(const QString& name)
 {
     d->m_config->setValue(QStringLiteral("name"), name);
-    d->m_config->sync();
 
     d->m_name = name;
 }
@@ -230,6 +413,11 @@ QString KdeConnectConfig::privateKeyPath() const
     return baseConfigDir().absoluteFilePath(QStringLiteral("privateKey.pem"));
 }
 
+QSslKey KdeConnectConfig::privateKey() const
+{
+    return d->m_privateKey;
+}
+
 QString KdeConnectConfig::certificatePath() const
 {
     return baseConfigDir().absoluteFilePath(QStringLiteral("certificate.pem"));
@@ -255,42 +443,70 @@ QDir KdeConnectConfig::baseConfigDir() const
     return d->m_configBaseDir;
 }
 
+void KdeConnectConfig::reloadTrustedDevices()
+{
+    const QSet<QString> trustedDeviceIds =
+            d->m_trustedDevices->childGroups().toSet();
+    const QSet<QString> oldTrustedDeviceIds = d->m_trustedDeviceIds;
+    d->m_trustedDeviceIds = trustedDeviceIds;
+
+    for (const QString& id : oldTrustedDeviceIds) {
+        if (!trustedDeviceIds.contains(id)) {
+            Q_EMIT deviceTrustChanged(id, false);
+        }
+    }
+    for (const QString& id : trustedDeviceIds) {
+        if (!oldTrustedDeviceIds.contains(id)) {
+            Q_EMIT deviceTrustChanged(id, true);
+        }
+    }
+}
+
 QStringList KdeConnectConfig::trustedDevices() const
 {
-    return d->m_trustedDevices->childGroups();
+    QStringList result = d->m_trustedDeviceIds.toList();
+    result.sort();
+    return result;
 }
 
+bool KdeConnectConfig::isTrustedDevice(const QString& id) const
+{
+    return d->m_trustedDeviceIds.contains(id);
+}
 
 void KdeConnectConfig::addTrustedDevice(const QString& id, const QString& name, const QString& type)
 {
-    d->m_trustedDevices->beginGroup(id);
-    d->m_trustedDevices->setValue(QStringLiteral("name"), name);
-    d->m_trustedDevices->setValue(QStringLiteral("type"), type);
-    d->m_trustedDevices->endGroup();
-    d->m_trustedDevices->sync();
+    d->m_trustedDevices->setValue(id + QStringLiteral("/name"), name);
+    d->m_trustedDevices->setValue(id + QStringLiteral("/type"), type);
 
     QDir().mkpath(deviceConfigDir(id).path());
+
+    if (!d->m_trustedDeviceIds.contains(id)) {
+        d->m_trustedDeviceIds.insert(id);
+        Q_EMIT deviceTrustChanged(id, true);
+    }
 }
 
 KdeConnectConfig::DeviceInfo KdeConnectConfig::getTrustedDevice(const QString& id) const
 {
-    d->m_trustedDevices->beginGroup(id);
-
     KdeConnectConfig::DeviceInfo info;
     info.deviceName = d->m_trustedDevices->value(
-                QStringLiteral("name"), QLatin1String("unnamed")).toString();
+                id + QStringLiteral("/name"),
+                QLatin1String("unnamed")).toString();
     info.deviceType = d->m_trustedDevices->value(
-                QStringLiteral("type"), QLatin1String("unknown")).toString();
-
-    d->m_trustedDevices->endGroup();
+                id + QStringLiteral("/type"),
+                QLatin1String("unknown")).toString();
     return info;
 }
 
 void KdeConnectConfig::removeTrustedDevice(const QString& deviceId)
 {
     d->m_trustedDevices->remove(deviceId);
-    d->m_trustedDevices->sync();
     //We do not remove the config files.
+
+    if (d->m_trustedDeviceIds.remove(deviceId)) {
+        Q_EMIT deviceTrustChanged(deviceId, false);
+    }
 }
 
 // Utility functions to set and get a value
@@ -298,25 +514,53 @@ void KdeConnectConfig::setDeviceProperty(
         const QString& deviceId, const QString& key, const QString& value)
 {
     // do not store values for untrusted devices (it would make them trusted)
-    if (!d->m_trustedDevices->childGroups().contains(deviceId))
+    if (!isTrustedDevice(deviceId))
         return;
 
-    d->m_trustedDevices->beginGroup(deviceId);
-    d->m_trustedDevices->setValue(key, value);
-    d->m_trustedDevices->endGroup();
-    d->m_trustedDevices->sync();
+    d->m_trustedDevices->setValue(deviceId + QLatin1Char('/') + key, value);
 }
 
 QString KdeConnectConfig::getDeviceProperty(
         const QString& deviceId, const QString& key, const QString& defaultValue) const
 {
-    QString value;
-    d->m_trustedDevices->beginGroup(deviceId);
-    value = d->m_trustedDevices->value(key, defaultValue).toString();
-    d->m_trustedDevices->endGroup();
-    return value;
+    return d->m_trustedDevices->value(
+                deviceId + QLatin1Char('/') + key, defaultValue).toString();
 }
 
+void KdeConnectConfig::setLastEndpoint(
+        const QString& deviceId, const KdeConnectConfig::Endpoint& endpoint)
+{
+    // avoid writing the config file on every reconnect
+    const Endpoint current = lastEndpoint(deviceId);
+    if (!endpoint.isValid()) {
+        if (current.isValid()) {
+            setDeviceProperty(deviceId, QStringLiteral("lastAddress"), QString());
+            setDeviceProperty(deviceId, QStringLiteral("lastTcpPort"), QString());
+        }
+        return;
+    }
+    if (current.address == endpoint.address
+            && current.tcpPort == endpoint.tcpPort)
+        return;
+
+    setDeviceProperty(
+                deviceId, QStringLiteral("lastAddress"),
+                endpoint.address.toString());
+    setDeviceProperty(
+                deviceId, QStringLiteral("lastTcpPort"),
+                QString::number(endpoint.tcpPort));
+}
+
+KdeConnectConfig::Endpoint KdeConnectConfig::lastEndpoint(
+        const QString& deviceId) const
+{
+    Endpoint result;
+    result.address = QHostAddress(
+                getDeviceProperty(deviceId, QStringLiteral("lastAddress")));
+    result.tcpPort = getDeviceProperty(
+                deviceId, QStringLiteral("lastTcpPort")).toUShort();
+    return result;
+}
 
 QDir KdeConnectConfig::deviceConfigDir(const QString& deviceId) const
 {
@@ -23,7 +23,8 @@
 #define KDECONNECTCONFIG_H
 
 #include <memory>
-#include <QCoreApplication>
+#include <QObject>
+#include <QHostAddress>
 
 class QSslCertificate;
 class QSslKey;
@@ -33,17 +34,33 @@ namespace SailfishConnect {
 class SystemInfo;
 } // namespace SailfishConnect
 
-class KdeConnectConfig
+class KdeConnectConfig : public QObject
 {
-    Q_DECLARE_TR_FUNCTIONS(KdeConnectConfig)
+    Q_OBJECT
 public:
-    KdeConnectConfig(std::unique_ptr<SailfishConnect::SystemInfo> systemInfo);
+    enum CertificateCreation {
+        CreateSynchronously,
+        // valid() is false until certificateChanged is emitted
+        CreateInBackground
+    };
+
+    KdeConnectConfig(
+            std::unique_ptr<SailfishConnect::SystemInfo> systemInfo,
+            CertificateCreation certificateCreation = CreateSynchronously);
+    ~KdeConnectConfig() override;
 
     struct DeviceInfo {
         QString deviceName;
         QString deviceType;
     };
 
+    struct Endpoint {
+        QHostAddress address;
+        quint16 tcpPort = 0;
+
+        bool isValid() const { return !address.isNull() && tcpPort != 0; }
+    };
+
     static KdeConnectConfig* instance();
 
     /*
@@ -56,6 +73,7 @@ public:
     QString deviceType() const;
 
     QString privateKeyPath() const;
+    QSslKey privateKey() const;
 
     QString certificatePath() const;
     QSslCertificate certificate() const;
@@ -67,11 +85,21 @@ public:
 
     bool valid() const;
 
+    /**
+     * Load or generate the certificate again in the background, e.g. after
+     * certificateGenerationFailed or when the key got lost.
+     *
+     * certificateLost is emitted if there is no valid certificate until
+     * the generation finished.
+     */
+    void regenerateCertificate();
+
     /*
      * Trusted devices
      */
 
     QStringList trustedDevices() const; //list of ids
+    bool isTrustedDevice(const QString& id) const;
     void removeTrustedDevice(const QString& id);
     void addTrustedDevice(const QString& id, const QString& name, const QString& type);
     KdeConnectConfig::DeviceInfo getTrustedDevice(const QString& id) const;
@@ -79,6 +107,11 @@ public:
     void setDeviceProperty(const QString& deviceId, const QString& name, const QString& value);
     QString getDeviceProperty(const QString& deviceId, const QString& name, const QString& defaultValue = QString()) const;
 
+    // Address and TCP port of the last successful connection to a trusted
+    // device. Setting an invalid endpoint forgets it.
+    void setLastEndpoint(const QString& deviceId, const Endpoint& endpoint);
+    KdeConnectConfig::Endpoint lastEndpoint(const QString& deviceId) const;
+
     /*
      * Paths for config files, there is no guarantee the directories already exist
      */
@@ -87,13 +120,26 @@ public:
     QDir deviceConfigDir(const QString& deviceId) const;
     QDir pluginConfigDir(const QString& deviceId, const QString& pluginName) const; //Used by KdeConnectPluginConfig
 
+Q_SIGNALS:
+    void deviceTrustChanged(const QString& deviceId, bool trusted);
+    void certificateChanged();
+    void certificateLost();
+    // permanent: the configuration is wrong, trying again will not help
+    void certificateGenerationFailed(const QString& error, bool permanent);
+
 private:
     struct KdeConnectConfigPrivate* d;
 
     void createBaseConfigDir();
-    void createCertificate();
+    void createCertificate(CertificateCreation certificateCreation);
+    void certificateGenerated();
+    void setCredentials(
+            const QSslKey& privateKey, const QSslCertificate& certificate,
+            bool keyGenerated);
+    void checkPrivateKeyPermissions();
     void createDeviceId();
     void createName();
+    void reloadTrustedDevices();
 };
 
 #endif
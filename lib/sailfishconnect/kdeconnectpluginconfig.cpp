@@ -22,14 +22,16 @@
 #include "kdeconnectpluginconfig.h"
 
 #include <QDir>
-#include <QSettings>
 
 #include "kdeconnectconfig.h"
+#include "io/configstore.h"
+
+using namespace SailfishConnect;
 
 struct SailfishConnectPluginConfigPrivate
 {
     QDir m_configDir;
-    QScopedPointer<QSettings> m_config;
+    QSharedPointer<ConfigStore> m_config;
 };
 
 SailfishConnectPluginConfig::SailfishConnectPluginConfig(const QString& deviceId, const QString& pluginName)
@@ -38,50 +40,34 @@ SailfishConnectPluginConfig::SailfishConnectPluginConfig(const QString& deviceId
     d->m_configDir = KdeConnectConfig::instance()->pluginConfigDir(deviceId, pluginName);
     QDir().mkpath(d->m_configDir.path());
 
-    d->m_config.reset(new QSettings(d->m_configDir.absoluteFilePath(QStringLiteral("config")), QSettings::IniFormat));
+    d->m_config = ConfigStore::forFile(d->m_configDir.absoluteFilePath(QStringLiteral("config")));
+    connect(d->m_config.data(), &ConfigStore::changed,
+            this, &SailfishConnectPluginConfig::slotConfigChanged);
 }
 
 SailfishConnectPluginConfig::~SailfishConnectPluginConfig() = default;
 
 QVariant SailfishConnectPluginConfig::get(const QString& key, const QVariant& defaultValue)
 {
-    d->m_config->sync();
+    // changes from other processes are picked up by the store
     return d->m_config->value(key, defaultValue);
 }
 
 QVariantList SailfishConnectPluginConfig::getList(const QString& key,
                                              const QVariantList& defaultValue)
 {
-    QVariantList list;
-    d->m_config->sync();  // note: need sync() to get recent changes signalled from other process
-    int size = d->m_config->beginReadArray(key);
-    if (size < 1) {
-        d->m_config->endArray();
-        return defaultValue;
-    }
-    for (int i = 0; i < size; ++i) {
-        d->m_config->setArrayIndex(i);
-        list << d->m_config->value(QStringLiteral("value"));
-    }
-    d->m_config->endArray();
-    return list;
+    const QVariantList list = d->m_config->list(key);
+    return list.isEmpty() ? defaultValue : list;
 }
 
 void SailfishConnectPluginConfig::set(const QString& key, const QVariant& value)
 {
     d->m_config->setValue(key, value);
-    d->m_config->sync();
 }
 
 void SailfishConnectPluginConfig::setList(const QString& key, const QVariantList& list)
 {
-    d->m_config->beginWriteArray(key);
-    for (int i = 0; i < list.size(); ++i) {
-        d->m_config->setArrayIndex(i);
-        d->m_config->setValue(QStringLiteral("value"), list.at(i));
-    }
-    d->m_config->endArray();
-    d->m_config->sync();
+    d->m_config->setList(key, list);
 }
 
 void SailfishConnectPluginConfig::slotConfigChanged()
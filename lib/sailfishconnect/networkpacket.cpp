@@ -27,7 +27,9 @@
 #include <QDateTime>
 #include <QJsonDocument>
 #include <QDebug>
+#include <QHash>
 #include <QLoggingCategory>
+#include <QReadWriteLock>
 
 #include "corelogging.h"
 #include "kdeconnectconfig.h"
@@ -51,6 +53,7 @@ const int NetworkPacket::s_protocolVersion = 7;
 NetworkPacket::NetworkPacket(const QString& type, const QVariantMap& body)
     : m_id(QString::number(QDateTime::currentMSecsSinceEpoch()))
     , m_type(type)
+    , m_typeId(internType(type))
     , m_body(body)
     , m_payload()
     , m_payloadSize(0)
@@ -60,19 +63,57 @@ NetworkPacket::NetworkPacket(const QString& type, const QVariantMap& body)
 void NetworkPacket::createIdentityPacket(KdeConnectConfig* config, NetworkPacket* np)
 {
     np->m_id = QString::number(QDateTime::currentMSecsSinceEpoch());
-    np->m_type = PACKET_TYPE_IDENTITY;
+    np->setType(PACKET_TYPE_IDENTITY);
     np->m_payload = QSharedPointer<QIODevice>();
     np->m_payloadSize = 0;
     np->set(QStringLiteral("deviceId"), config->deviceId());
     np->set(QStringLiteral("deviceName"), config->name());
     np->set(QStringLiteral("deviceType"), config->deviceType());
     np->set(QStringLiteral("protocolVersion"), NetworkPacket::s_protocolVersion);
-    np->set(QStringLiteral("incomingCapabilities"), PluginManager::instance()->incomingCapabilities());
-    np->set(QStringLiteral("outgoingCapabilities"), PluginManager::instance()->outgoingCapabilities());
+
+    // heartbeats are handled by the links, not by plugins
+    np->set(QStringLiteral("incomingCapabilities"),
+            PluginManager::instance()->incomingCapabilities()
+            << PACKET_TYPE_HEARTBEAT);
+    np->set(QStringLiteral("outgoingCapabilities"),
+            PluginManager::instance()->outgoingCapabilities()
+            << PACKET_TYPE_HEARTBEAT);
 
     //qCDebug(coreLogger) << "createIdentityPacket" << np->serialize();
 }
 
+int NetworkPacket::internType(const QString& type)
+{
+    static QReadWriteLock lock;
+    static QHash<QString, int> typeIds;
+
+    {
+        QReadLocker readLocker(&lock);
+        auto iter = typeIds.constFind(type);
+        if (iter != typeIds.constEnd())
+            return iter.value();
+    }
+
+    QWriteLocker writeLocker(&lock);
+    auto iter = typeIds.constFind(type);
+    if (iter != typeIds.constEnd())
+        return iter.value();
+
+    // do not let peers grow the table without bounds
+    if (typeIds.size() >= MAX_INTERNED_TYPES)
+        return -1;
+
+    const int typeId = typeIds.size();
+    typeIds.insert(type, typeId);
+    return typeId;
+}
+
+void NetworkPacket::setType(const QString& t)
+{
+    m_type = t;
+    m_typeId = internType(t);
+}
+
 template<class T>
 QVariantMap qobject2qvariant(const T* object)
 {
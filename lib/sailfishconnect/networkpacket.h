@@ -53,6 +53,22 @@ public:
 
     const QString& id() const { return m_id; }
     const QString& type() const { return m_type; }
+
+    /**
+     * Small integer standing for the packet type, equal for equal types.
+     * -1 if the type could not be interned.
+     */
+    int typeId() const { return m_typeId; }
+
+    /**
+     * Returns the id for @p type, assigning a new one on first use. Ids are
+     * dense, start at 0 and stay valid for the lifetime of the process.
+     * Once MAX_INTERNED_TYPES types are known, new types get -1.
+     *
+     * Thread-safe.
+     */
+    static int internType(const QString& type);
+    static const int MAX_INTERNED_TYPES = 1024;
     QVariantMap& body() { return m_body; }
     const QVariantMap& body() const { return m_body; }
 
@@ -78,12 +94,13 @@ public:
 private:
 
     void setId(const QString& id) { m_id = id; }
-    void setType(const QString& t) { m_type = t; }
+    void setType(const QString& t);
     void setBody(const QVariantMap& b) { m_body = b; }
     void setPayloadSize(qint64 s) { m_payloadSize = s; }
 
     QString m_id;
     QString m_type;
+    int m_typeId;
     QVariantMap m_body;
 
     QSharedPointer<QIODevice> m_payload;
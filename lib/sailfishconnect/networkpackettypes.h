@@ -23,5 +23,6 @@
 
 #define PACKET_TYPE_IDENTITY QStringLiteral("kdeconnect.identity")
 #define PACKET_TYPE_PAIR QStringLiteral("kdeconnect.pair")
+#define PACKET_TYPE_HEARTBEAT QStringLiteral("sailfishconnect.heartbeat")
 
 #endif // NETWORKPACKETTYPES_H
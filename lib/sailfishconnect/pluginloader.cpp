@@ -30,7 +30,9 @@
 #include "corelogging.h"
 #include "device.h"
 #include "kdeconnectplugin.h"
+#include "networkpacket.h"
 #include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/helper/tracing.h>
 
 using namespace SailfishConnect;
 
@@ -142,14 +144,19 @@ PluginManager::PluginListEntry PluginManager::createPluginEntry(
         return PluginListEntry();
     }
 
+    // bits are assigned when all plugins are known
     return PluginListEntry {
             pluginId,
             toStringList(pluginMetadata.value(
-                             QStringLiteral("IncomingCapabilities"))).toSet(),
+                             QStringLiteral("IncomingCapabilities"))),
             toStringList(pluginMetadata.value(
-                             QStringLiteral("OutcomingCapabilities"))).toSet(),
+                             QStringLiteral("OutcomingCapabilities"))),
+            Capabilities(),
+            Capabilities(),
             pluginMetadata.value(
                              QStringLiteral("EnabledByDefault")).toBool(true),
+            pluginMetadata.value(
+                             QStringLiteral("LoadOnDemand")).toBool(false),
             factory,
             std::move(pluginLoader)
     };
@@ -163,6 +170,8 @@ PluginManager* PluginManager::instance()
 
 PluginManager::PluginManager()
 {
+    SC_TRACE_SCOPE("PluginManager::PluginManager");
+
     const auto staticPlugins = QPluginLoader::staticPlugins();
     for (const QStaticPlugin& staticPlugin : staticPlugins) {
         auto entry = createPluginEntry(
@@ -172,13 +181,58 @@ PluginManager::PluginManager()
         }
     }
 
-    for (auto& keyValue : asConst(plugins)) {
-       keyValue.second.factory->registerTypes();
+    QSet<QString> incoming;
+    QSet<QString> outgoing;
+    for (auto& keyValue : plugins) {
+        auto& entry = keyValue.second;
+        {
+            SC_TRACE_SCOPE("SailfishConnectPluginFactory::registerTypes");
+            entry.factory->registerTypes();
+        }
+
+        // packet types we handle must have an id before peers can exhaust
+        // the table
+        for (const QString& capability : asConst(entry.incomingCapabilities)) {
+            NetworkPacket::internType(capability);
+        }
+
+        entry.incomingCapabilityBits =
+                assignCapabilityBits(entry.incomingCapabilities);
+        entry.outgoingCapabilityBits =
+                assignCapabilityBits(entry.outgoingCapabilities);
+
+        entry.outgoingCapabilitySet = entry.outgoingCapabilities.toSet();
+
+        pluginIds.insert(entry.id);
+        incoming += entry.incomingCapabilities.toSet();
+        outgoing += entry.outgoingCapabilitySet;
     }
+    allIncomingCapabilities = incoming.toList();
+    allOutgoingCapabilities = outgoing.toList();
 
     qCDebug(coreLogger) << "loaded plugins:" << getPluginList();
 }
 
+PluginManager::Capabilities PluginManager::assignCapabilityBits(
+        const QStringList& capabilities)
+{
+    Capabilities result;
+    for (const QString& capability : capabilities) {
+        auto iter = capabilityBits.constFind(capability);
+        if (iter == capabilityBits.constEnd()) {
+            if (std::size_t(capabilityBits.size()) >= MAX_CAPABILITIES) {
+                qCWarning(coreLogger)
+                        << "Too many capabilities, ignoring" << capability;
+                continue;
+            }
+            iter = capabilityBits.insert(
+                        capability, std::size_t(capabilityBits.size()));
+        }
+        result.set(iter.value());
+    }
+    return result;
+}
+
 QStringList PluginManager::getPluginList() const
 {
     QStringList list;
@@ -189,6 +243,11 @@ QStringList PluginManager::getPluginList() const
     return list;
 }
 
+QSet<QString> PluginManager::getPluginSet() const
+{
+    return pluginIds;
+}
+
 KdeConnectPlugin* PluginManager::instantiatePluginForDevice(const QString& pluginId, Device* device) const
 {
     auto entryIter = plugins.find(pluginId);
@@ -199,7 +258,7 @@ KdeConnectPlugin* PluginManager::instantiatePluginForDevice(const QString& plugi
 
     auto& entry = entryIter->second;
     KdeConnectPlugin* plugin = entry.factory->create(
-                device, entry.id, entry.outgoingCapabilities);
+                device, entry.id, entry.outgoingCapabilitySet);
     if (!plugin) {
         qCDebug(coreLogger) << "Error loading plugin";
         return nullptr;
@@ -215,7 +274,7 @@ QStringList PluginManager::incomingCapabilities(const QString &pluginId) const
     if (entryIter == plugins.end()) {
         return QStringList();
     }
-    return entryIter->second.incomingCapabilities.toList();
+    return entryIter->second.incomingCapabilities;
 }
 
 QStringList PluginManager::outgoingCapabilities(const QString &pluginId) const
@@ -224,7 +283,7 @@ QStringList PluginManager::outgoingCapabilities(const QString &pluginId) const
     if (entryIter == plugins.end()) {
         return QStringList();
     }
-    return entryIter->second.outgoingCapabilities.toList();
+    return entryIter->second.outgoingCapabilities;
 }
 
 bool PluginManager::enabledByDefault(const QString &pluginId) const
@@ -236,6 +295,15 @@ bool PluginManager::enabledByDefault(const QString &pluginId) const
     return entryIter->second.enabledByDefault;
 }
 
+bool PluginManager::loadOnDemand(const QString &pluginId) const
+{
+    auto entryIter = plugins.find(pluginId);
+    if (entryIter == plugins.end()) {
+        return false;
+    }
+    return entryIter->second.loadOnDemand;
+}
+
 QString PluginManager::pluginName(const QString &pluginId) const
 {
     auto entryIter = plugins.find(pluginId);
@@ -265,25 +333,31 @@ QString PluginManager::pluginIconUrl(const QString &pluginId) const
 
 QStringList PluginManager::incomingCapabilities() const
 {
-    QSet<QString> ret;
-    for (auto& keyValue : asConst(plugins)) {
-        ret += keyValue.second.incomingCapabilities;
-    }
-    return ret.toList();
+    return allIncomingCapabilities;
 }
 
 QStringList PluginManager::outgoingCapabilities() const
 {
-    QSet<QString> ret;
-    for (auto& keyValue : asConst(plugins)) {
-        ret += keyValue.second.outgoingCapabilities;
+    return allOutgoingCapabilities;
+}
+
+PluginManager::Capabilities PluginManager::capabilities(
+        const QStringList& capabilities) const
+{
+    Capabilities result;
+    for (const QString& capability : capabilities) {
+        auto iter = capabilityBits.constFind(capability);
+        if (iter != capabilityBits.constEnd()) {
+            result.set(iter.value());
+        }
     }
-    return ret.toList();
+    return result;
 }
 
-QSet<QString> PluginManager::pluginsForCapabilities(const QSet<QString>& incoming, const QSet<QString>& outgoing)
+QSet<QString> PluginManager::pluginsForCapabilities(
+        const Capabilities& incoming, const Capabilities& outgoing) const
 {
-    QSet<QString> pluginIds;
+    QSet<QString> result;
 
     for (auto& keyValue : asConst(plugins)) {
         auto& entry = keyValue.second;
@@ -291,11 +365,11 @@ QSet<QString> PluginManager::pluginsForCapabilities(const QSet<QString>& incomin
                 entry.incomingCapabilities.isEmpty()
                 && entry.outgoingCapabilities.isEmpty();
         bool capabilitiesIntersect =
-                outgoing.intersects(entry.incomingCapabilities)
-                || incoming.intersects(entry.outgoingCapabilities);
+                (outgoing & entry.incomingCapabilityBits).any()
+                || (incoming & entry.outgoingCapabilityBits).any();
 
         if (capabilitiesIntersect || capabilitiesEmpty) {
-            pluginIds += entry.id;
+            result += entry.id;
         } else {
             qCDebug(coreLogger)
                     << "Not loading plugin" << entry.id
@@ -303,5 +377,5 @@ QSet<QString> PluginManager::pluginsForCapabilities(const QSet<QString>& incomin
         }
     }
 
-    return pluginIds;
+    return result;
 }
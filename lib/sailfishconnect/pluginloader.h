@@ -22,10 +22,13 @@
 #ifndef PLUGINLOADER_H
 #define PLUGINLOADER_H
 
+#include <bitset>
 #include <map>
 #include <memory>
+#include <QHash>
 #include <QSet>
 #include <QString>
+#include <QStringList>
 
 #include <QJsonObject>
 
@@ -33,44 +36,73 @@ class Device;
 class KdeConnectPlugin;
 class PluginLoader;
 class SailfishConnectPluginFactory;
-class QStringList;
 
 class PluginManager
 {
 
 public:
+    /**
+     * Maximal number of distinct capabilities of all local plugins
+     */
+    static const std::size_t MAX_CAPABILITIES = 128;
+
+    /**
+     * Set of capabilities as bits, see capabilities()
+     */
+    using Capabilities = std::bitset<MAX_CAPABILITIES>;
+
     static PluginManager* instance();
 
     QStringList getPluginList() const;
+    QSet<QString> getPluginSet() const;
     KdeConnectPlugin* instantiatePluginForDevice(const QString& name, Device* device) const;
 
     QStringList incomingCapabilities(const QString& pluginId) const;
     QStringList outgoingCapabilities(const QString& pluginId) const;
     bool enabledByDefault(const QString& pluginId) const;
+    bool loadOnDemand(const QString& pluginId) const;
     QString pluginName(const QString& pluginId) const;
     QString pluginDescription(const QString& pluginId) const;
     QString pluginIconUrl(const QString& pluginId) const;
 
     QStringList incomingCapabilities() const;
     QStringList outgoingCapabilities() const;
-    QSet<QString> pluginsForCapabilities(const QSet<QString>& incoming, const QSet<QString>& outgoing);
+
+    /**
+     * Converts capabilities, e.g. of an identity packet, to a bit set.
+     *
+     * Capabilities no local plugin knows about are ignored.
+     */
+    Capabilities capabilities(const QStringList& capabilities) const;
+    QSet<QString> pluginsForCapabilities(
+            const Capabilities& incoming, const Capabilities& outgoing) const;
 
 private:
     PluginManager();
 
     struct PluginListEntry {
         QString id;
-        QSet<QString> incomingCapabilities;
-        QSet<QString> outgoingCapabilities;
+        QStringList incomingCapabilities;
+        QStringList outgoingCapabilities;
+        // passed to every plugin instance
+        QSet<QString> outgoingCapabilitySet;
+        Capabilities incomingCapabilityBits;
+        Capabilities outgoingCapabilityBits;
         bool enabledByDefault;
+        bool loadOnDemand;
         SailfishConnectPluginFactory* factory;
         std::unique_ptr<PluginLoader> loader;
     };
 
     std::map<QString, PluginListEntry> plugins;
+    QSet<QString> pluginIds;
+    QStringList allIncomingCapabilities;
+    QStringList allOutgoingCapabilities;
+    QHash<QString, std::size_t> capabilityBits;
 
     PluginListEntry createPluginEntry(
             std::unique_ptr<PluginLoader> pluginLoader);
+    Capabilities assignCapabilityBits(const QStringList& capabilities);
 };
 
 #endif
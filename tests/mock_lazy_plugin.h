@@ -0,0 +1,40 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOCK_LAZY_PLUGIN_H
+#define MOCK_LAZY_PLUGIN_H
+
+#include "mock_plugin.h"
+
+#define PACKET_TYPE_TEST_LAZY QStringLiteral("sailfishconnect.test.lazy")
+
+/**
+ * Mock plugin that is only loaded on demand.
+ */
+class LazyMockPluginFactory :
+        public SailfishConnectPluginFactory_<MockPlugin>
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID SailfishConnectPlugin_iid FILE "mock_lazy_plugin.json")
+    Q_INTERFACES(SailfishConnectPluginFactory)
+public:
+    QString name() const override { return QStringLiteral("Lazy mock"); }
+    QString description() const override { return QString(); }
+    QString iconUrl() const override { return QString(); }
+};
+
+#endif // MOCK_LAZY_PLUGIN_H
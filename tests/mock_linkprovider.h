@@ -26,10 +26,10 @@ class MockLinkProvider : public LinkProvider
 {
 public:
     MockLinkProvider();
-    MockLinkProvider(const QString& name, int priority = 0);
+    MockLinkProvider(const QString& name, int priority = PRIORITY_HIGH);
 
     QString name() override { return m_name; }
-    int priority() override { return PRIORITY_HIGH; }
+    int priority() override { return m_priority; }
 
 public Q_SLOTS:
     MOCK_METHOD0(onStart, void());
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOCK_PLUGIN_H
+#define MOCK_PLUGIN_H
+
+#include <QList>
+#include <QtPlugin>
+
+#include <sailfishconnect/kdeconnectplugin.h>
+#include <sailfishconnect/networkpacket.h>
+
+#define PACKET_TYPE_TEST QStringLiteral("sailfishconnect.test")
+
+/**
+ * Plugin that records every received packet, used to test the packet flow
+ * from link to plugin.
+ */
+class MockPlugin : public KdeConnectPlugin
+{
+    Q_OBJECT
+public:
+    using KdeConnectPlugin::KdeConnectPlugin;
+
+    bool receivePacket(const NetworkPacket& np) override;
+
+    QList<NetworkPacket> receivedPackets;
+};
+
+class MockPluginFactory :
+        public SailfishConnectPluginFactory_<MockPlugin>
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID SailfishConnectPlugin_iid FILE "mock_plugin.json")
+    Q_INTERFACES(SailfishConnectPluginFactory)
+public:
+    QString name() const override { return QStringLiteral("Mock"); }
+    QString description() const override { return QString(); }
+    QString iconUrl() const override { return QString(); }
+};
+
+#endif // MOCK_PLUGIN_H
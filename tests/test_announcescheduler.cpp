@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTest>
+
+#include <sailfishconnect/backend/lan/announcescheduler.h>
+
+using namespace SailfishConnect;
+
+class AnnounceSchedulerTests : public ::testing::Test {
+protected:
+    AnnounceSchedulerTests()
+        : m_app(_argn, nullptr)
+    {
+        scheduler.setBurst({0, 20, 60});
+        scheduler.setCoalesceInterval(10);
+        scheduler.setIdleInterval(50, 200);
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+
+    AnnounceScheduler scheduler;
+};
+
+TEST_F(AnnounceSchedulerTests, burstAfterTrigger) {
+    scheduler.setSatisfied(true);
+    QSignalSpy spy(&scheduler, &AnnounceScheduler::announce);
+
+    QElapsedTimer timer;
+    timer.start();
+    scheduler.trigger(QStringLiteral("test"));
+    ASSERT_TRUE(spy.wait(1000));
+    RecordProperty("timeToFirstAnnounceMs", int(timer.elapsed()));
+
+    QTest::qWait(300);
+    EXPECT_EQ(spy.size(), 3);
+    EXPECT_EQ(scheduler.announcements(), 3u);
+    EXPECT_FALSE(scheduler.isBursting());
+}
+
+TEST_F(AnnounceSchedulerTests, triggersAreCoalesced) {
+    scheduler.setSatisfied(true);
+    QSignalSpy spy(&scheduler, &AnnounceScheduler::announce);
+
+    for (int i = 0; i < 5; ++i) {
+        scheduler.trigger(QStringLiteral("test"));
+    }
+
+    QTest::qWait(300);
+    EXPECT_EQ(spy.size(), 3);
+    EXPECT_EQ(scheduler.triggers(), 5u);
+    EXPECT_EQ(scheduler.coalescedTriggers(), 4u);
+}
+
+TEST_F(AnnounceSchedulerTests, idleBackoff) {
+    scheduler.setBurst({0});
+    QSignalSpy spy(&scheduler, &AnnounceScheduler::announce);
+
+    scheduler.trigger(QStringLiteral("test"));
+    QTest::qWait(1000);
+
+    // burst at 10 ms, then 50, 100, 200, 200, ... ms apart
+    EXPECT_GE(spy.size(), 5);
+    EXPECT_LE(spy.size(), 8);
+}
+
+TEST_F(AnnounceSchedulerTests, satisfiedEndsBurst) {
+    QSignalSpy spy(&scheduler, &AnnounceScheduler::announce);
+
+    scheduler.trigger(QStringLiteral("test"));
+    ASSERT_TRUE(spy.wait(1000));
+    EXPECT_TRUE(scheduler.isBursting());
+    scheduler.setSatisfied(true);
+    EXPECT_FALSE(scheduler.isBursting());
+
+    QTest::qWait(300);
+    EXPECT_EQ(spy.size(), 1);
+}
+
+TEST_F(AnnounceSchedulerTests, satisfiedStopsAnnouncing) {
+    scheduler.setBurst({0});
+    QSignalSpy spy(&scheduler, &AnnounceScheduler::announce);
+
+    scheduler.trigger(QStringLiteral("test"));
+    ASSERT_TRUE(spy.wait(1000));
+    scheduler.setSatisfied(true);
+
+    QTest::qWait(300);
+    EXPECT_EQ(spy.size(), 1);
+
+    // a device went away
+    scheduler.setSatisfied(false);
+    EXPECT_TRUE(spy.wait(1000));
+}
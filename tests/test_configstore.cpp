@@ -0,0 +1,300 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest/QTest>
+
+#include <sailfishconnect/io/configstore.h>
+
+using namespace SailfishConnect;
+
+class ConfigStoreTests : public ::testing::Test {
+protected:
+    ConfigStoreTests()
+        : m_app(_argn, nullptr)
+        , path(dir.path() + QStringLiteral("/config"))
+    { }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+    QTemporaryDir dir;
+    QString path;
+};
+
+TEST_F(ConfigStoreTests, sharedPerFile) {
+    auto store = ConfigStore::forFile(path);
+    auto store2 = ConfigStore::forFile(dir.path() + QStringLiteral("/./config"));
+
+    EXPECT_EQ(store, store2);
+}
+
+TEST_F(ConfigStoreTests, valuesAndGroups) {
+    auto store = ConfigStore::forFile(path);
+
+    store->setValue(QStringLiteral("name"), QStringLiteral("Phone"));
+    store->setValue(QStringLiteral("device1/name"), QStringLiteral("One"));
+    store->setValue(QStringLiteral("device1/type"), QStringLiteral("phone"));
+    store->setValue(QStringLiteral("device2/name"), QStringLiteral("Two"));
+
+    EXPECT_EQ(store->value(QStringLiteral("name")), QVariant("Phone"));
+    EXPECT_EQ(store->value(QStringLiteral("missing"), 5), QVariant(5));
+    EXPECT_EQ(store->childGroups(),
+              QStringList({QStringLiteral("device1"), QStringLiteral("device2")}));
+
+    store->remove(QStringLiteral("device1"));
+    EXPECT_EQ(store->childGroups(), QStringList({QStringLiteral("device2")}));
+    EXPECT_FALSE(store->contains(QStringLiteral("device1/type")));
+}
+
+TEST_F(ConfigStoreTests, writeBehind) {
+    auto store = ConfigStore::forFile(path);
+    store->setValue(QStringLiteral("key"), 1);
+
+    EXPECT_TRUE(store->hasPendingChanges());
+    EXPECT_FALSE(QFile::exists(path));
+
+    QTest::qWait(ConfigStore::FLUSH_DELAY + 100);
+    store->flush();
+
+    EXPECT_FALSE(store->hasPendingChanges());
+    EXPECT_TRUE(QFile::exists(path));
+    EXPECT_FALSE(QFile::exists(path + QStringLiteral(".tmp")));
+    EXPECT_EQ(store->flushCount(), 1u);
+}
+
+TEST_F(ConfigStoreTests, compatibleWithQSettings) {
+    const QVariantList list = {QStringLiteral("a"), QStringLiteral("b")};
+    {
+        auto store = ConfigStore::forFile(path);
+        store->setValue(QStringLiteral("group/key"), QStringLiteral("value"));
+        store->setList(QStringLiteral("list"), list);
+    }
+
+    QSettings settings(path, QSettings::IniFormat);
+    EXPECT_EQ(settings.value(QStringLiteral("group/key")), QVariant("value"));
+    ASSERT_EQ(settings.beginReadArray(QStringLiteral("list")), 2);
+    settings.setArrayIndex(1);
+    EXPECT_EQ(settings.value(QStringLiteral("value")), QVariant("b"));
+    settings.endArray();
+
+    // and back
+    settings.setValue(QStringLiteral("other"), 42);
+    settings.sync();
+
+    auto store = ConfigStore::forFile(path);
+    EXPECT_EQ(store->list(QStringLiteral("list")), list);
+    EXPECT_EQ(store->value(QStringLiteral("other")).toInt(), 42);
+}
+
+TEST_F(ConfigStoreTests, reloadIfChanged) {
+    auto store = ConfigStore::forFile(path);
+    store->setValue(QStringLiteral("key"), 1);
+    store->flush();
+
+    // mtime resolution of some file systems is one second
+    QTest::qWait(1100);
+    {
+        QSettings settings(path, QSettings::IniFormat);
+        settings.setValue(QStringLiteral("key"), 2);
+    }
+
+    store->reloadIfChanged();
+    EXPECT_EQ(store->value(QStringLiteral("key")).toInt(), 2);
+}
+
+TEST_F(ConfigStoreTests, externalEditIsMerged) {
+    auto store = ConfigStore::forFile(path);
+    store->setValue(QStringLiteral("key"), 1);
+    store->setValue(QStringLiteral("removed"), 1);
+    store->flush();
+
+    // mtime resolution of some file systems is one second
+    QTest::qWait(1100);
+    {
+        QSettings settings(path, QSettings::IniFormat);
+        settings.setValue(QStringLiteral("other"), 2);
+    }
+
+    // no event processing, so the store did not reload yet
+    store->setValue(QStringLiteral("key"), 3);
+    store->remove(QStringLiteral("removed"));
+    store->flush();
+    EXPECT_EQ(store->conflictCount(), 1u);
+
+    QSettings settings(path, QSettings::IniFormat);
+    EXPECT_EQ(settings.value(QStringLiteral("other")).toInt(), 2);
+    EXPECT_EQ(settings.value(QStringLiteral("key")).toInt(), 3);
+    EXPECT_FALSE(settings.contains(QStringLiteral("removed")));
+
+    // the store picks up the merged content
+    store->reloadIfChanged();
+    EXPECT_EQ(store->value(QStringLiteral("other")).toInt(), 2);
+}
+
+TEST_F(ConfigStoreTests, writtenKeysYieldToExternalEdits) {
+    auto store = ConfigStore::forFile(path);
+    store->setValue(QStringLiteral("key"), 1);
+    store->flush();
+
+    // mtime resolution of some file systems is one second
+    QTest::qWait(1100);
+    {
+        QSettings settings(path, QSettings::IniFormat);
+        settings.setValue(QStringLiteral("key"), 22);
+    }
+
+    // the flushed value of key must not be written again
+    store->setValue(QStringLiteral("other"), 3);
+    store->flush();
+    EXPECT_EQ(store->conflictCount(), 1u);
+
+    QSettings settings(path, QSettings::IniFormat);
+    EXPECT_EQ(settings.value(QStringLiteral("key")).toInt(), 22);
+    EXPECT_EQ(settings.value(QStringLiteral("other")).toInt(), 3);
+
+    store->reloadIfChanged();
+    EXPECT_EQ(store->value(QStringLiteral("key")).toInt(), 22);
+    EXPECT_EQ(store->value(QStringLiteral("other")).toInt(), 3);
+}
+
+TEST_F(ConfigStoreTests, writeBenchmark) {
+    const int iterations = 200;
+    QElapsedTimer timer;
+
+    timer.start();
+    {
+        QSettings settings(
+                    dir.path() + QStringLiteral("/qsettings"),
+                    QSettings::IniFormat);
+        for (int i = 0; i < iterations; ++i) {
+            settings.setValue(QStringLiteral("key%1").arg(i % 20), i);
+            settings.sync();
+        }
+    }
+    const qint64 qsettingsNs = timer.nsecsElapsed();
+
+    auto store = ConfigStore::forFile(path);
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        store->setValue(QStringLiteral("key%1").arg(i % 20), i);
+    }
+    const qint64 storeNs = timer.nsecsElapsed();
+    store->flush();
+
+    RecordProperty("qsettingsWritesPerSecond",
+                   int(iterations * 1000000000LL / qMax<qint64>(qsettingsNs, 1)));
+    RecordProperty("configStoreMainThreadNsPerWrite",
+                   int(storeNs / iterations));
+    RecordProperty("qsettingsMainThreadNsPerWrite",
+                   int(qsettingsNs / iterations));
+    EXPECT_EQ(store->value(QStringLiteral("key19")).toInt(), iterations - 1);
+}
+
+TEST_F(ConfigStoreTests, externalChangeIsNotified) {
+    auto store = ConfigStore::forFile(path);
+    store->setValue(QStringLiteral("key"), 1);
+    store->flush();
+    QSignalSpy changedSpy(store.data(), &ConfigStore::changed);
+
+    // our own writes are no changes
+    QTest::qWait(100);
+    EXPECT_EQ(changedSpy.count(), 0);
+
+    QTest::qWait(1100);
+    {
+        QSettings settings(path, QSettings::IniFormat);
+        settings.setValue(QStringLiteral("key"), 2);
+    }
+
+    ASSERT_TRUE(changedSpy.count() > 0 || changedSpy.wait(2000));
+    EXPECT_EQ(store->value(QStringLiteral("key")).toInt(), 2);
+}
+
+TEST_F(ConfigStoreTests, storesShareDirectoryWatch) {
+    auto store = ConfigStore::forFile(path);
+    auto store2 = ConfigStore::forFile(dir.path() + QStringLiteral("/config2"));
+    QSignalSpy changedSpy(store.data(), &ConfigStore::changed);
+    QSignalSpy changedSpy2(store2.data(), &ConfigStore::changed);
+
+    // writes behind, temporary files and renames are no changes
+    store->setValue(QStringLiteral("key"), 1);
+    store2->setValue(QStringLiteral("key"), 1);
+    QTest::qWait(ConfigStore::FLUSH_DELAY + 500);
+    EXPECT_FALSE(store->hasPendingChanges());
+    EXPECT_EQ(store->reloadCount(), 0u);
+    EXPECT_EQ(store2->reloadCount(), 0u);
+
+    QTest::qWait(1100);
+    {
+        QSettings settings(store2->fileName(), QSettings::IniFormat);
+        settings.setValue(QStringLiteral("key"), 2);
+    }
+
+    ASSERT_TRUE(changedSpy2.count() > 0 || changedSpy2.wait(2000));
+    EXPECT_EQ(store2->value(QStringLiteral("key")).toInt(), 2);
+    EXPECT_EQ(changedSpy.count(), 0);
+}
+
+TEST_F(ConfigStoreTests, notificationBurstBenchmark) {
+    const QStringList keys = {
+        QStringLiteral("generalPersistent"),
+        QStringLiteral("generalUrgency"),
+        QStringLiteral("generalIncludeBody"),
+        QStringLiteral("generalSynchronizeIcons")
+    };
+    const int notifications = 1000;
+
+    auto store = ConfigStore::forFile(path);
+    for (const QString& key : keys) {
+        store->setValue(key, true);
+    }
+    store->flush();
+
+    // what every notification paid before
+    QSettings settings(path, QSettings::IniFormat);
+    QElapsedTimer timer;
+    timer.start();
+    int enabled = 0;
+    for (int i = 0; i < notifications; ++i) {
+        for (const QString& key : keys) {
+            settings.sync();
+            enabled += settings.value(key).toBool() ? 1 : 0;
+        }
+    }
+    const qint64 syncNs = timer.nsecsElapsed();
+    EXPECT_EQ(enabled, notifications * keys.size());
+
+    timer.start();
+    enabled = 0;
+    for (int i = 0; i < notifications; ++i) {
+        for (const QString& key : keys) {
+            enabled += store->value(key).toBool() ? 1 : 0;
+        }
+    }
+    const qint64 storeNs = timer.nsecsElapsed();
+    EXPECT_EQ(enabled, notifications * keys.size());
+
+    RecordProperty("syncReadNsPerNotification", int(syncNs / notifications));
+    RecordProperty("storeReadNsPerNotification", int(storeNs / notifications));
+}
@@ -21,11 +21,18 @@
 
 #include "test.h"
 
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSettings>
+#include <QSignalSpy>
 #include <QSslCertificate>
+#include <QSslKey>
 
 #include <sailfishconnect/kdeconnectconfig.h>
 #include <sailfishconnect/systeminfo.h>
 #include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/io/configstore.h>
 
 using namespace SailfishConnect;
 
@@ -75,3 +82,151 @@ TEST_F(ConnectConfigTests, removeTrustedDevice) {
     EXPECT_EQ(devInfo.deviceName, QString("unnamed"));
     EXPECT_EQ(devInfo.deviceType, QString("unknown"));
 }
+
+TEST_F(ConnectConfigTests, trustChangeSignals) {
+    const QString deviceId = QStringLiteral("trusteddevice");
+    QSignalSpy spy(&config, &KdeConnectConfig::deviceTrustChanged);
+
+    config.addTrustedDevice(
+                deviceId, QStringLiteral("Device"), QStringLiteral("phone"));
+    EXPECT_TRUE(config.isTrustedDevice(deviceId));
+    EXPECT_TRUE(config.trustedDevices().contains(deviceId));
+
+    // already trusted
+    config.addTrustedDevice(
+                deviceId, QStringLiteral("Device"), QStringLiteral("phone"));
+
+    config.removeTrustedDevice(deviceId);
+    EXPECT_FALSE(config.isTrustedDevice(deviceId));
+    EXPECT_FALSE(config.trustedDevices().contains(deviceId));
+
+    EXPECT_EQ(spy, toVVList({{deviceId, true}, {deviceId, false}}));
+}
+
+// Compares only the trust lookup itself. The packet path including this
+// lookup is measured by PairedDeviceTests.packetDispatch.
+TEST_F(ConnectConfigTests, trustedDeviceLookupVsChildGroups) {
+    for (int i = 0; i < 20; ++i) {
+        config.addTrustedDevice(
+                    QStringLiteral("device%1").arg(i),
+                    QStringLiteral("Device"), QStringLiteral("phone"));
+    }
+    const QString deviceId = QStringLiteral("device19");
+    const int iterations = 10000;
+
+    // what every isTrustedDevice() call paid before
+    QSettings settings(
+                config.trustedDevicesConfigPath(), QSettings::IniFormat);
+    QElapsedTimer timer;
+    timer.start();
+    int found = 0;
+    for (int i = 0; i < iterations; ++i) {
+        found += settings.childGroups().contains(deviceId) ? 1 : 0;
+    }
+    const qint64 childGroupsNs = timer.nsecsElapsed() / iterations;
+    EXPECT_EQ(found, iterations);
+
+    timer.start();
+    found = 0;
+    for (int i = 0; i < iterations; ++i) {
+        found += config.isTrustedDevice(deviceId) ? 1 : 0;
+    }
+    const qint64 lookupNs = timer.nsecsElapsed() / iterations;
+    EXPECT_EQ(found, iterations);
+
+    RecordProperty("childGroupsContainsNsPerLookup", int(childGroupsNs));
+    RecordProperty("inMemoryIsTrustedDeviceNsPerLookup", int(lookupNs));
+    EXPECT_LT(lookupNs, childGroupsNs);
+}
+
+TEST(CertificateCreationTests, ecCertificateInBackground) {
+    int argn = 0;
+    QCoreApplication app(argn, nullptr);
+    QStandardPaths::setTestModeEnabled(true);
+
+    auto configDir = QDir(QStandardPaths::writableLocation(
+                QStandardPaths::AppConfigLocation));
+    EXPECT_TRUE(configDir.removeRecursively());
+    QDir().mkpath(configDir.path());
+
+    auto settings = ConfigStore::forFile(
+                configDir.absoluteFilePath(QStringLiteral("config")));
+    settings->setValue(QStringLiteral("keyAlgorithm"), QStringLiteral("ec"));
+
+    QSslCertificate certificate;
+    {
+        KdeConnectConfig config(
+                    makeUniquePtr<SystemInfo>(),
+                    KdeConnectConfig::CreateInBackground);
+        QSignalSpy spy(&config, &KdeConnectConfig::certificateChanged);
+        EXPECT_FALSE(config.valid());
+        EXPECT_FALSE(config.deviceId().isEmpty());
+
+        ASSERT_TRUE(spy.wait(30000));
+        EXPECT_TRUE(config.valid());
+        EXPECT_EQ(config.privateKey().algorithm(), QSsl::Ec);
+        certificate = config.certificate();
+        EXPECT_EQ(certificate.subjectInfo(
+                      QSslCertificate::CommonName).constFirst(),
+                  config.deviceId());
+    }
+
+    // stored key and certificate are used the next time
+    KdeConnectConfig config(
+                makeUniquePtr<SystemInfo>(),
+                KdeConnectConfig::CreateInBackground);
+    EXPECT_TRUE(config.valid());
+    EXPECT_EQ(config.privateKey().algorithm(), QSsl::Ec);
+    EXPECT_EQ(config.certificate(), certificate);
+
+    settings->remove(QStringLiteral("keyAlgorithm"));
+}
+
+TEST(CertificateCreationTests, failedGenerationIsReported) {
+    int argn = 0;
+    QCoreApplication app(argn, nullptr);
+    QStandardPaths::setTestModeEnabled(true);
+
+    auto configDir = QDir(QStandardPaths::writableLocation(
+                QStandardPaths::AppConfigLocation));
+    EXPECT_TRUE(configDir.removeRecursively());
+    QDir().mkpath(configDir.path());
+
+    auto settings = ConfigStore::forFile(
+                configDir.absoluteFilePath(QStringLiteral("config")));
+    settings->setValue(QStringLiteral("keyAlgorithm"), QStringLiteral("dsa"));
+
+    KdeConnectConfig config(
+                makeUniquePtr<SystemInfo>(),
+                KdeConnectConfig::CreateInBackground);
+    QSignalSpy changedSpy(&config, &KdeConnectConfig::certificateChanged);
+    QSignalSpy failedSpy(
+                &config, &KdeConnectConfig::certificateGenerationFailed);
+
+    ASSERT_TRUE(failedSpy.wait(30000));
+    EXPECT_FALSE(failedSpy.constFirst().at(0).toString().isEmpty());
+    // retrying does not help for an unknown algorithm
+    EXPECT_TRUE(failedSpy.constFirst().at(1).toBool());
+    EXPECT_EQ(changedSpy.count(), 0);
+    EXPECT_FALSE(config.valid());
+
+    // a retry with a usable algorithm recovers
+    settings->setValue(QStringLiteral("keyAlgorithm"), QStringLiteral("ec"));
+    config.regenerateCertificate();
+    ASSERT_TRUE(changedSpy.wait(30000));
+    EXPECT_TRUE(config.valid());
+    EXPECT_EQ(failedSpy.count(), 1);
+
+    // losing the key later regenerates it and announces the new certificate
+    const QSslCertificate oldCertificate = config.certificate();
+    EXPECT_TRUE(QFile::remove(config.privateKeyPath()));
+    QSignalSpy lostSpy(&config, &KdeConnectConfig::certificateLost);
+    config.regenerateCertificate();
+    EXPECT_EQ(lostSpy.count(), 1);
+    EXPECT_FALSE(config.valid());
+    ASSERT_TRUE(changedSpy.wait(30000));
+    EXPECT_TRUE(config.valid());
+    EXPECT_NE(config.certificate(), oldCertificate);
+
+    settings->remove(QStringLiteral("keyAlgorithm"));
+}
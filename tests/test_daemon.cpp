@@ -0,0 +1,213 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <QTest>
+
+#include <sailfishconnect/daemon.h>
+#include <sailfishconnect/device.h>
+#include <sailfishconnect/kdeconnectconfig.h>
+#include <sailfishconnect/systeminfo.h>
+#include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/io/configstore.h>
+#include <sailfishconnect/networkpacket.h>
+#include <sailfishconnect/networkpackettypes.h>
+
+#include "mock_devicelink.h"
+#include "mock_linkprovider.h"
+
+using namespace SailfishConnect;
+using ::testing::NiceMock;
+
+namespace {
+
+class TestDaemon : public Daemon
+{
+public:
+    TestDaemon(const QList<LinkProvider*>& linkProviders)
+        : Daemon(makeUniquePtr<SystemInfo>(), linkProviders, nullptr)
+    { }
+
+    void askPairingConfirmation(Device*) override { }
+    void reportError(const QString&, const QString&) override { ++errors; }
+
+    int errors = 0;
+};
+
+NetworkPacket daemonTestIdentity(const QString& deviceId, const QString& name)
+{
+    NetworkPacket identityPacket(PACKET_TYPE_IDENTITY);
+    identityPacket.set(QStringLiteral("deviceId"), deviceId);
+    identityPacket.set(QStringLiteral("deviceName"), name);
+    identityPacket.set(QStringLiteral("deviceType"), QStringLiteral("phone"));
+    identityPacket.set(
+                QStringLiteral("protocolVersion"),
+                NetworkPacket::s_protocolVersion);
+    return identityPacket;
+}
+
+} // namespace
+
+class DaemonTests : public ::testing::Test {
+protected:
+    DaemonTests()
+        : m_app(_argn, nullptr)
+        , daemon({ &linkProvider })
+    {
+        // accept devices which are not trusted
+        daemon.acquireDiscoveryMode(QStringLiteral("test"));
+    }
+
+    static void SetUpTestCase() {
+        QStandardPaths::setTestModeEnabled(true);
+
+        auto configDir = QDir(QStandardPaths::writableLocation(
+                    QStandardPaths::AppConfigLocation));
+        EXPECT_TRUE(configDir.removeRecursively());
+    }
+
+    void connectDevice(const QString& deviceId, const QString& name)
+    {
+        // links are owned by the device
+        auto* link = new NiceMock<MockDeviceLink>(deviceId, &linkProvider);
+        Q_EMIT linkProvider.onConnectionReceived(
+                    daemonTestIdentity(deviceId, name), link);
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+    NiceMock<MockLinkProvider> linkProvider;
+    TestDaemon daemon;
+};
+
+TEST_F(DaemonTests, getDevice) {
+    connectDevice(QStringLiteral("device1"), QStringLiteral("One"));
+
+    Device* device = daemon.getDevice(QStringLiteral("device1"));
+    ASSERT_NE(device, nullptr);
+    EXPECT_EQ(device->name(), QStringLiteral("One"));
+    EXPECT_EQ(daemon.getDevice(QStringLiteral("unknown")), nullptr);
+}
+
+TEST_F(DaemonTests, deviceIdByName) {
+    connectDevice(QStringLiteral("device1"), QStringLiteral("One"));
+    connectDevice(QStringLiteral("device2"), QStringLiteral("One"));
+
+    // only trusted devices are found
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("One")), QString());
+
+    daemon.config()->addTrustedDevice(
+                QStringLiteral("device2"), QStringLiteral("One"),
+                QStringLiteral("phone"));
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("One")),
+              QStringLiteral("device2"));
+
+    // renamed with the next identity packet
+    connectDevice(QStringLiteral("device2"), QStringLiteral("Two"));
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("One")), QString());
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("Two")),
+              QStringLiteral("device2"));
+
+    daemon.config()->removeTrustedDevice(QStringLiteral("device2"));
+}
+
+TEST_F(DaemonTests, lookupScaling) {
+    const int deviceCount = 500;
+    for (int i = 0; i < deviceCount; ++i) {
+        connectDevice(QStringLiteral("device%1").arg(i),
+                      QStringLiteral("Device %1").arg(i));
+        // only trusted devices are found by name
+        daemon.config()->addTrustedDevice(
+                    QStringLiteral("device%1").arg(i),
+                    QStringLiteral("Device %1").arg(i),
+                    QStringLiteral("phone"));
+    }
+    ASSERT_EQ(daemon.devicesList().size(), deviceCount);
+
+    const int lookups = 10000;
+    QElapsedTimer timer;
+    timer.start();
+    int found = 0;
+    for (int i = 0; i < lookups; ++i) {
+        const QString deviceId =
+                QStringLiteral("device%1").arg(i % deviceCount);
+        found += daemon.getDevice(deviceId) ? 1 : 0;
+    }
+    RecordProperty("getDeviceNsPerLookup", int(timer.nsecsElapsed() / lookups));
+    EXPECT_EQ(found, lookups);
+
+    timer.start();
+    found = 0;
+    for (int i = 0; i < lookups; ++i) {
+        const QString name = QStringLiteral("Device %1").arg(i % deviceCount);
+        const QString expected =
+                QStringLiteral("device%1").arg(i % deviceCount);
+        found += daemon.deviceIdByName(name) == expected ? 1 : 0;
+    }
+    RecordProperty("deviceIdByNameNsPerLookup",
+                   int(timer.nsecsElapsed() / lookups));
+    EXPECT_EQ(found, lookups);
+
+    // the name index follows renames
+    connectDevice(QStringLiteral("device7"), QStringLiteral("Renamed"));
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("Renamed")),
+              QStringLiteral("device7"));
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("Device 7")), QString());
+    EXPECT_EQ(daemon.deviceIdByName(QStringLiteral("Device 8")),
+              QStringLiteral("device8"));
+
+    for (int i = 0; i < deviceCount; ++i) {
+        daemon.config()->removeTrustedDevice(QStringLiteral("device%1").arg(i));
+    }
+}
+
+TEST(DaemonCertificateTests, configurationErrorIsReportedOnce) {
+    int argn = 0;
+    QCoreApplication app(argn, nullptr);
+    QStandardPaths::setTestModeEnabled(true);
+
+    auto configDir = QDir(QStandardPaths::writableLocation(
+                QStandardPaths::AppConfigLocation));
+    EXPECT_TRUE(configDir.removeRecursively());
+    QDir().mkpath(configDir.path());
+    auto settings = ConfigStore::forFile(
+                configDir.absoluteFilePath(QStringLiteral("config")));
+    settings->setValue(QStringLiteral("keyAlgorithm"), QStringLiteral("dsa"));
+
+    NiceMock<MockLinkProvider> linkProvider;
+    EXPECT_CALL(linkProvider, onStart()).Times(0);
+    {
+        TestDaemon daemon({ &linkProvider });
+        for (int i = 0; i < 100 && daemon.errors == 0; ++i) {
+            QTest::qWait(50);
+        }
+        EXPECT_EQ(daemon.errors, 1);
+        EXPECT_FALSE(daemon.isReady());
+
+        // no retries, so nothing is reported again
+        QTest::qWait(200);
+        EXPECT_EQ(daemon.errors, 1);
+    }
+
+    settings->remove(QStringLiteral("keyAlgorithm"));
+    settings->flush();
+}
@@ -23,8 +23,10 @@
 #include <gmock/gmock.h>
 
 #include <QSslCertificate>
+#include <QElapsedTimer>
 #include <QSignalSpy>
 #include <QVariant>
+#include <QBuffer>
 
 #include <sailfishconnect/kdeconnectconfig.h>
 #include <sailfishconnect/device.h>
@@ -32,14 +34,18 @@
 #include <sailfishconnect/helper/cpphelper.h>
 #include <sailfishconnect/networkpacket.h>
 #include <sailfishconnect/networkpackettypes.h>
+#include <sailfishconnect/pluginloader.h>
 
 #include "mock_devicelink.h"
 #include "mock_linkprovider.h"
 #include "mock_pairinghandler.h"
+#include "mock_lazy_plugin.h"
+#include "mock_plugin.h"
 
 using namespace SailfishConnect;
 using ::testing::Return;
 using ::testing::InvokeWithoutArgs;
+using ::testing::Invoke;
 using ::testing::_;
 using ::testing::NiceMock;
 
@@ -485,3 +491,239 @@ TEST_F(UnpairedDeviceTests, sanitizeDeviceId)
 
     device.removeLink(&link);
 }
+
+TEST_F(PairedDeviceTests, sendPacketFailsOver)
+{
+    MockLinkProvider backupProvider(
+                QStringLiteral("BackupLinkProvider"),
+                LinkProvider::PRIORITY_LOW);
+    NiceMock<MockDeviceLink> backupLink(deviceId, &backupProvider);
+
+    Device device(nullptr, &kcc, deviceId);
+    device.addLink(identityPacket, &link);
+    device.addLink(identityPacket, &backupLink);
+
+    // the preferred link fails and the packet goes out on the backup link
+    {
+        ::testing::InSequence sequence;
+        EXPECT_CALL(link, sendPacket(_, _)).WillOnce(Return(false));
+        EXPECT_CALL(backupLink, sendPacket(_, _)).WillOnce(Return(true));
+    }
+    NetworkPacket np(QStringLiteral("kdeconnect.ping"));
+    EXPECT_TRUE(device.sendPacket(np));
+    EXPECT_EQ(link.sendErrors(), 1);
+    EXPECT_EQ(backupLink.sendErrors(), 0);
+
+    // after repeated failures the backup link is tried first
+    EXPECT_CALL(link, sendPacket(_, _)).WillOnce(Return(false));
+    EXPECT_CALL(backupLink, sendPacket(_, _)).WillOnce(Return(true));
+    EXPECT_TRUE(device.sendPacket(np));
+    EXPECT_LT(link.score(), backupLink.score());
+
+    EXPECT_CALL(link, sendPacket(_, _)).Times(0);
+    EXPECT_CALL(backupLink, sendPacket(_, _)).WillOnce(Return(true));
+    EXPECT_TRUE(device.sendPacket(np));
+
+    device.removeLink(&backupLink);
+    device.removeLink(&link);
+}
+
+TEST_F(PairedDeviceTests, primaryLinkRecovers)
+{
+    MockLinkProvider backupProvider(
+                QStringLiteral("BackupLinkProvider"),
+                LinkProvider::PRIORITY_LOW);
+    NiceMock<MockDeviceLink> backupLink(deviceId, &backupProvider);
+
+    Device device(nullptr, &kcc, deviceId);
+    device.addLink(identityPacket, &link);
+    device.addLink(identityPacket, &backupLink);
+
+    NetworkPacket np(QStringLiteral("kdeconnect.ping"));
+    EXPECT_CALL(link, sendPacket(_, _)).Times(2).WillRepeatedly(Return(false));
+    EXPECT_CALL(backupLink, sendPacket(_, _)).Times(2).WillRepeatedly(Return(true));
+    EXPECT_TRUE(device.sendPacket(np));
+    EXPECT_TRUE(device.sendPacket(np));
+    EXPECT_LT(link.score(), backupLink.score());
+
+    // a packet received over the preferred link shows that it works again
+    Q_EMIT link.receivedPacket(NetworkPacket(QStringLiteral("kdeconnect.ping")));
+    EXPECT_EQ(link.sendErrors(), 0);
+    EXPECT_GT(link.score(), backupLink.score());
+
+    EXPECT_CALL(link, sendPacket(_, _)).WillOnce(Return(true));
+    EXPECT_CALL(backupLink, sendPacket(_, _)).Times(0);
+    EXPECT_TRUE(device.sendPacket(np));
+
+    device.removeLink(&backupLink);
+    device.removeLink(&link);
+}
+
+TEST_F(PairedDeviceTests, payloadIsRewoundForFailover)
+{
+    MockLinkProvider backupProvider(
+                QStringLiteral("BackupLinkProvider"),
+                LinkProvider::PRIORITY_LOW);
+    NiceMock<MockDeviceLink> backupLink(deviceId, &backupProvider);
+
+    Device device(nullptr, &kcc, deviceId);
+    device.addLink(identityPacket, &link);
+    device.addLink(identityPacket, &backupLink);
+
+    auto payload = QSharedPointer<QBuffer>::create();
+    payload->setData(QByteArray("payload"));
+    payload->open(QIODevice::ReadOnly);
+    NetworkPacket np(QStringLiteral("kdeconnect.share.request"));
+    np.setPayload(payload, payload->size());
+
+    qint64 backupOffset = -1;
+    EXPECT_CALL(link, sendPacket(_, _))
+            .WillOnce(Invoke([](NetworkPacket& packet, KJobTrackerInterface*) {
+                packet.payload()->readAll();
+                return false;
+            }));
+    EXPECT_CALL(backupLink, sendPacket(_, _))
+            .WillOnce(Invoke([&](NetworkPacket& packet, KJobTrackerInterface*) {
+                backupOffset = packet.payload()->pos();
+                return true;
+            }));
+    EXPECT_TRUE(device.sendPacket(np));
+    EXPECT_EQ(backupOffset, 0);
+
+    device.removeLink(&backupLink);
+    device.removeLink(&link);
+}
+
+TEST_F(PairedDeviceTests, externalTrustChange)
+{
+    Device device(nullptr, &kcc, deviceId);
+    QSignalSpy trustedChangedSpy(&device, &Device::trustedChanged);
+
+    kcc.removeTrustedDevice(deviceId);
+    EXPECT_FALSE(device.isTrusted());
+
+    kcc.addTrustedDevice(deviceId, deviceName, deviceType);
+    EXPECT_TRUE(device.isTrusted());
+
+    EXPECT_EQ(trustedChangedSpy, toVVList({{false}, {true}}));
+}
+
+TEST_F(PairedDeviceTests, pluginEnablement)
+{
+    const QString pluginId = QStringLiteral("MockPlugin");
+    {
+        Device device(nullptr, &kcc, deviceId);
+        EXPECT_TRUE(device.isPluginEnabled(pluginId));
+
+        device.setPluginEnabled(pluginId, false);
+        EXPECT_FALSE(device.isPluginEnabled(pluginId));
+    }
+
+    Device device(nullptr, &kcc, deviceId);
+    EXPECT_FALSE(device.isPluginEnabled(pluginId));
+
+    device.setPluginEnabled(pluginId, true);
+    EXPECT_TRUE(device.isPluginEnabled(pluginId));
+}
+
+TEST_F(PairedDeviceTests, packetDispatch)
+{
+    identityPacket.set(
+                QStringLiteral("incomingCapabilities"),
+                QStringList { PACKET_TYPE_TEST });
+    identityPacket.set(
+                QStringLiteral("outgoingCapabilities"),
+                QStringList { PACKET_TYPE_TEST });
+
+    Device device(nullptr, &kcc, deviceId);
+    device.addLink(identityPacket, &link);
+
+    auto* plugin = qobject_cast<MockPlugin*>(
+                device.plugin(QStringLiteral("MockPlugin")));
+    ASSERT_NE(plugin, nullptr);
+
+    const NetworkPacket np(PACKET_TYPE_TEST);
+    const NetworkPacket unsupported(QStringLiteral("kdeconnect.unsupported"));
+    Q_EMIT link.receivedPacket(unsupported);
+    EXPECT_EQ(plugin->receivedPackets.size(), 0);
+
+    const int packets = 100000;
+    plugin->receivedPackets.reserve(packets);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < packets; ++i) {
+        Q_EMIT link.receivedPacket(np);
+    }
+    RecordProperty("dispatchNsPerPacket", int(timer.nsecsElapsed() / packets));
+    EXPECT_EQ(plugin->receivedPackets.size(), packets);
+
+    device.removeLink(&link);
+}
+
+TEST_F(PairedDeviceTests, loadPluginOnDemand)
+{
+    identityPacket.set(
+                QStringLiteral("incomingCapabilities"),
+                QStringList { PACKET_TYPE_TEST_LAZY });
+    identityPacket.set(
+                QStringLiteral("outgoingCapabilities"),
+                QStringList { PACKET_TYPE_TEST_LAZY });
+
+    const QString pluginId = QStringLiteral("LazyMockPlugin");
+    Device device(nullptr, &kcc, deviceId);
+    auto instances = [&]() {
+        int result = 0;
+        for (auto* plugin : device.findChildren<KdeConnectPlugin*>()) {
+            if (plugin->id() == pluginId)
+                ++result;
+        }
+        return result;
+    };
+
+    // loaded by the first packet
+    device.addLink(identityPacket, &link);
+    EXPECT_TRUE(device.hasPlugin(pluginId));
+    EXPECT_EQ(instances(), 0);
+
+    Q_EMIT link.receivedPacket(NetworkPacket(PACKET_TYPE_TEST_LAZY));
+    EXPECT_EQ(instances(), 1);
+
+    auto* plugin = qobject_cast<MockPlugin*>(device.plugin(pluginId));
+    ASSERT_NE(plugin, nullptr);
+    EXPECT_EQ(plugin->receivedPackets.size(), 1);
+
+    Q_EMIT link.receivedPacket(NetworkPacket(PACKET_TYPE_TEST_LAZY));
+    EXPECT_EQ(plugin->receivedPackets.size(), 2);
+    EXPECT_EQ(instances(), 1);
+
+    device.removeLink(&link);
+    EXPECT_FALSE(device.hasPlugin(pluginId));
+    EXPECT_EQ(instances(), 0);
+
+    // loaded by the first access
+    device.addLink(identityPacket, &link);
+    EXPECT_EQ(instances(), 0);
+    EXPECT_NE(device.plugin(pluginId), nullptr);
+    EXPECT_EQ(instances(), 1);
+
+    device.removeLink(&link);
+}
+
+TEST(PluginManagerTests, pluginsForCapabilities)
+{
+    PluginManager* pluginManager = PluginManager::instance();
+    const auto test = pluginManager->capabilities(
+                { PACKET_TYPE_TEST, QStringLiteral("kdeconnect.unknown") });
+    EXPECT_EQ(test.count(), 1u);
+    EXPECT_TRUE(pluginManager->capabilities({}).none());
+
+    const QSet<QString> plugins =
+            pluginManager->pluginsForCapabilities(test, test);
+    EXPECT_TRUE(plugins.contains(QStringLiteral("MockPlugin")));
+    EXPECT_FALSE(plugins.contains(QStringLiteral("LazyMockPlugin")));
+
+    const QSet<QString> outgoingOnly =
+            pluginManager->pluginsForCapabilities(
+                PluginManager::Capabilities(), test);
+    EXPECT_TRUE(outgoingOnly.contains(QStringLiteral("MockPlugin")));
+}
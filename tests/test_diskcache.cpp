@@ -0,0 +1,181 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QtTest/QTest>
+
+#include <sailfishconnect/io/diskcache.h>
+
+#include <utime.h>
+
+using namespace SailfishConnect;
+
+class DiskCacheTests : public ::testing::Test {
+protected:
+    DiskCacheTests()
+        : m_app(_argn, nullptr)
+        , path(dir.path() + QStringLiteral("/cache"))
+    { }
+
+    void addFile(DiskCache& cache, const QString& key, int size)
+    {
+        const QString fileName = key + QStringLiteral(".png");
+        QFile file(cache.directory() + QLatin1Char('/') + fileName);
+        file.open(QIODevice::WriteOnly);
+        file.write(QByteArray(size, 'x'));
+        file.close();
+        cache.insert(key, fileName, size);
+    }
+
+    static void setModified(const QString& filePath, time_t time)
+    {
+        struct utimbuf times;
+        times.actime = time;
+        times.modtime = time;
+        ASSERT_EQ(utime(QFile::encodeName(filePath).constData(), &times), 0);
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+    QTemporaryDir dir;
+    QString path;
+};
+
+TEST_F(DiskCacheTests, evictLeastRecentlyUsed) {
+    DiskCache cache(path, 300);
+    addFile(cache, QStringLiteral("a"), 100);
+    addFile(cache, QStringLiteral("b"), 100);
+    addFile(cache, QStringLiteral("c"), 100);
+
+    EXPECT_FALSE(cache.lookup(QStringLiteral("a")).isNull());
+    addFile(cache, QStringLiteral("d"), 100);
+
+    EXPECT_TRUE(cache.contains(QStringLiteral("a")));
+    EXPECT_FALSE(cache.contains(QStringLiteral("b")));
+    EXPECT_FALSE(QFile::exists(path + QStringLiteral("/b.png")));
+    EXPECT_EQ(cache.size(), 300);
+    EXPECT_EQ(cache.evictionCount(), 1u);
+}
+
+TEST_F(DiskCacheTests, hitsAndMisses) {
+    DiskCache cache(path, 1000);
+    addFile(cache, QStringLiteral("a"), 10);
+
+    EXPECT_EQ(cache.lookup(QStringLiteral("a")),
+              path + QStringLiteral("/a.png"));
+    EXPECT_TRUE(cache.lookup(QStringLiteral("b")).isNull());
+
+    EXPECT_EQ(cache.hitCount(), 1u);
+    EXPECT_EQ(cache.missCount(), 1u);
+}
+
+TEST_F(DiskCacheTests, persistentIndex) {
+    {
+        DiskCache cache(path, 1000);
+        addFile(cache, QStringLiteral("a"), 10);
+        addFile(cache, QStringLiteral("b"), 20);
+        cache.setMetadata(QStringLiteral("b"), QByteArray("etag"));
+        cache.markFailed(QStringLiteral("c"));
+    }
+
+    DiskCache cache(path, 1000);
+    EXPECT_TRUE(cache.loadedFromIndex());
+    EXPECT_EQ(cache.count(), 3);
+    EXPECT_EQ(cache.size(), 30);
+    EXPECT_TRUE(cache.contains(QStringLiteral("b")));
+    EXPECT_EQ(cache.metadata(QStringLiteral("b")), QByteArray("etag"));
+    EXPECT_TRUE(cache.hasFailed(QStringLiteral("c")));
+}
+
+TEST_F(DiskCacheTests, rescanChangedDirectory) {
+    const time_t indexedTime = 1500000000;
+    {
+        DiskCache cache(path, 1000);
+        addFile(cache, QStringLiteral("a"), 10);
+        // the index records this directory time when saved on destruction
+        setModified(path, indexedTime);
+    }
+
+    // written behind our back, e.g. index not saved before a crash
+    QFile file(path + QStringLiteral("/b.png"));
+    file.open(QIODevice::WriteOnly);
+    file.write(QByteArray(20, 'x'));
+    file.close();
+    // still older than the index file, a stale index must not be trusted
+    setModified(path, indexedTime + 1);
+
+    DiskCache cache(path, 1000);
+    EXPECT_FALSE(cache.loadedFromIndex());
+    EXPECT_TRUE(cache.contains(QStringLiteral("a")));
+    EXPECT_TRUE(cache.contains(QStringLiteral("b")));
+    EXPECT_EQ(cache.size(), 30);
+}
+
+TEST_F(DiskCacheTests, retryFailedAfterTtl) {
+    DiskCache cache(path, 1000);
+    cache.setFailureTtl(50);
+    cache.markFailed(QStringLiteral("a"));
+
+    EXPECT_TRUE(cache.hasFailed(QStringLiteral("a")));
+    EXPECT_FALSE(cache.contains(QStringLiteral("a")));
+
+    QTest::qWait(60);
+    EXPECT_FALSE(cache.hasFailed(QStringLiteral("a")));
+
+    addFile(cache, QStringLiteral("a"), 10);
+    EXPECT_TRUE(cache.contains(QStringLiteral("a")));
+    EXPECT_FALSE(cache.hasFailed(QStringLiteral("a")));
+}
+
+TEST_F(DiskCacheTests, groupBudget) {
+    DiskCacheGroup group(250);
+    DiskCache cache1(path + QStringLiteral("1"), 200);
+    DiskCache cache2(path + QStringLiteral("2"), 200);
+    cache1.setGroup(&group);
+    cache2.setGroup(&group);
+
+    addFile(cache1, QStringLiteral("a"), 100);
+    addFile(cache2, QStringLiteral("b"), 100);
+    addFile(cache1, QStringLiteral("c"), 100);
+
+    EXPECT_EQ(group.size(), 200);
+    EXPECT_FALSE(cache1.contains(QStringLiteral("a")));
+    EXPECT_TRUE(cache2.contains(QStringLiteral("b")));
+    EXPECT_TRUE(cache1.contains(QStringLiteral("c")));
+}
+
+TEST_F(DiskCacheTests, announceChanges) {
+    DiskCache cache(path, 150);
+    QSignalSpy inserted(&cache, &DiskCache::inserted);
+    QSignalSpy removed(&cache, &DiskCache::removed);
+
+    addFile(cache, QStringLiteral("a"), 100);
+    addFile(cache, QStringLiteral("b"), 100);
+
+    ASSERT_EQ(inserted.count(), 2);
+    ASSERT_EQ(removed.count(), 1);
+    EXPECT_EQ(removed.at(0).at(0).toString(), QStringLiteral("a"));
+    EXPECT_EQ(cache.keys(), QStringList({QStringLiteral("b")}));
+    EXPECT_EQ(cache.filePath(QStringLiteral("b")),
+              path + QStringLiteral("/b.png"));
+    EXPECT_EQ(cache.hitCount(), 0u);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QNetworkAccessManager>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtTest/QTest>
+
+#include <sailfishconnect/io/httpfetcher.h>
+
+using namespace SailfishConnect;
+
+namespace {
+
+/**
+ * Minimal HTTP server: "/art" is served with an ETag and revalidated,
+ * requests to "/hang..." are never answered.
+ */
+class HttpStandIn : public QObject
+{
+public:
+    HttpStandIn()
+    {
+        m_server.listen(QHostAddress::LocalHost);
+        connect(&m_server, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket* socket = m_server.nextPendingConnection()) {
+                connect(socket, &QTcpSocket::readyRead,
+                        this, [this, socket]() { readRequest(socket); });
+            }
+        });
+    }
+
+    QUrl url(const QString& path) const
+    {
+        return QUrl(QStringLiteral("http://127.0.0.1:%1%2")
+                    .arg(m_server.serverPort()).arg(path));
+    }
+
+    QList<QByteArray> requests;
+
+private:
+    void readRequest(QTcpSocket* socket)
+    {
+        QByteArray& buffer = m_buffers[socket];
+        buffer += socket->readAll();
+
+        int end;
+        while ((end = buffer.indexOf("\r\n\r\n")) >= 0) {
+            QByteArray request = buffer.left(end);
+            buffer.remove(0, end + 4);
+            requests.append(request);
+            respond(socket, request);
+        }
+    }
+
+    void respond(QTcpSocket* socket, const QByteArray& request)
+    {
+        if (request.startsWith("GET /hang"))
+            return;
+
+        if (!request.startsWith("GET /art ")) {
+            socket->write("HTTP/1.1 404 Not Found\r\n"
+                          "Content-Length: 0\r\n\r\n");
+            return;
+        }
+
+        if (request.contains("If-None-Match: \"v1\"")) {
+            socket->write("HTTP/1.1 304 Not Modified\r\n"
+                          "ETag: \"v1\"\r\n"
+                          "Content-Length: 0\r\n\r\n");
+            return;
+        }
+
+        socket->write("HTTP/1.1 200 OK\r\n"
+                      "ETag: \"v1\"\r\n"
+                      "Last-Modified: Mon, 01 Apr 2019 10:00:00 GMT\r\n"
+                      "Content-Length: 5\r\n\r\n"
+                      "image");
+    }
+
+    QTcpServer m_server;
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+};
+
+} // namespace
+
+class HttpFetcherTests : public ::testing::Test {
+protected:
+    HttpFetcherTests()
+        : m_app(_argn, nullptr)
+        , fetcher(&network)
+    {
+        QObject::connect(
+            &fetcher, &HttpFetcher::finished,
+            [this](const QUrl& url, const HttpFetcher::Result& result) {
+                urls.append(url);
+                results.append(result);
+            });
+    }
+
+    void waitForResults(int count)
+    {
+        for (int i = 0; i < 100 && results.size() < count; ++i) {
+            QTest::qWait(20);
+        }
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+    HttpStandIn server;
+    QNetworkAccessManager network;
+    HttpFetcher fetcher;
+    QList<QUrl> urls;
+    QList<HttpFetcher::Result> results;
+};
+
+TEST_F(HttpFetcherTests, fetchAndRevalidate) {
+    fetcher.fetch(server.url(QStringLiteral("/art")));
+    waitForResults(1);
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].status, HttpFetcher::Ok);
+    EXPECT_EQ(results[0].data, QByteArray("image"));
+    EXPECT_EQ(results[0].validators.etag, QByteArray("\"v1\""));
+    EXPECT_EQ(results[0].validators.lastModified,
+              QByteArray("Mon, 01 Apr 2019 10:00:00 GMT"));
+
+    fetcher.fetch(server.url(QStringLiteral("/art")), results[0].validators);
+    waitForResults(2);
+
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(results[1].status, HttpFetcher::NotModified);
+    EXPECT_TRUE(results[1].data.isEmpty());
+    EXPECT_EQ(fetcher.notModifiedCount(), 1u);
+    EXPECT_EQ(server.requests.size(), 2);
+}
+
+TEST_F(HttpFetcherTests, failedRequest) {
+    fetcher.fetch(server.url(QStringLiteral("/missing")));
+    waitForResults(1);
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].status, HttpFetcher::Failed);
+    EXPECT_FALSE(results[0].errorString.isEmpty());
+}
+
+TEST_F(HttpFetcherTests, coalesceIdenticalUrls) {
+    fetcher.fetch(server.url(QStringLiteral("/art")));
+    fetcher.fetch(server.url(QStringLiteral("/art")));
+    EXPECT_TRUE(fetcher.isFetching(server.url(QStringLiteral("/art"))));
+
+    waitForResults(1);
+    QTest::qWait(50);
+
+    EXPECT_EQ(results.size(), 1);
+    EXPECT_EQ(server.requests.size(), 1);
+    EXPECT_EQ(fetcher.coalescedCount(), 1u);
+}
+
+TEST_F(HttpFetcherTests, contentForCoalescedRequesterWithoutCopy) {
+    HttpFetcher::Validators validators;
+    validators.etag = "\"v1\"";
+    fetcher.fetch(server.url(QStringLiteral("/art")), validators);
+    fetcher.fetch(server.url(QStringLiteral("/art")));
+
+    waitForResults(1);
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].status, HttpFetcher::Ok);
+    EXPECT_EQ(results[0].data, QByteArray("image"));
+}
+
+TEST_F(HttpFetcherTests, timeout) {
+    fetcher.setTimeout(100);
+    fetcher.fetch(server.url(QStringLiteral("/hang")));
+    waitForResults(1);
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].status, HttpFetcher::Failed);
+    EXPECT_EQ(fetcher.timeoutCount(), 1u);
+    EXPECT_EQ(fetcher.runningCount(), 0);
+}
+
+TEST_F(HttpFetcherTests, limitConcurrentRequests) {
+    fetcher.setTimeout(200);
+    fetcher.setMaxConcurrent(1);
+    fetcher.fetch(server.url(QStringLiteral("/hang1")));
+    fetcher.fetch(server.url(QStringLiteral("/hang2")));
+
+    EXPECT_EQ(fetcher.runningCount(), 1);
+    EXPECT_EQ(fetcher.queuedCount(), 1);
+
+    QTest::qWait(100);
+    EXPECT_EQ(server.requests.size(), 1);
+
+    waitForResults(2);
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(urls[0], server.url(QStringLiteral("/hang1")));
+    EXPECT_EQ(urls[1], server.url(QStringLiteral("/hang2")));
+    EXPECT_EQ(server.requests.size(), 2);
+}
@@ -24,9 +24,15 @@
 
 #include <QSslCertificate>
 #include <QSslKey>
+#include <QSslSocket>
 #include <QSignalSpy>
 #include <QVariant>
 #include <QCoreApplication>
+#include <QTcpSocket>
+#include <QTcpServer>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QTest>
 
 #include <sailfishconnect/kdeconnectconfig.h>
 #include <sailfishconnect/device.h>
@@ -35,6 +41,7 @@
 #include <sailfishconnect/networkpacket.h>
 #include <sailfishconnect/networkpackettypes.h>
 #include <sailfishconnect/backend/lan/lanlinkprovider.h>
+#include <sailfishconnect/backend/lan/landevicelink.h>
 #include <sailfishconnect/helper/sslhelper.h>
 
 #include "mock_devicelink.h"
@@ -47,6 +54,20 @@ using ::testing::InvokeWithoutArgs;
 using ::testing::_;
 using ::testing::NiceMock;
 
+namespace {
+
+// Accepts connections as QSslSocket to be able to answer with TLS
+class SslServer : public QTcpServer {
+protected:
+    void incomingConnection(qintptr descriptor) override {
+        auto* socket = new QSslSocket(this);
+        socket->setSocketDescriptor(descriptor);
+        addPendingConnection(socket);
+    }
+};
+
+} // namespace
+
 
 class LanLinkProviderTests : public ::testing::Test {
 protected:
@@ -92,6 +113,8 @@ protected:
     void setSocketAttributes(QSslSocket* socket);
     void testIdentityPacket(QByteArray& identityPacket);
     QSslCertificate generateCertificate(const QString&, const QSslKey&);
+    LanDeviceLink* createLink(QTcpServer* server, QTcpSocket** peer);
+    static void answerHeartbeats(QTcpSocket* peer, qint64 seqOffset = 0);
 };
 
 
@@ -151,6 +174,222 @@ protected:
 //    delete mUdpServer;
 //}
 
+TEST_F(LanLinkProviderTests, identityStartsEncryption) {
+    QTcpSocket socket;
+    QSignalSpy connectedSpy(&socket, SIGNAL(connected()));
+    socket.connectToHost(QHostAddress::LocalHost, LanLinkProvider::MIN_TCP_PORT);
+    ASSERT_TRUE(connectedSpy.wait());
+
+    // the provider answers with a TLS client hello
+    QSignalSpy readyReadSpy(&socket, SIGNAL(readyRead()));
+    socket.write(m_identityPacket.toLatin1());
+    ASSERT_TRUE(readyReadSpy.wait());
+
+    auto receiving = LanLinkProvider::HandshakeStage::ReceivingIdentity;
+    EXPECT_EQ(m_lanLinkProvider.handshakeLatency(receiving).count(), 1u);
+    EXPECT_EQ(m_lanLinkProvider.handshakeTimeouts(), 0u);
+}
+
+TEST_F(LanLinkProviderTests, silentPeerTimesOut) {
+    QTcpSocket socket;
+    QSignalSpy connectedSpy(&socket, SIGNAL(connected()));
+    socket.connectToHost(QHostAddress::LocalHost, LanLinkProvider::MIN_TCP_PORT);
+    ASSERT_TRUE(connectedSpy.wait());
+
+    QSignalSpy disconnectedSpy(&socket, SIGNAL(disconnected()));
+    ASSERT_TRUE(disconnectedSpy.wait(LanLinkProvider::IDENTITY_TIMEOUT + 2000));
+
+    EXPECT_EQ(m_lanLinkProvider.handshakeTimeouts(), 1u);
+    auto receiving = LanLinkProvider::HandshakeStage::ReceivingIdentity;
+    EXPECT_EQ(m_lanLinkProvider.handshakeLatency(receiving).count(), 0u);
+}
+
+TEST_F(LanLinkProviderTests, lastEndpointIsDialedDirectly) {
+    QTcpServer server;
+    ASSERT_TRUE(server.listen(QHostAddress::LocalHost, TEST_PORT));
+    QSignalSpy newConnectionSpy(&server, SIGNAL(newConnection()));
+    addTrustedDevice();
+
+    // without a known endpoint nothing is dialed directly
+    m_lanLinkProvider.onNetworkChange(QStringLiteral("test"));
+    EXPECT_FALSE(newConnectionSpy.wait(500));
+
+    KdeConnectConfig::Endpoint endpoint;
+    endpoint.address = QHostAddress::LocalHost;
+    endpoint.tcpPort = quint16(TEST_PORT);
+    kcc.setLastEndpoint(deviceId, endpoint);
+
+    QElapsedTimer timer;
+    timer.start();
+    m_lanLinkProvider.onNetworkChange(QStringLiteral("test"));
+    ASSERT_TRUE(newConnectionSpy.wait(1000));
+    const qint64 timeToReachable = timer.elapsed();
+    RecordProperty("timeToReachableWithCacheMs", int(timeToReachable));
+
+    QTcpSocket* socket = server.nextPendingConnection();
+    ASSERT_NE(socket, nullptr);
+    QSignalSpy readyReadSpy(socket, SIGNAL(readyRead()));
+    ASSERT_TRUE(socket->canReadLine() || readyReadSpy.wait());
+    QByteArray identity = socket->readLine();
+    testIdentityPacket(identity);
+
+    removeTrustedDevice();
+}
+
+TEST_F(LanLinkProviderTests, staleEndpointIsForgotten) {
+    // another peer with another certificate took the remembered address
+    SslServer server;
+    ASSERT_TRUE(server.listen(QHostAddress::LocalHost, TEST_PORT));
+    QSignalSpy newConnectionSpy(&server, SIGNAL(newConnection()));
+    addTrustedDevice();
+
+    KdeConnectConfig::Endpoint endpoint;
+    endpoint.address = QHostAddress::LocalHost;
+    endpoint.tcpPort = quint16(TEST_PORT);
+    kcc.setLastEndpoint(deviceId, endpoint);
+
+    m_lanLinkProvider.onNetworkChange(QStringLiteral("test"));
+    ASSERT_TRUE(newConnectionSpy.wait(1000));
+    auto* peer = qobject_cast<QSslSocket*>(server.nextPendingConnection());
+    ASSERT_NE(peer, nullptr);
+    QSignalSpy readyReadSpy(peer, SIGNAL(readyRead()));
+    ASSERT_TRUE(peer->canReadLine() || readyReadSpy.wait());
+    peer->readLine();
+
+    QSignalSpy disconnectedSpy(peer, SIGNAL(disconnected()));
+    setSocketAttributes(peer);
+    peer->setPeerVerifyMode(QSslSocket::QueryPeer);
+    peer->startServerEncryption();
+    ASSERT_TRUE(disconnectedSpy.wait(5000));
+
+    EXPECT_FALSE(kcc.lastEndpoint(deviceId).isValid());
+    EXPECT_TRUE(kcc.isTrustedDevice(deviceId));
+
+    removeTrustedDevice();
+}
+
+TEST_F(LanLinkProviderTests, heartbeatMeasuresRoundTrip) {
+    QTcpServer server;
+    QTcpSocket* peer = nullptr;
+    QPointer<LanDeviceLink> link = createLink(&server, &peer);
+    ASSERT_NE(link, nullptr);
+    answerHeartbeats(peer);
+
+    QSignalSpy statisticsSpy(link.data(), &DeviceLink::statisticsChanged);
+    link->setHeartbeatEnabled(true);
+    ASSERT_TRUE(statisticsSpy.wait(1000));
+
+    EXPECT_GE(link->rtt(), 0);
+    EXPECT_EQ(link->packetLoss(), 0.0);
+    EXPECT_EQ(link->missedHeartbeats(), 0);
+
+    delete link;
+}
+
+TEST_F(LanLinkProviderTests, heartbeatWithWrongSequenceIsLost) {
+    QTcpServer server;
+    QTcpSocket* peer = nullptr;
+    QPointer<LanDeviceLink> link = createLink(&server, &peer);
+    ASSERT_NE(link, nullptr);
+    answerHeartbeats(peer, 1);
+
+    QSignalSpy statisticsSpy(link.data(), &DeviceLink::statisticsChanged);
+    link->setHeartbeatEnabled(true);
+    ASSERT_TRUE(statisticsSpy.wait(1000));
+
+    EXPECT_EQ(link->rtt(), -1);
+    EXPECT_GT(link->packetLoss(), 0.0);
+
+    delete link;
+}
+
+TEST_F(LanLinkProviderTests, silentPeerClosesLink) {
+    QTcpServer server;
+    QTcpSocket* peer = nullptr;
+    QPointer<LanDeviceLink> link = createLink(&server, &peer);
+    ASSERT_NE(link, nullptr);
+    link->setHeartbeatInterval(100);
+
+    QSignalSpy statisticsSpy(link.data(), &DeviceLink::statisticsChanged);
+    QSignalSpy disconnectedSpy(peer, SIGNAL(disconnected()));
+    link->setHeartbeatEnabled(true);
+
+    // a link that missed two heartbeats refuses packets
+    ASSERT_TRUE(statisticsSpy.wait(1000));
+    NetworkPacket np(QStringLiteral("kdeconnect.ping"));
+    EXPECT_TRUE(link->sendPacket(np, nullptr));
+    ASSERT_TRUE(statisticsSpy.wait(1000));
+    EXPECT_EQ(link->missedHeartbeats(), 2);
+    EXPECT_FALSE(link->sendPacket(np, nullptr));
+
+    // and is closed after MAX_MISSED_HEARTBEATS
+    ASSERT_TRUE(disconnectedSpy.wait(1000));
+    for (int i = 0; i < 20 && link; ++i) {
+        QTest::qWait(50);
+    }
+    EXPECT_TRUE(link.isNull());
+}
+
+TEST_F(LanLinkProviderTests, heartbeatNeedsCapability) {
+    NetworkPacket identity(PACKET_TYPE_IDENTITY);
+    EXPECT_FALSE(LanLinkProvider::supportsHeartbeat(identity));
+
+    identity.set(QStringLiteral("incomingCapabilities"),
+                 QStringList { QStringLiteral("kdeconnect.ping") });
+    EXPECT_FALSE(LanLinkProvider::supportsHeartbeat(identity));
+
+    identity.set(QStringLiteral("incomingCapabilities"),
+                 QStringList { QStringLiteral("kdeconnect.ping"), PACKET_TYPE_HEARTBEAT });
+    EXPECT_TRUE(LanLinkProvider::supportsHeartbeat(identity));
+}
+
+TEST_F(LanLinkProviderTests, sslConfigurationIsCached) {
+    addTrustedDevice();
+
+    QSslSocket socket;
+    m_lanLinkProvider.configureSslSocket(&socket, deviceId, true);
+    EXPECT_EQ(socket.peerVerifyMode(), QSslSocket::VerifyPeer);
+    EXPECT_EQ(socket.peerVerifyName(), kcc.deviceId());
+    EXPECT_EQ(socket.sslConfiguration().caCertificates(),
+              QList<QSslCertificate> { kcc.certificate() });
+    EXPECT_EQ(socket.sslConfiguration().localCertificate(), kcc.certificate());
+    EXPECT_EQ(socket.sslConfiguration().privateKey(), kcc.privateKey());
+
+    // the stored certificate is only read again after invalidation
+    kcc.setDeviceProperty(
+                deviceId,
+                QStringLiteral("certificate"),
+                QString::fromLatin1(m_certificate.toPem()));
+    QSslSocket cached;
+    m_lanLinkProvider.configureSslSocket(&cached, deviceId, true);
+    EXPECT_EQ(cached.peerVerifyName(), kcc.deviceId());
+
+    m_lanLinkProvider.invalidateSslConfiguration(deviceId);
+    QSslSocket reloaded;
+    m_lanLinkProvider.configureSslSocket(&reloaded, deviceId, true);
+    EXPECT_EQ(reloaded.peerVerifyName(), deviceId);
+    EXPECT_EQ(reloaded.sslConfiguration().caCertificates(),
+              QList<QSslCertificate> { m_certificate });
+
+    const int sockets = 1000;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < sockets; ++i) {
+        QSslSocket payloadSocket;
+        m_lanLinkProvider.configureSslSocket(&payloadSocket, deviceId, true);
+    }
+    RecordProperty("configureSslSocketUs",
+                   int(timer.nsecsElapsed() / 1000 / sockets));
+
+    // unpairing drops the configuration
+    removeTrustedDevice();
+    QSslSocket untrusted;
+    m_lanLinkProvider.configureSslSocket(&untrusted, deviceId, false);
+    EXPECT_EQ(untrusted.peerVerifyMode(), QSslSocket::QueryPeer);
+    EXPECT_EQ(untrusted.peerVerifyName(), deviceId);
+    EXPECT_TRUE(untrusted.sslConfiguration().caCertificates().isEmpty());
+}
+
 void LanLinkProviderTests::testIdentityPacket(QByteArray& identityPacket)
 {
     QJsonDocument jsonDocument = QJsonDocument::fromJson(identityPacket);
@@ -183,6 +422,46 @@ QSslCertificate LanLinkProviderTests::generateCertificate(const QString& commonN
             .selfSigned(privateKey);
 }
 
+LanDeviceLink* LanLinkProviderTests::createLink(
+        QTcpServer* server, QTcpSocket** peer)
+{
+    if (!server->listen(QHostAddress::LocalHost))
+        return nullptr;
+
+    auto* socket = new QSslSocket();
+    socket->connectToHost(QHostAddress::LocalHost, server->serverPort());
+    if (!socket->waitForConnected(1000)
+            || !server->waitForNewConnection(1000)) {
+        delete socket;
+        return nullptr;
+    }
+    *peer = server->nextPendingConnection();
+
+    auto* link = new LanDeviceLink(
+                deviceId, &m_lanLinkProvider, socket, LanDeviceLink::Locally);
+    link->setHeartbeatInterval(50);
+    return link;
+}
+
+void LanLinkProviderTests::answerHeartbeats(QTcpSocket* peer, qint64 seqOffset)
+{
+    QObject::connect(peer, &QIODevice::readyRead, peer, [peer, seqOffset]() {
+        while (peer->canReadLine()) {
+            NetworkPacket np;
+            NetworkPacket::unserialize(peer->readLine(), &np);
+            if (np.type() != PACKET_TYPE_HEARTBEAT
+                    || np.get<bool>(QStringLiteral("pong")))
+                continue;
+
+            NetworkPacket pong(PACKET_TYPE_HEARTBEAT);
+            pong.set(QStringLiteral("seq"),
+                     np.get<qint64>(QStringLiteral("seq")) + seqOffset);
+            pong.set(QStringLiteral("pong"), true);
+            peer->write(pong.serialize());
+        }
+    });
+}
+
 void LanLinkProviderTests::setSocketAttributes(QSslSocket* socket)
 {
     socket->setPrivateKey(m_privateKey);
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <sailfishconnect/helper/latencyhistogram.h>
+
+using namespace SailfishConnect;
+
+TEST(LatencyHistogramTests, empty) {
+    LatencyHistogram histogram;
+
+    EXPECT_EQ(histogram.count(), 0u);
+    EXPECT_EQ(histogram.mean(), 0);
+    EXPECT_EQ(histogram.percentile(50), 0);
+}
+
+TEST(LatencyHistogramTests, buckets) {
+    LatencyHistogram histogram;
+    histogram.add(0);
+    histogram.add(1);
+    histogram.add(3);
+    histogram.add(4);
+    histogram.add(1000000);
+
+    EXPECT_EQ(histogram.count(), 5u);
+    EXPECT_EQ(histogram.bucket(0), 2u);
+    EXPECT_EQ(histogram.bucket(2), 2u);
+    EXPECT_EQ(histogram.bucket(LatencyHistogram::BucketCount - 1), 1u);
+    EXPECT_EQ(histogram.min(), 0);
+    EXPECT_EQ(histogram.max(), 1000000);
+}
+
+TEST(LatencyHistogramTests, percentile) {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 90; ++i)
+        histogram.add(10);
+    for (int i = 0; i < 10; ++i)
+        histogram.add(100);
+
+    EXPECT_EQ(histogram.percentile(50), 16);
+    EXPECT_EQ(histogram.percentile(90), 16);
+    EXPECT_EQ(histogram.percentile(99), 128);
+    EXPECT_EQ(histogram.mean(), 19);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QStandardPaths>
+
+#include <sailfishconnect/kdeconnectconfig.h>
+#include <sailfishconnect/device.h>
+#include <sailfishconnect/systeminfo.h>
+#include <sailfishconnect/helper/cpphelper.h>
+#include <sailfishconnect/networkpacket.h>
+#include <sailfishconnect/networkpackettypes.h>
+#include <sailfishconnect/backend/loopback/loopbacklinkprovider.h>
+#include <sailfishconnect/backend/loopback/loopbackdevicelink.h>
+
+#include "mock_plugin.h"
+
+using namespace SailfishConnect;
+
+namespace {
+
+NetworkPacket loopbackIdentity(const QString& deviceId)
+{
+    NetworkPacket identityPacket(PACKET_TYPE_IDENTITY);
+    identityPacket.set(QStringLiteral("deviceId"), deviceId);
+    identityPacket.set(QStringLiteral("deviceName"), deviceId);
+    identityPacket.set(QStringLiteral("deviceType"), QStringLiteral("phone"));
+    identityPacket.set(
+                QStringLiteral("protocolVersion"),
+                NetworkPacket::s_protocolVersion);
+    identityPacket.set(
+                QStringLiteral("incomingCapabilities"),
+                QStringList { PACKET_TYPE_TEST });
+    identityPacket.set(
+                QStringLiteral("outgoingCapabilities"),
+                QStringList { PACKET_TYPE_TEST });
+    return identityPacket;
+}
+
+template<typename Predicate>
+bool waitFor(Predicate predicate, int timeout = 5000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!predicate()) {
+        if (timer.hasExpired(timeout))
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * Two endpoints "alice" and "bob" in one process. Both share a config,
+ * which is fine because trust is stored per remote device id.
+ */
+class LoopbackTests : public ::testing::Test {
+protected:
+    LoopbackTests()
+        : m_app(_argn, nullptr)
+        , kcc(makeUniquePtr<SystemInfo>())
+        , alice(loopbackIdentity(QStringLiteral("alice")))
+        , bob(loopbackIdentity(QStringLiteral("bob")))
+    {
+        kcc.removeTrustedDevice(QStringLiteral("alice"));
+        kcc.removeTrustedDevice(QStringLiteral("bob"));
+
+        QObject::connect(
+                    &alice, &LinkProvider::onConnectionReceived,
+                    [this](const NetworkPacket& identity, DeviceLink* link) {
+            bobOnAlice.reset(new Device(nullptr, &kcc, identity, link));
+        });
+        QObject::connect(
+                    &bob, &LinkProvider::onConnectionReceived,
+                    [this](const NetworkPacket& identity, DeviceLink* link) {
+            aliceOnBob.reset(new Device(nullptr, &kcc, identity, link));
+        });
+
+        alice.onStart();
+        bob.onStart();
+        alice.connectTo(&bob);
+    }
+
+    static void SetUpTestCase() {
+        QStandardPaths::setTestModeEnabled(true);
+    }
+
+    void pair()
+    {
+        bobOnAlice->requestPair();
+        ASSERT_TRUE(waitFor([this]{ return aliceOnBob->hasPairingRequests(); }));
+        aliceOnBob->acceptPairing();
+        ASSERT_TRUE(waitFor([this]{ return bobOnAlice->isTrusted(); }));
+    }
+
+    MockPlugin* mockPlugin(Device* device)
+    {
+        return qobject_cast<MockPlugin*>(
+                    device->plugin(QStringLiteral("MockPlugin")));
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+
+    KdeConnectConfig kcc;
+    LoopbackLinkProvider alice;
+    LoopbackLinkProvider bob;
+    std::unique_ptr<Device> bobOnAlice;
+    std::unique_ptr<Device> aliceOnBob;
+};
+
+TEST_F(LoopbackTests, connect) {
+    ASSERT_TRUE(bobOnAlice);
+    ASSERT_TRUE(aliceOnBob);
+
+    EXPECT_EQ(bobOnAlice->id(), QStringLiteral("bob"));
+    EXPECT_EQ(aliceOnBob->id(), QStringLiteral("alice"));
+    EXPECT_TRUE(bobOnAlice->isReachable());
+    EXPECT_TRUE(aliceOnBob->isReachable());
+    EXPECT_FALSE(bobOnAlice->isTrusted());
+}
+
+TEST_F(LoopbackTests, pairing) {
+    pair();
+
+    EXPECT_TRUE(bobOnAlice->isTrusted());
+    EXPECT_TRUE(aliceOnBob->isTrusted());
+    EXPECT_NE(mockPlugin(bobOnAlice.get()), nullptr);
+    EXPECT_NE(mockPlugin(aliceOnBob.get()), nullptr);
+}
+
+TEST_F(LoopbackTests, disconnect) {
+    alice.onStop();
+
+    EXPECT_TRUE(waitFor([this]{ return !aliceOnBob->isReachable(); }));
+    EXPECT_FALSE(bobOnAlice->isReachable());
+}
+
+TEST_F(LoopbackTests, pluginDispatch) {
+    pair();
+    MockPlugin* sender = mockPlugin(bobOnAlice.get());
+    MockPlugin* receiver = mockPlugin(aliceOnBob.get());
+    ASSERT_NE(sender, nullptr);
+    ASSERT_NE(receiver, nullptr);
+
+    EXPECT_TRUE(sender->sendPacket(
+        NetworkPacket(PACKET_TYPE_TEST, {{QStringLiteral("n"), 42}})));
+
+    ASSERT_TRUE(waitFor([=]{ return receiver->receivedPackets.size() == 1; }));
+    EXPECT_EQ(receiver->receivedPackets[0].get<int>(QStringLiteral("n")), 42);
+}
+
+TEST_F(LoopbackTests, payload) {
+    pair();
+    MockPlugin* sender = mockPlugin(bobOnAlice.get());
+    MockPlugin* receiver = mockPlugin(aliceOnBob.get());
+    ASSERT_NE(sender, nullptr);
+    ASSERT_NE(receiver, nullptr);
+
+    QByteArray data(64 * 1024, 'x');
+    QSharedPointer<QBuffer> buffer(new QBuffer());
+    buffer->setData(data);
+
+    NetworkPacket np(PACKET_TYPE_TEST);
+    np.setPayload(buffer, data.size());
+    EXPECT_TRUE(sender->sendPacket(np));
+
+    ASSERT_TRUE(waitFor([=]{ return receiver->receivedPackets.size() == 1; }));
+    const NetworkPacket& received = receiver->receivedPackets[0];
+    EXPECT_EQ(received.payloadSize(), data.size());
+    ASSERT_TRUE(received.payload());
+    EXPECT_EQ(received.payload()->readAll(), data);
+}
+
+TEST_F(LoopbackTests, throughput) {
+    pair();
+    MockPlugin* sender = mockPlugin(bobOnAlice.get());
+    MockPlugin* receiver = mockPlugin(aliceOnBob.get());
+    ASSERT_NE(sender, nullptr);
+    ASSERT_NE(receiver, nullptr);
+
+    const int packetCount = 1000;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < packetCount; ++i) {
+        sender->sendPacket(
+            NetworkPacket(PACKET_TYPE_TEST, {{QStringLiteral("n"), i}}));
+    }
+    ASSERT_TRUE(waitFor(
+        [=]{ return receiver->receivedPackets.size() == packetCount; }));
+    const qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+
+    RecordProperty("packetsPerSecond", int(packetCount * 1000 / elapsed));
+    EXPECT_EQ(
+        receiver->receivedPackets.last().get<int>(QStringLiteral("n")),
+        packetCount - 1);
+}
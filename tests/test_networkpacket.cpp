@@ -71,3 +71,19 @@ TEST(NetworkPacketTests, networkPacketIdentityTest) {
               NetworkPacket::s_protocolVersion);
     EXPECT_EQ(np.type(), PACKET_TYPE_IDENTITY);
 }
+
+TEST(NetworkPacketTests, typeId) {
+    NetworkPacket ping(QStringLiteral("kdeconnect.ping"));
+    NetworkPacket otherPing(QStringLiteral("kdeconnect.ping"));
+    NetworkPacket battery(QStringLiteral("kdeconnect.battery"));
+
+    EXPECT_GE(ping.typeId(), 0);
+    EXPECT_EQ(ping.typeId(), otherPing.typeId());
+    EXPECT_NE(ping.typeId(), battery.typeId());
+    EXPECT_EQ(ping.typeId(),
+              NetworkPacket::internType(QStringLiteral("kdeconnect.ping")));
+
+    NetworkPacket unserialized;
+    NetworkPacket::unserialize(ping.serialize(), &unserialized);
+    EXPECT_EQ(unserialized.typeId(), ping.typeId());
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QCoreApplication>
+#include <QSignalSpy>
+#include <QTest>
+
+#include <sailfishconnect/helper/packetthrottle.h>
+
+using namespace SailfishConnect;
+
+class PacketThrottleTests : public ::testing::Test {
+protected:
+    PacketThrottleTests()
+        : m_app(_argn, nullptr)
+        , m_packetType(qRegisterMetaType<NetworkPacket>())
+        , spy(&throttle, &PacketThrottle::send)
+    {
+        throttle.setCoalesceWindow(20);
+        throttle.setMinInterval(100);
+    }
+
+    static NetworkPacket packet(int version)
+    {
+        return NetworkPacket(QStringLiteral("test"), {
+            {QStringLiteral("version"), version}
+        });
+    }
+
+    int lastVersion() const
+    {
+        return spy.last().at(0).value<NetworkPacket>()
+                .get<int>(QStringLiteral("version"));
+    }
+
+    int _argn = 0;
+    QCoreApplication m_app;
+    int m_packetType;
+
+    PacketThrottle throttle;
+    QSignalSpy spy;
+};
+
+TEST_F(PacketThrottleTests, firstPacketIsSentImmediately) {
+    throttle.submit(QStringLiteral("a"), packet(1));
+    ASSERT_EQ(spy.size(), 1);
+    EXPECT_EQ(lastVersion(), 1);
+    EXPECT_TRUE(throttle.contains(QStringLiteral("a")));
+
+    // other keys are not throttled by it
+    throttle.submit(QStringLiteral("b"), packet(1));
+    EXPECT_EQ(spy.size(), 2);
+}
+
+TEST_F(PacketThrottleTests, burstIsCoalesced) {
+    throttle.submit(QStringLiteral("a"), packet(1));
+    throttle.submit(QStringLiteral("a"), packet(2));
+    throttle.submit(QStringLiteral("a"), packet(3));
+    throttle.submit(QStringLiteral("a"), packet(4));
+    EXPECT_EQ(spy.size(), 1);
+
+    ASSERT_TRUE(spy.wait(1000));
+    EXPECT_EQ(spy.size(), 2);
+    EXPECT_EQ(lastVersion(), 4);
+    EXPECT_EQ(throttle.sentPackets(), 2u);
+    EXPECT_EQ(throttle.droppedPackets(), 2u);
+
+    QTest::qWait(150);
+    EXPECT_EQ(spy.size(), 2);
+}
+
+TEST_F(PacketThrottleTests, minIntervalBetweenPackets) {
+    qint64 now = 0;
+    throttle.setClock([&now]() { return now; });
+
+    throttle.submit(QStringLiteral("a"), packet(1));
+    throttle.submit(QStringLiteral("a"), packet(2));
+
+    // the timer may fire, but the clock did not reach the interval yet
+    now = 99;
+    QTest::qWait(150);
+    EXPECT_EQ(spy.size(), 1);
+    now = 100;
+    ASSERT_TRUE(spy.wait(1000));
+    EXPECT_EQ(lastVersion(), 2);
+
+    // only the coalesce window applies once the interval has passed
+    now = 300;
+    throttle.submit(QStringLiteral("a"), packet(3));
+    now = 319;
+    QTest::qWait(50);
+    EXPECT_EQ(spy.size(), 2);
+    now = 320;
+    ASSERT_TRUE(spy.wait(1000));
+    EXPECT_EQ(lastVersion(), 3);
+    EXPECT_EQ(throttle.sentPackets(), 3u);
+}
+
+TEST_F(PacketThrottleTests, removeDropsPendingPacket) {
+    throttle.submit(QStringLiteral("a"), packet(1));
+    throttle.submit(QStringLiteral("a"), packet(2));
+
+    EXPECT_TRUE(throttle.remove(QStringLiteral("a")));
+    EXPECT_FALSE(throttle.remove(QStringLiteral("a")));
+    EXPECT_FALSE(throttle.contains(QStringLiteral("a")));
+    EXPECT_EQ(throttle.droppedPackets(), 1u);
+
+    QTest::qWait(150);
+    EXPECT_EQ(spy.size(), 1);
+}
+
+TEST_F(PacketThrottleTests, idleKeysAreForgotten) {
+    throttle.setForgetAfter(50);
+    throttle.setMinInterval(1000);
+    throttle.submit(QStringLiteral("a"), packet(1));
+    throttle.submit(QStringLiteral("b"), packet(1));
+    throttle.submit(QStringLiteral("b"), packet(2));
+    EXPECT_EQ(throttle.count(), 2);
+
+    // without any further submit, only keys with pending packets stay
+    QTest::qWait(200);
+    EXPECT_FALSE(throttle.contains(QStringLiteral("a")));
+    EXPECT_TRUE(throttle.contains(QStringLiteral("b")));
+    EXPECT_EQ(spy.size(), 2);
+}
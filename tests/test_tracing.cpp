@@ -0,0 +1,77 @@
+/*
+ * Copyright 2019 Richard Liebscher <richard.liebscher@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <sailfishconnect/helper/tracing.h>
+
+using namespace SailfishConnect;
+
+TEST(TracingTests, scopeIsRecorded) {
+    Tracing::clear();
+    {
+        TraceScope outer("outer");
+        TraceScope inner("inner \"quoted\"");
+    }
+    EXPECT_EQ(Tracing::eventCount(), 2);
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString path = dir.path() + QStringLiteral("/trace.json");
+    ASSERT_TRUE(Tracing::writeTrace(path));
+
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    ASSERT_EQ(error.error, QJsonParseError::NoError);
+
+    const QJsonArray events = document.object().value("traceEvents").toArray();
+    ASSERT_EQ(events.size(), 2);
+
+    // inner scope ends first
+    const QJsonObject inner = events.at(0).toObject();
+    const QJsonObject outer = events.at(1).toObject();
+    EXPECT_EQ(inner.value("name").toString(), QString("inner \"quoted\""));
+    EXPECT_EQ(outer.value("name").toString(), QString("outer"));
+    EXPECT_EQ(outer.value("ph").toString(), QString("X"));
+    EXPECT_LE(outer.value("ts").toDouble(), inner.value("ts").toDouble());
+    EXPECT_GE(outer.value("dur").toDouble(), inner.value("dur").toDouble());
+    EXPECT_EQ(outer.value("tid").toDouble(), inner.value("tid").toDouble());
+
+    Tracing::clear();
+    EXPECT_EQ(Tracing::eventCount(), 0);
+}
+
+TEST(TracingTests, macroCompiledOut) {
+    Tracing::clear();
+    {
+        SC_TRACE_SCOPE("macro");
+    }
+#ifdef SAILFISHCONNECT_TRACING
+    EXPECT_EQ(Tracing::eventCount(), 1);
+#else
+    EXPECT_EQ(Tracing::eventCount(), 0);
+#endif
+    Tracing::clear();
+}
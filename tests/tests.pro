@@ -14,7 +14,9 @@ HEADERS += \
     test.h \
     mock_devicelink.h \
     mock_linkprovider.h \
-    mock_pairinghandler.h
+    mock_pairinghandler.h \
+    mock_lazy_plugin.h \
+    mock_plugin.h
 
 SOURCES += main.cpp \
     test_filehelper.cpp \
@@ -27,4 +29,20 @@ SOURCES += main.cpp \
     test.cpp \
     test_humanize.cpp \
     test_functools.cpp \
-    test_lanlinkprovider.cpp
+    test_lanlinkprovider.cpp \
+    test_latencyhistogram.cpp \
+    test_announcescheduler.cpp \
+    mock_plugin.cpp \
+    test_loopback.cpp \
+    test_configstore.cpp \
+    test_daemon.cpp \
+    test_tracing.cpp \
+    test_diskcache.cpp \
+    test_httpfetcher.cpp \
+    test_packetthrottle.cpp
+
+DEFINES += QT_STATICPLUGIN
+
+DISTFILES += \
+    mock_lazy_plugin.json \
+    mock_plugin.json